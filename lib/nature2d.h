@@ -13,7 +13,8 @@ typedef struct Object {
 
     void (*update)(struct Object *obj, double dt);
 
-    void (*draw)(struct Object *obj);
+    // alpha is how far the frame is between the last update and the next
+    void (*draw)(struct Object *obj, double alpha);
 
 } Object;
 
@@ -27,21 +28,23 @@ void object_update(Object *obj, double dt)
     body_update(&obj->body, dt);
 }
 
-Collision object_detect_collision(Object *o1, Object *o2)
+Manifold object_detect_collision(Object *o1, Object *o2)
 {
-    return collider_detect_collisions(o1->body.pos, o1->collier,o2->body.pos, o2->collier);
+    return collider_detect_collisions(o1->body.pos, &o1->collier, o2->body.pos, &o2->collier);
 }
 
 void draw_shape(Vec2 start, Shape shape, Color color);
+void draw_placed_shape(Shape shape, Color color);
 
 
 #define SHADOW_COLOR (Color){ 100, 100, 100, 100 }
 
 // Default object_draw
-void object_draw(Object *obj)
+void object_draw(Object *obj, double alpha)
 {
-    for (int i=0; i<arrlen(obj->collier); i++) {
-        draw_shape(obj->body.pos, obj->collier[i], SHADOW_COLOR);
+    Vec2 pos = body_lerp_pos(&obj->body, alpha);
+    for (int i=0; i<collider_count(&obj->collier); i++) {
+        draw_shape(pos, obj->collier.shapes[i], SHADOW_COLOR);
     }
 }
 
@@ -55,6 +58,47 @@ typedef struct World {
 
     Object *objects;
 
+    // Seconds an island has to rest before it is put to sleep
+    double time_to_sleep;
+
+    // Forces on the objects, evaluated in one pass over all of them before
+    // the objects update, see world_add_force. BodyIds index objects.
+    ForceGen *forces;
+    BodyStore force_scratch;
+
+    // Shapes of every object at its body position, placed each update
+    ShapeCache shapes;
+
+    // Finds the objects whose shapes may touch. A grid unless
+    // broadphase.type picks BROADPHASE_TREE, for objects of very different
+    // sizes, BROADPHASE_SAP, for levels spread along x, or BROADPHASE_LBVH,
+    // for many objects that all move every step. Set
+    // broadphase.grid.cell_size to fix the cell size, else it follows the
+    // objects.
+    Broadphase broadphase;
+
+    // Objects that never move, like the walls of the level. They are placed
+    // and put in static_tree once, and only again when statics_changed is
+    // set, so editing the level should set it. Statics never collide with
+    // each other, only objects look for the statics they touch.
+    Object *statics;
+    ShapeCache static_shapes;
+    StaticTree static_tree;
+    bool statics_changed;
+
+    // Objects touching statics after the last update, a is the object and
+    // b the static
+    BodyPair *static_contacts;
+    // Scratch for the statics an object overlaps
+    int *static_hits;
+
+    // Scratch for sleeping and placing shapes, reused every update
+    Body **bodies;
+    BodyPair *contacts;
+    int *islands;
+    const Collider **colliders;
+    Vec2 *positions;
+
 } World;
 
 World world_new(int width, int height)
@@ -63,6 +107,22 @@ World world_new(int width, int height)
         .width = width,
         .height = height,
         .objects = NULL,
+        .time_to_sleep = 0.5,
+        .forces = NULL,
+        .force_scratch = {0},
+        .shapes = {0},
+        .broadphase = {0},
+        .statics = NULL,
+        .static_shapes = {0},
+        .static_tree = {0},
+        .statics_changed = false,
+        .static_contacts = NULL,
+        .static_hits = NULL,
+        .bodies = NULL,
+        .contacts = NULL,
+        .islands = NULL,
+        .colliders = NULL,
+        .positions = NULL,
     };
 }
 
@@ -72,10 +132,30 @@ void world_free(World *world)
 
     int n = arrlen(world->objects);
     for (int i=0; i<n; i++) {
-        Object obj = world->objects[i];
-        object_free(&obj);
+        object_free(&world->objects[i]);
+    }
+    arrfree(world->objects);
+    for (int i=0; i < arrlen(world->forces); i++) {
+        arrfree(world->forces[i].bodies);
     }
-    free(world->objects);
+    arrfree(world->forces);
+    body_store_free(&world->force_scratch);
+    n = arrlen(world->statics);
+    for (int i=0; i<n; i++) {
+        object_free(&world->statics[i]);
+    }
+    arrfree(world->statics);
+    arrfree(world->static_contacts);
+    arrfree(world->static_hits);
+    shape_cache_free(&world->static_shapes);
+    static_tree_free(&world->static_tree);
+    arrfree(world->bodies);
+    arrfree(world->contacts);
+    arrfree(world->islands);
+    arrfree(world->colliders);
+    arrfree(world->positions);
+    shape_cache_free(&world->shapes);
+    broadphase_free(&world->broadphase);
 }
 
 void world_add_object(World *world, Object obj)
@@ -84,41 +164,227 @@ void world_add_object(World *world, Object obj)
     arrput(world->objects, obj);
 }
 
+// world_add_static adds an object that never moves. Its update is never
+// called.
+void world_add_static(World *world, Object obj)
+{
+    if (world==NULL) return;
+    arrput(world->statics, obj);
+    world->statics_changed = true;
+}
+
+// world_add_force registers a force applied to the objects every update,
+// instead of each object applying it in its update. The world takes
+// ownership of force.bodies. Returns the index of the force.
+int world_add_force(World *world, ForceGen force)
+{
+    arrput(world->forces, force);
+    return arrlen(world->forces) - 1;
+}
+
 void world_init(World *world)
 {
     if (world==NULL) return;
 
     int n = arrlen(world->objects);
     for (int i=0; i<n; i++) {
-        Object obj = world->objects[i];
-        if (obj.init != NULL ) {
-            obj.init(&obj);
+        Object *obj = &world->objects[i];
+        if (obj->init != NULL ) {
+            obj->init(obj);
         }
     }
 }
 
+// world_update_shapes places the shapes of the objects that moved.
+void world_update_shapes(World *world)
+{
+    int n = arrlen(world->objects);
+
+    arrsetlen(world->colliders, n);
+    arrsetlen(world->positions, n);
+    for (int i=0; i<n; i++) {
+        world->colliders[i] = &world->objects[i].collier;
+        world->positions[i] = world->objects[i].body.pos;
+    }
+    shape_cache_update(&world->shapes, world->colliders, world->positions, n);
+}
+
+// world_update_statics places the statics and builds their tree again,
+// only if statics_changed is set.
+void world_update_statics(World *world)
+{
+    if (!world->statics_changed) return;
+
+    int n = arrlen(world->statics);
+    arrsetlen(world->colliders, n);
+    arrsetlen(world->positions, n);
+    for (int i=0; i<n; i++) {
+        world->colliders[i] = &world->statics[i].collier;
+        world->positions[i] = world->statics[i].body.pos;
+    }
+    // Shapes may have been edited without moving
+    shape_cache_reset(&world->static_shapes);
+    shape_cache_update(&world->static_shapes, world->colliders, world->positions, n);
+    static_tree_build(&world->static_tree, world->static_shapes.box, n);
+    world->statics_changed = false;
+}
+
+// Finds the statics whose boxes overlap box, in world->static_hits.
+static int world_query_statics(World *world, AABB box)
+{
+    int found;
+    while ((found = static_tree_query(&world->static_tree, box,
+                    world->static_hits, arrlen(world->static_hits))) == arrlen(world->static_hits)) {
+        // Maybe more, look again with room for them
+        arrsetlen(world->static_hits, 2 * found + 16);
+    }
+    return found;
+}
+
+// world_update_static_contacts finds the statics each awake object
+// touches, in static_contacts.
+void world_update_static_contacts(World *world)
+{
+    int n = arrlen(world->objects);
+
+    arrsetlen(world->static_contacts, 0);
+    if (arrlen(world->statics) == 0) return;
+
+    for (int i=0; i<n; i++) {
+        Body *body = &world->objects[i].body;
+        if (body->sleeping || body->mass == 0) continue;
+
+        int found = world_query_statics(world, world->shapes.box[i]);
+        for (int k=0; k<found; k++) {
+            int s = world->static_hits[k];
+            ColliderContact contact;
+            if (shape_caches_collide(&world->shapes, i, &world->static_shapes, s, &contact, 1) > 0) {
+                arrput(world->static_contacts, ((BodyPair){i, s}));
+            }
+        }
+    }
+}
+
+// world_collide_statics finds the contacts of obj, in or out of the world,
+// with the statics, up to max_contacts. Returns how many it found.
+int world_collide_statics(World *world, Object *obj, ColliderContact *contacts, int max_contacts)
+{
+    if (world==NULL) return 0;
+    world_update_statics(world);
+
+    AABB box = collider_aabb(&obj->collier, obj->body.pos);
+    int found = world_query_statics(world, box);
+    int count = 0;
+    for (int k=0; k<found && count<max_contacts; k++) {
+        Object *s = &world->statics[world->static_hits[k]];
+        count += collider_collide(obj->body.pos, &obj->collier, s->body.pos, &s->collier,
+                contacts + count, max_contacts - count);
+    }
+    return count;
+}
+
+// world_update_sleep finds which objects touch and lets resting islands
+// fall asleep. Only the pairs the broadphase finds are tested. Pairs where both
+// are asleep are not, so a sleeping pile costs nothing until something
+// awake touches it.
+void world_update_sleep(World *world, double dt)
+{
+    int n = arrlen(world->objects);
+
+    arrsetlen(world->bodies, n);
+    arrsetlen(world->contacts, 0);
+    for (int i=0; i<n; i++) {
+        world->bodies[i] = &world->objects[i].body;
+    }
+
+    int pairs;
+    broadphase_update(&world->broadphase, world->shapes.box, n);
+    const BodyPair *found = broadphase_pairs(&world->broadphase, &pairs);
+    for (int k=0; k<pairs; k++) {
+        BodyPair pair = found[k];
+        Body *a = &world->objects[pair.a].body;
+        Body *b = &world->objects[pair.b].body;
+        if (a->sleeping && b->sleeping) continue;
+        if (a->mass == 0 || b->mass == 0) continue;
+
+        ColliderContact contact;
+        if (shape_cache_collide(&world->shapes, pair.a, pair.b, &contact, 1) > 0) {
+            arrput(world->contacts, pair);
+        }
+    }
+
+    bodies_update_sleep(world->bodies, n,
+            world->contacts, arrlen(world->contacts),
+            world->time_to_sleep, dt, &world->islands);
+}
+
 void world_update(World *world, double dt)
 {
     if (world==NULL) return;
 
     int n = arrlen(world->objects);
+    arrsetlen(world->bodies, n);
+    for (int i=0; i<n; i++) {
+        world->bodies[i] = &world->objects[i].body;
+    }
+    bodies_apply_forces(world->bodies, n, world->forces, arrlen(world->forces),
+            &world->force_scratch);
+
+    // Sleeping objects update too, their forces are what wakes them, and
+    // body_update doesn't move them while they sleep
     for (int i=0; i<n; i++) {
-        Object obj = world->objects[i];
-        if (obj.update != NULL ) {
-            obj.update(&obj, dt);
+        Object *obj = &world->objects[i];
+        if (obj->update != NULL ) {
+            obj->update(obj, dt);
         }
     }
+
+    world_update_statics(world);
+    world_update_shapes(world);
+    world_update_static_contacts(world);
+    world_update_sleep(world, dt);
 }
 
-void world_draw(World *world)
+void world_draw(World *world, double alpha)
 {
     if (world==NULL) return;
 
-    int n = arrlen(world->objects);
+    // Statics are always where they were placed
+    int n = arrlen(world->statics);
+    bool placed = !world->statics_changed && shape_cache_count(&world->static_shapes) == n;
+    for (int i=0; i<n; i++) {
+        Object *obj = &world->statics[i];
+        if (placed && obj->draw == object_draw) {
+            int num_shapes;
+            const Shape *shapes = shape_cache_shapes(&world->static_shapes, i, &num_shapes);
+            for (int j=0; j<num_shapes; j++) {
+                draw_placed_shape(shapes[j], SHADOW_COLOR);
+            }
+            continue;
+        }
+        if (obj->draw != NULL ) {
+            obj->draw(obj, alpha);
+        }
+    }
+
+    n = arrlen(world->objects);
+    placed = shape_cache_count(&world->shapes) == n;
     for (int i=0; i<n; i++) {
-        Object obj = world->objects[i];
-        if (obj.draw != NULL ) {
-            obj.draw(&obj);
+        Object *obj = &world->objects[i];
+
+        // Resting objects draw their placed shapes, there is nothing to lerp
+        Body *body = &obj->body;
+        if (placed && obj->draw == object_draw && vec2_equal(body->pos, body->prev_pos)) {
+            int num_shapes;
+            const Shape *shapes = shape_cache_shapes(&world->shapes, i, &num_shapes);
+            for (int j=0; j<num_shapes; j++) {
+                draw_placed_shape(shapes[j], SHADOW_COLOR);
+            }
+            continue;
+        }
+
+        if (obj->draw != NULL ) {
+            obj->draw(obj, alpha);
         }
     }
 }
@@ -159,8 +425,13 @@ void draw_poly(Poly poly, Color color)
 
 void draw_shape(Vec2 start, Shape shape, Color color)
 {
-    Shape s = shape_offset(start, shape);
-    switch (shape.type) {
+    draw_placed_shape(shape_offset(start, shape), color);
+}
+
+// draw_placed_shape draws a shape that is already in world space.
+void draw_placed_shape(Shape s, Color color)
+{
+    switch (s.type) {
         case POINT: draw_point(s.point, color); break;
         case LINE: draw_line(s.line, color); break;
         case CIRCLE: draw_circle(s.circle, color); break;
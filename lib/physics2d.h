@@ -43,36 +43,66 @@ This include this in one C files:
 #include <stdlib.h>
 #include <math.h>
 #include <stdarg.h>
+#include <float.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-static inline double normalize(double value, double start, double end)
+/**
+ * Scalar type
+ *
+ * p2_real is the floating point type used by the whole engine. It is double
+ * by default, define PHYSICS2D_USE_FLOAT before including this file to build
+ * everything with float instead.
+ */
+#ifdef PHYSICS2D_USE_FLOAT
+typedef float p2_real;
+#define p2_sqrt sqrtf
+#define p2_fabs fabsf
+#define p2_floor floorf
+#define P2_REAL_MAX FLT_MAX
+#define P2_REAL_EPSILON FLT_EPSILON
+#else
+typedef double p2_real;
+#define p2_sqrt sqrt
+#define p2_fabs fabs
+#define p2_floor floor
+#define P2_REAL_MAX DBL_MAX
+#define P2_REAL_EPSILON DBL_EPSILON
+#endif
+
+static inline p2_real normalize(p2_real value, p2_real start, p2_real end)
 {
     return (value - start) / (end - start);
 }
 
-static inline double lerp(double start, double end, double amount)
+static inline p2_real lerp(p2_real start, p2_real end, p2_real amount)
 {
     return start + amount * (end - start);
 }
 
-static inline double map(const double value,
-        const double start1, const double stop1,
-        const double start2, const double stop2)
+static inline p2_real map(const p2_real value,
+        const p2_real start1, const p2_real stop1,
+        const p2_real start2, const p2_real stop2)
 {
     return (value - start1) / (stop1 - start1) * (stop2 - start2) + start2;
 }
 
-static inline double max(const double a, const double b)
+static inline p2_real max(const p2_real a, const p2_real b)
 {
     return (a > b)? a : b;
 }
 
-static inline double min(const double a, const double b)
+static inline p2_real min(const p2_real a, const p2_real b)
 {
     return (a < b)? a : b;
 }
 
-// equalp compares two doubles for equality with given percision.
-static inline bool equalp(double a, double b, int percision)
+// equalp compares two reals for equality with given percision.
+static inline bool equalp(p2_real a, p2_real b, int percision)
 {
     int multi = pow(10, percision);
     int value_a = (int)(a * multi + 0.5); 
@@ -80,15 +110,63 @@ static inline bool equalp(double a, double b, int percision)
     return value_a == value_b;
 }
 
+/**
+ * Random numbers
+ *
+ * Rng is a PCG32 generator (pcg-random.org). Its whole state is the struct,
+ * so give each thread or world its own Rng and the numbers it makes depend
+ * only on its seed. Two Rngs with the same seed and different streams give
+ * independent sequences.
+ */
+typedef struct Rng {
+    uint64_t state;
+    // Stream, always odd
+    uint64_t inc;
+} Rng;
+
+extern Rng rng_new(uint64_t seed, uint64_t stream);
+extern void rng_seed(Rng *rng, uint64_t seed, uint64_t stream);
+extern void rng_fill_uniform(Rng *rng, p2_real *out, int n, p2_real min, p2_real max);
+
+// rng_default is the generator used by randfrom and vec2_random, one per
+// thread. It is seeded with 0 until rng_seed_default is called. Each
+// thread gets its own stream, in the order the threads first use it, the
+// first is stream 0. Threads that need the same numbers every run should
+// use their own Rng.
+extern Rng *rng_default();
+extern void rng_seed_default(uint64_t seed);
+
+static inline uint32_t rng_next_u32(Rng *rng)
+{
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+    uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+    uint32_t rot = old >> 59;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Uniform in [0, 1)
+static inline p2_real rng_uniform(Rng *rng)
+{
+#ifdef PHYSICS2D_USE_FLOAT
+    return (rng_next_u32(rng) >> 8) * 0x1p-24f;
+#else
+    return rng_next_u32(rng) * 0x1p-32;
+#endif
+}
+
+// Uniform in [min, max)
+static inline p2_real rng_range(Rng *rng, p2_real min, p2_real max)
+{
+    return min + rng_uniform(rng) * (max - min);
+}
+
 /* generate a random floating point number from min to max 
- * #include <time.h>
- * srand(time(NULL));
+ * Seed with rng_seed_default.
  * */
-static double randfrom(double min, double max) 
+static inline p2_real randfrom(p2_real min, p2_real max) 
 {
-    double range = (max - min); 
-    double div = RAND_MAX / range;
-    return min + (rand() / div);
+    return rng_range(rng_default(), min, max);
 }
 
 extern void noise_seed(int seed);
@@ -103,13 +181,13 @@ extern double noise3(double x, double y, double z);
  * 
  */
 typedef struct Vec2 {
-    double x;
-    double y;
+    p2_real x;
+    p2_real y;
 } Vec2;
 
 static const Vec2 vec2zero = {0.0f, 0.0f};
 
-static inline Vec2 vec2(const double x, const double y)
+static inline Vec2 vec2(const p2_real x, const p2_real y)
 {
     return (Vec2){x, y};
 }
@@ -124,42 +202,42 @@ static inline Vec2 vec2_sub(const Vec2 a, const Vec2 b)
     return vec2(a.x - b.x, a.y - b.y);
 }
 
-static inline double vec2_dot(const Vec2 a, const Vec2 b)
+static inline p2_real vec2_dot(const Vec2 a, const Vec2 b)
 {
     return a.x * b.x + a.y * b.y;
 }
 
 // Returns the magnitude (length) of the vector.
-static inline double vec2_mag(const Vec2 v)
+static inline p2_real vec2_mag(const Vec2 v)
 {
-    return sqrtf(v.x * v.x + v.y * v.y);
+    return p2_sqrt(v.x * v.x + v.y * v.y);
 }
 
 // Returns the magnitude (length) of the vector squared.
-static inline double vec2_mag_sq(const Vec2 v)
+static inline p2_real vec2_mag_sq(const Vec2 v)
 {
     return v.x * v.x + v.y * v.y;
 }
 
-static inline Vec2 vec2_mult(const Vec2 v, const double m)
+static inline Vec2 vec2_mult(const Vec2 v, const p2_real m)
 {
     return vec2(v.x * m, v.y * m);
 }
 
-static inline Vec2 vec2_div(const Vec2 v, const double m)
+static inline Vec2 vec2_div(const Vec2 v, const p2_real m)
 {
     return m == 0 ? vec2zero : vec2(v.x / m, v.y / m);
 }
 
 static inline Vec2 vec2_normalize(const Vec2 v)
 {
-    double mag = vec2_mag(v);
+    p2_real mag = vec2_mag(v);
     return mag == 0 ? vec2zero : vec2(v.x/mag, v.y/mag);
 }
 
 // Set the magnitude (length) of the vector.
 // Returns a new Vec2.
-static inline Vec2 vec2_set_mag(const Vec2 v, double m)
+static inline Vec2 vec2_set_mag(const Vec2 v, p2_real m)
 {
     return vec2_mult(vec2_normalize(v), m);
 }
@@ -180,21 +258,29 @@ static inline bool vec2_equalp(const Vec2 a, const Vec2 b, int percision)
         && equalp(a.y, b.y, percision);
 }
 
+// Random vector with both components in [-1, 1)
+static inline Vec2 rng_vec2(Rng *rng)
+{
+    p2_real x = rng_range(rng, -1, 1);
+    p2_real y = rng_range(rng, -1, 1);
+    return vec2(x, y);
+}
+
+extern void rng_fill_vec2(Rng *rng, Vec2 *out, int n, p2_real min, p2_real max);
+
 /* First seed:
  * #include <time.h>
- * srand(time(NULL));
+ * rng_seed_default(time(NULL));
  */
 static inline Vec2 vec2_random()
 {
-    double x = randfrom(-1, 1);
-    double y = randfrom(-1, 1);
-    return vec2(x, y);
+    return rng_vec2(rng_default());
 }
 
 // Limits a vector's magnitude to a maximum value. 
-static inline Vec2 vec2_limit(const Vec2 v, double max)
+static inline Vec2 vec2_limit(const Vec2 v, p2_real max)
 {
-    double mag = vec2_mag(v);
+    p2_real mag = vec2_mag(v);
     if (mag <= max) return v;
     return vec2_set_mag(v, max);
 }
@@ -205,29 +291,32 @@ static inline Vec2 vec2_limit(const Vec2 v, double max)
 
 // Calculates the angle a 2D vector makes with the positive x-axis. Angles
 // increase in the clockwise direction.p
-static inline double vec2_heading(const Vec2 v);
+static inline p2_real vec2_heading(const Vec2 v);
 
 // Rotates a 2D vector to a specific angle without changing its magnitude. By
 // convention, the positive x-axis has an angle of 0. Angles increase in the
 // clockwise direction.
-static inline Vec2 vec2_set_heading(const Vec2 v, double angle);
+static inline Vec2 vec2_set_heading(const Vec2 v, p2_real angle);
 
 // Rotates a 2D vector by an angle without changing its magnitude. By
 // convention, the positive x-axis has an angle of 0. Angles increase in the
 // clockwise direction.
-static inline Vec2 vec2_rotate(const Vec2 v, double angle);
+static inline Vec2 vec2_rotate(const Vec2 v, p2_real angle);
 
 // Returns the angle between two vectors. The angle returned are signed.
-static inline double vec2_angle_between(const Vec2 a, const Vec2 b);
+static inline p2_real vec2_angle_between(const Vec2 a, const Vec2 b);
+
+*/
 
 // Calculates new x and y components that are proportionally the same
 // distance between two vectors. The amt parameter is the amount to interpolate
 // between the old vector and the new vector. 0.0 keeps all components equal to
 // the old vector's, 0.5 is halfway between, and 1.0 sets all components equal
 // to the new vector's.
-static inline double vec2_lerp(const Vec2 a, const Vec2 b, const double amp);
-
-*/
+static inline Vec2 vec2_lerp(const Vec2 a, const Vec2 b, const p2_real amt)
+{
+    return vec2(lerp(a.x, b.x, amt), lerp(a.y, b.y, amt));
+}
 
 static inline void debug_vec2(char* name, Vec2 v)
 {
@@ -235,6 +324,41 @@ static inline void debug_vec2(char* name, Vec2 v)
 }
 
 
+/**
+ * Vec2 array functions
+ *
+ * Batch versions of the Vec2 functions above, working on n contiguous
+ * vectors at a time. out may be the same array as an input.
+ *
+ * The SIMD instruction set is picked at runtime (AVX2 or SSE2 on x86,
+ * NEON on ARM64) with a portable scalar fallback. Define PHYSICS2D_NO_SIMD
+ * to always use the scalar version.
+ */
+typedef enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_NEON,
+} SimdLevel;
+
+// Returns the instruction set the array functions are using.
+extern SimdLevel simd_level();
+// Forces an instruction set, mostly for testing and benchmarks.
+// Returns the level actually used, which is SIMD_SCALAR if the CPU
+// does not support the requested one.
+extern SimdLevel simd_set_level(SimdLevel level);
+extern const char *simd_level_name(SimdLevel level);
+
+extern void vec2_add_n(Vec2 *out, const Vec2 *a, const Vec2 *b, int n);
+extern void vec2_sub_n(Vec2 *out, const Vec2 *a, const Vec2 *b, int n);
+extern void vec2_mult_n(Vec2 *out, const Vec2 *v, p2_real m, int n);
+// out = a + b * s, for integration and force accumulation.
+extern void vec2_add_scaled_n(Vec2 *out, const Vec2 *a, const Vec2 *b, p2_real s, int n);
+extern void vec2_normalize_n(Vec2 *out, const Vec2 *v, int n);
+extern void vec2_set_mag_n(Vec2 *out, const Vec2 *v, p2_real m, int n);
+extern void vec2_limit_n(Vec2 *out, const Vec2 *v, p2_real max, int n);
+
+
 /**
  * Body is a physics body that lives in an enviroment.
  * 
@@ -244,6 +368,9 @@ typedef struct Body {
     // Position
     Vec2 pos;
 
+    // Position before the last update, for drawing between updates
+    Vec2 prev_pos;
+
     // Velocity
     Vec2 vel;
 
@@ -251,20 +378,451 @@ typedef struct Body {
     Vec2 acc;
 
     // Mass
-    double mass;
+    p2_real mass;
 
     // Maximum speed
-    double max_speed;
+    p2_real max_speed;
+
+    // Speed below which the body counts as resting, negative never sleeps
+    p2_real sleep_speed;
+
+    // Seconds the body has been resting
+    p2_real sleep_time;
+
+    // Sleeping bodies are skipped by body_update until woken
+    bool sleeping;
+
+    // Island the body fell asleep in, -1 while awake
+    int island;
 
 } Body;
 
+// Default Body.sleep_speed
+#define BODY_SLEEP_SPEED 2.0
+
 extern Body *body_alloc();
-extern void body_init(Body *body, Vec2 pos, double mass);
-extern Body *body_new(Vec2 pos, float mass);
+extern void body_init(Body *body, Vec2 pos, p2_real mass);
+extern Body *body_new(Vec2 pos, p2_real mass);
 extern void body_apply_force(Body *body, const Vec2 force);
 extern void body_apply_gravity(Body *body, const Vec2 gravity);
-extern void body_update(Body *body, const double dt);
+extern void body_update(Body *body, const p2_real dt);
+extern void body_set_pos(Body *body, Vec2 pos);
+extern Vec2 body_lerp_pos(const Body *body, p2_real alpha);
 extern Vec2 body_momentum(Body *body);
+extern void body_wake(Body *body);
+
+// BodyPair is a pair of touching bodies, by index.
+typedef struct BodyPair {
+    int a;
+    int b;
+} BodyPair;
+
+extern void bodies_update_sleep(Body **bodies, int n,
+        const BodyPair *contacts, int num_contacts,
+        p2_real time_to_sleep, p2_real dt, int **scratch);
+
+
+/**
+ * BodyPool allocates bodies from one contiguous block instead of a malloc
+ * per body.
+ *
+ * Live bodies are packed at the front of the bodies array, so iterating
+ * them is a plain loop over body_pool_count bodies. Destroying a body moves
+ * the last body into its place, so Body pointers are only good until the
+ * next create or destroy. Hold a BodyHandle instead.
+ *
+ * A BodyHandle is a slot index plus the generation of the slot. Every time
+ * a slot is reused its generation goes up, so a handle to a destroyed body
+ * is detected (body_pool_get returns NULL) instead of pointing at whatever
+ * body took its place.
+ */
+typedef uint32_t BodyHandle;
+
+// BodyHandle is BODY_HANDLE_INDEX_BITS of slot index, the rest generation.
+#define BODY_HANDLE_INDEX_BITS 20
+#define BODY_HANDLE_INDEX_MASK ((1u << BODY_HANDLE_INDEX_BITS) - 1)
+#define BODY_HANDLE_GEN_MASK ((1u << (32 - BODY_HANDLE_INDEX_BITS)) - 1)
+#define BODY_POOL_MAX (1 << BODY_HANDLE_INDEX_BITS)
+
+// Never a valid handle, generations start at 1.
+#define BODY_HANDLE_NONE 0
+
+// Where a slot's body is in BodyPool.bodies and the slot's generation, kept
+// together so a handle lookup touches one cache line.
+typedef struct BodySlot {
+    uint32_t dense;
+    uint32_t gen;
+} BodySlot;
+
+typedef struct BodyPool {
+    // Live bodies, packed
+    Body *bodies;
+    // Slot of each live body, parallel to bodies
+    uint32_t *dense_slot;
+
+    BodySlot *slots;
+
+    // Slots free to reuse
+    uint32_t *free_slots;
+} BodyPool;
+
+extern BodyPool body_pool_new();
+extern void body_pool_free(BodyPool *pool);
+extern void body_pool_reserve(BodyPool *pool, int n);
+extern int body_pool_count(const BodyPool *pool);
+extern BodyHandle body_pool_create(BodyPool *pool, Vec2 pos, p2_real mass);
+extern bool body_pool_destroy(BodyPool *pool, BodyHandle handle);
+extern bool body_pool_valid(const BodyPool *pool, BodyHandle handle);
+extern Body *body_pool_get(BodyPool *pool, BodyHandle handle);
+extern BodyHandle body_pool_handle(const BodyPool *pool, int i);
+extern void body_pool_update_all(BodyPool *pool, const p2_real dt);
+
+
+/**
+ * Integrator is the numerical method used to step bodies forward in time.
+ */
+typedef enum Integrator {
+    // Semi-implicit (symplectic) Euler, the same as body_update.
+    INTEGRATOR_EULER,
+    // Velocity Verlet. Second order, evaluates the accel field twice a step.
+    INTEGRATOR_VERLET,
+    // Classic fourth order Runge-Kutta. Evaluates the accel field four
+    // times a step.
+    INTEGRATOR_RK4,
+} Integrator;
+
+extern const char *integrator_name(Integrator integrator);
+
+struct BodyStore;
+
+// AccelFunc is an acceleration field, for forces that depend on where the
+// bodies are or how fast they move (springs, orbits). It must set acc_x and
+// acc_y of every body in the store for the given positions and velocities,
+// which may be an intermediate state of the integrator.
+typedef void (*AccelFunc)(const struct BodyStore *store, void *ctx,
+        const p2_real *pos_x, const p2_real *pos_y,
+        const p2_real *vel_x, const p2_real *vel_y,
+        p2_real *acc_x, p2_real *acc_y);
+
+typedef int BodyId;
+
+/**
+ * Force generators
+ *
+ * A ForceGen is a force that is applied every step, registered once with
+ * body_store_add_force instead of calling body_apply_force from Update.
+ * The store evaluates all of them in one pass per force over the columns,
+ * each time the integrator needs the acceleration, so velocity and position
+ * dependent forces (drag, springs) are also right for Verlet and RK4.
+ */
+typedef enum ForceType {
+    // Uniform gravity, the same acceleration for every body with mass.
+    FORCE_GRAVITY,
+    // f = -k v
+    FORCE_LINEAR_DRAG,
+    // f = -k |v| v
+    FORCE_QUADRATIC_DRAG,
+    // Coulomb friction, f = -u N v/|v|
+    FORCE_FRICTION,
+    // Pulls toward a point, a = strength / r^2
+    FORCE_ATTRACTOR,
+    // Damped spring between two bodies, or a body and a fixed anchor.
+    FORCE_SPRING,
+} ForceType;
+
+typedef struct ForceGen {
+    ForceType type;
+
+    // Bodies the force acts on, an stb_ds array owned by the ForceGen.
+    // NULL for every body in the store. Not used by springs.
+    BodyId *bodies;
+
+    // FORCE_GRAVITY
+    Vec2 gravity;
+
+    // FORCE_LINEAR_DRAG, FORCE_QUADRATIC_DRAG and FORCE_FRICTION
+    p2_real coefficient;
+    // FORCE_FRICTION normal force
+    p2_real normal;
+
+    // FORCE_ATTRACTOR
+    Vec2 point;
+    p2_real strength;
+    // Distance under which the pull stops growing
+    p2_real min_dist;
+
+    // FORCE_SPRING, b is -1 for a spring from a to anchor.
+    BodyId a, b;
+    Vec2 anchor;
+    p2_real stiffness;
+    p2_real damping;
+    p2_real rest_length;
+} ForceGen;
+
+extern ForceGen force_gravity(Vec2 gravity);
+extern ForceGen force_linear_drag(p2_real k);
+extern ForceGen force_quadratic_drag(p2_real k);
+extern ForceGen force_friction(p2_real coff, p2_real normal);
+extern ForceGen force_attractor(Vec2 point, p2_real strength, p2_real min_dist);
+extern ForceGen force_spring(BodyId a, BodyId b, p2_real stiffness, p2_real damping, p2_real rest_length);
+extern ForceGen force_anchored_spring(BodyId a, Vec2 anchor, p2_real stiffness, p2_real damping, p2_real rest_length);
+extern void force_add_body(ForceGen *force, BodyId id);
+extern const char *force_name(ForceType type);
+
+extern Vec2 friction(Vec2 vel, p2_real coff, p2_real n);
+extern Vec2 drag(Vec2 vel, p2_real coff, p2_real n);
+
+/**
+ * BodyStore holds many bodies as a structure of arrays.
+ *
+ * Each field of Body is its own column, so a pass over every body walks
+ * contiguous memory instead of chasing individually allocated Body pointers.
+ * Columns are stb_ds arrays and always have the same length.
+ *
+ * A body in the store is addressed by its BodyId (the row index).
+ */
+typedef struct BodyStore {
+    p2_real *pos_x;
+    p2_real *pos_y;
+    p2_real *vel_x;
+    p2_real *vel_y;
+    p2_real *acc_x;
+    p2_real *acc_y;
+    p2_real *mass;
+    // 1/mass, or 0 for a zero mass body
+    p2_real *inv_mass;
+    p2_real *max_speed;
+
+    // Working columns for the integrators
+    p2_real *scratch;
+
+    // Integrator used by body_store_update_all, INTEGRATOR_EULER by default.
+    Integrator integrator;
+
+    // Optional acceleration field, added to the applied forces while
+    // integrating.
+    AccelFunc accel;
+    void *accel_ctx;
+
+    // Registered force generators, see body_store_add_force.
+    ForceGen *forces;
+} BodyStore;
+
+extern BodyStore body_store_new();
+extern void body_store_free(BodyStore *store);
+extern void body_store_reserve(BodyStore *store, int n);
+extern int body_store_count(const BodyStore *store);
+extern BodyId body_store_add(BodyStore *store, Vec2 pos, p2_real mass);
+extern BodyId body_store_push(BodyStore *store, Body body);
+extern void body_store_remove(BodyStore *store, BodyId id);
+extern void body_store_update_all(BodyStore *store, const p2_real dt);
+extern int body_store_add_force(BodyStore *store, ForceGen force);
+extern void body_store_clear_forces(BodyStore *store);
+
+// Handle API, for reading and writing a single body in the store.
+extern Body body_store_get(const BodyStore *store, BodyId id);
+extern void body_store_set(BodyStore *store, BodyId id, Body body);
+extern Vec2 body_store_pos(const BodyStore *store, BodyId id);
+extern Vec2 body_store_vel(const BodyStore *store, BodyId id);
+extern void body_store_set_pos(BodyStore *store, BodyId id, Vec2 pos);
+extern void body_store_set_vel(BodyStore *store, BodyId id, Vec2 vel);
+extern void body_store_apply_force(BodyStore *store, BodyId id, const Vec2 force);
+extern void body_store_apply_gravity(BodyStore *store, BodyId id, const Vec2 gravity);
+extern uint64_t body_store_checksum(const BodyStore *store);
+
+extern void bodies_apply_forces(Body **bodies, int n, const ForceGen *forces, int num_forces,
+        BodyStore *scratch);
+
+
+/**
+ * Fixed point
+ *
+ * p2_fixed is a Q16.16 fixed point number, for lockstep simulations that
+ * must give bit identical results on every machine and compiler. Only
+ * integer arithmetic is used, with 64 bit intermediates, so nothing depends
+ * on the floating point unit, the optimization level or libm.
+ *
+ * The range is about -32768 to 32767 with a resolution of 1/65536. Adding
+ * and subtracting saturate at the ends of the range instead of overflowing.
+ * Convert with fix_from_real only when setting up a scene, after that
+ * everything that feeds the simulation should stay in fixed point.
+ */
+typedef int32_t p2_fixed;
+
+#define FIX_SHIFT 16
+#define FIX_ONE (1 << FIX_SHIFT)
+#define FIX_MAX INT32_MAX
+#define FIX_MIN INT32_MIN
+
+static inline p2_fixed fix_from_int(int a)
+{
+    return (p2_fixed) ((uint32_t) a << FIX_SHIFT);
+}
+
+static inline p2_fixed fix_from_real(p2_real a)
+{
+    return (p2_fixed) floor(a * FIX_ONE + 0.5);
+}
+
+static inline p2_real fix_to_real(p2_fixed a)
+{
+    return (p2_real) a / FIX_ONE;
+}
+
+static inline p2_fixed fix_saturate(int64_t a)
+{
+    return a > FIX_MAX ? FIX_MAX : a < FIX_MIN ? FIX_MIN : (p2_fixed) a;
+}
+
+static inline p2_fixed fix_add(p2_fixed a, p2_fixed b)
+{
+    return fix_saturate((int64_t) a + b);
+}
+
+static inline p2_fixed fix_sub(p2_fixed a, p2_fixed b)
+{
+    return fix_saturate((int64_t) a - b);
+}
+
+static inline p2_fixed fix_mul(p2_fixed a, p2_fixed b)
+{
+    return (p2_fixed) (((int64_t) a * b) >> FIX_SHIFT);
+}
+
+// Dividing by zero saturates.
+static inline p2_fixed fix_div(p2_fixed a, p2_fixed b)
+{
+    if (b == 0) return a >= 0 ? FIX_MAX : FIX_MIN;
+    return (p2_fixed) ((int64_t) a * FIX_ONE / b);
+}
+
+static inline p2_fixed fix_min(p2_fixed a, p2_fixed b)
+{
+    return (a < b)? a : b;
+}
+
+static inline p2_fixed fix_max(p2_fixed a, p2_fixed b)
+{
+    return (a > b)? a : b;
+}
+
+extern uint64_t isqrt64(uint64_t n);
+extern p2_fixed fix_sqrt(p2_fixed a);
+
+typedef struct FixVec2 {
+    p2_fixed x;
+    p2_fixed y;
+} FixVec2;
+
+#define fixvec2zero (FixVec2){0, 0}
+
+static inline FixVec2 fixvec2(p2_fixed x, p2_fixed y)
+{
+    return (FixVec2){x, y};
+}
+
+static inline FixVec2 fixvec2_from_vec2(Vec2 v)
+{
+    return fixvec2(fix_from_real(v.x), fix_from_real(v.y));
+}
+
+static inline Vec2 fixvec2_to_vec2(FixVec2 v)
+{
+    return vec2(fix_to_real(v.x), fix_to_real(v.y));
+}
+
+static inline FixVec2 fixvec2_add(FixVec2 a, FixVec2 b)
+{
+    return fixvec2(fix_add(a.x, b.x), fix_add(a.y, b.y));
+}
+
+static inline FixVec2 fixvec2_sub(FixVec2 a, FixVec2 b)
+{
+    return fixvec2(fix_sub(a.x, b.x), fix_sub(a.y, b.y));
+}
+
+static inline FixVec2 fixvec2_mult(FixVec2 v, p2_fixed m)
+{
+    return fixvec2(fix_mul(v.x, m), fix_mul(v.y, m));
+}
+
+static inline FixVec2 fixvec2_div(FixVec2 v, p2_fixed d)
+{
+    return fixvec2(fix_div(v.x, d), fix_div(v.y, d));
+}
+
+static inline bool fixvec2_equal(FixVec2 a, FixVec2 b)
+{
+    return a.x == b.x && a.y == b.y;
+}
+
+static inline p2_fixed fixvec2_dot(FixVec2 a, FixVec2 b)
+{
+    return (p2_fixed) (((int64_t) a.x * b.x + (int64_t) a.y * b.y) >> FIX_SHIFT);
+}
+
+// Squared magnitude in Q32.32, which does not overflow for any FixVec2.
+static inline uint64_t fixvec2_mag_sq_wide(FixVec2 v)
+{
+    return (uint64_t) ((int64_t) v.x * v.x) + (uint64_t) ((int64_t) v.y * v.y);
+}
+
+static inline p2_fixed fixvec2_mag(FixVec2 v)
+{
+    // sqrt of a Q32.32 is a Q16.16
+    uint64_t mag = isqrt64(fixvec2_mag_sq_wide(v));
+    return mag > FIX_MAX ? FIX_MAX : (p2_fixed) mag;
+}
+
+extern FixVec2 fixvec2_normalize(FixVec2 v);
+extern FixVec2 fixvec2_set_mag(FixVec2 v, p2_fixed m);
+extern FixVec2 fixvec2_limit(FixVec2 v, p2_fixed max);
+
+// FixBody is Body in fixed point.
+typedef struct FixBody {
+    FixVec2 pos;
+    FixVec2 vel;
+    FixVec2 acc;
+    // 1/mass, 0 for a static body
+    p2_fixed inv_mass;
+    // Negative for no limit
+    p2_fixed max_speed;
+} FixBody;
+
+extern void fix_body_init(FixBody *body, FixVec2 pos, p2_fixed mass);
+extern void fix_body_apply_force(FixBody *body, FixVec2 force);
+extern void fix_body_apply_gravity(FixBody *body, FixVec2 gravity);
+extern void fix_body_update(FixBody *body, p2_fixed dt);
+extern uint64_t fix_bodies_checksum(const FixBody *bodies, int n);
+
+// Fixed point shapes, positions are in world space.
+typedef struct FixCircle {
+    FixVec2 center;
+    p2_fixed radius;
+} FixCircle;
+
+typedef struct FixRect {
+    FixVec2 pos;
+    p2_fixed width;
+    p2_fixed height;
+} FixRect;
+
+// FixContact is the result of a fixed point collision test. normal points
+// from the first shape to the second and depth is how far they overlap.
+typedef struct FixContact {
+    bool hit;
+    FixVec2 normal;
+    p2_fixed depth;
+} FixContact;
+
+extern FixContact fix_circle_collide(FixCircle a, FixCircle b);
+extern FixContact fix_rect_collide(FixRect a, FixRect b);
+extern FixContact fix_circle_rect_collide(FixCircle a, FixRect b);
+
+// checksum_bytes folds size bytes of data into hash (64 bit FNV-1a). Start
+// with CHECKSUM_INIT.
+#define CHECKSUM_INIT 0xcbf29ce484222325ULL
+extern uint64_t checksum_bytes(uint64_t hash, const void *data, size_t size);
 
 
 /************
@@ -287,7 +845,7 @@ typedef struct Line {
 // Circle
 typedef struct Circle {
     Vec2 center;
-    double radius;
+    p2_real radius;
 } Circle;
 
 
@@ -306,18 +864,42 @@ typedef struct Quad {
     Vec2 v4;
 } Quad;
 
-// Polygon
+// Polygon. Up to POLY_INLINE_VERTS vertices are kept in the struct, so
+// polys are made and copied like the other shapes. Bigger ones, up to
+// POLY_MAX_VERTS, keep theirs in a PolyArena and get moved by offset.
+#define POLY_INLINE_VERTS 8
+#define POLY_MAX_VERTS 64
+
 typedef struct Poly {
     int n;
-    Vec2 *v;
+    // Center of the area, moved along with the vertices
+    Vec2 centroid;
+    // n vertices followed by n normals in an arena, NULL for inline polys
+    Vec2 *ext;
+    // Added to the arena vertices on use
+    Vec2 offset;
+    Vec2 v[POLY_INLINE_VERTS];
+    // Outward unit normal of the edge from v[i] to v[i + 1]
+    Vec2 normals[POLY_INLINE_VERTS];
 } Poly;
 
+// PolyArena hands out vertex storage for big polys in blocks of
+// POLY_ARENA_BLOCK, so only every few polys touch the heap. The polys stay
+// valid until poly_arena_free.
+#define POLY_ARENA_BLOCK 4096
+
+typedef struct PolyArena {
+    // stb_ds array of blocks, the last one is filled up to used
+    Vec2 **blocks;
+    int used;
+} PolyArena;
+
 
 // Rectangle
 typedef struct Rect {
     Vec2 pos;
-    double width;
-    double height;
+    p2_real width;
+    p2_real height;
 } Rect;
 
 
@@ -347,7 +929,7 @@ typedef struct Shape {
 } Shape;
 
 
-static inline Shape point(const double x, const double y)
+static inline Shape point(const p2_real x, const p2_real y)
 {
     return (Shape){
         .type = POINT,
@@ -363,12 +945,12 @@ static inline Shape linev(Vec2 v1, Vec2 v2)
     };
 }
 
-static inline Shape line(double x1, double y1, double x2, double y2)
+static inline Shape line(p2_real x1, p2_real y1, p2_real x2, p2_real y2)
 {
     return linev(vec2(x1, y1), vec2(x2, y2));
 }
 
-static inline Shape circlev(Vec2 center, double radius)
+static inline Shape circlev(Vec2 center, p2_real radius)
 {
     return (Shape){
         .type = CIRCLE,
@@ -379,12 +961,12 @@ static inline Shape circlev(Vec2 center, double radius)
     };
 }
 
-static inline Shape circle(double x, double y, double radius)
+static inline Shape circle(p2_real x, p2_real y, p2_real radius)
 {
     return circlev(vec2(x,y), radius);
 }
 
-static inline Shape rectv(const Vec2 pos, const double width, const double height)
+static inline Shape rectv(const Vec2 pos, const p2_real width, const p2_real height)
 {
     return (Shape){
         .type = RECT,
@@ -396,7 +978,7 @@ static inline Shape rectv(const Vec2 pos, const double width, const double heigh
     };
 }
 
-static inline Shape rect(const double x, const double y, const double width, const double height)
+static inline Shape rect(const p2_real x, const p2_real y, const p2_real width, const p2_real height)
 {
     return rectv(vec2(x,y), width, height);
 }
@@ -409,7 +991,7 @@ static inline Shape trianglev(Vec2 v1, Vec2 v2, Vec2 v3)
     };
 }
 
-static inline Shape triangle(double x1, double y1, double x2, double y2, double x3, double y3)
+static inline Shape triangle(p2_real x1, p2_real y1, p2_real x2, p2_real y2, p2_real x3, p2_real y3)
 {
     return trianglev(vec2(x1,y1), vec2(x2,y2), vec2(x3,y3));
 }
@@ -422,7 +1004,7 @@ static inline Shape quadv(Vec2 v1, Vec2 v2, Vec2 v3, Vec2 v4)
     };
 }
 
-static inline Shape quad(double x1, double y1, double x2, double y2, double x3, double y3, double x4, double y4)
+static inline Shape quad(p2_real x1, p2_real y1, p2_real x2, p2_real y2, p2_real x3, p2_real y3, p2_real x4, p2_real y4)
 {
     return quadv(vec2(x1,y1), vec2(x2,y2), vec2(x3,y3), vec2(x4,y4));
 }
@@ -437,423 +1019,5271 @@ static inline Quad rect_to_quad(Rect r)
     };
 }
 
+// poly_prepare fills the edge normals of the n vertices in v and returns
+// their centroid. Normals point away from the centroid, so either winding
+// works.
+static inline Vec2 poly_prepare(const Vec2 *v, Vec2 *normals, int n)
+{
+    Vec2 c = vec2zero;
+    p2_real area = 0;
+    for (int i=0; i<n; i++) {
+        Vec2 a = v[i], b = v[(i + 1) % n];
+        p2_real cross = a.x * b.y - a.y * b.x;
+        area += cross;
+        c = vec2_add(c, vec2_mult(vec2_add(a, b), cross));
+    }
+
+    if (p2_fabs(area) > 1e-9) {
+        c = vec2_div(c, 3 * area);
+    } else {
+        // Points and lines have no area, take the middle of the vertices
+        c = vec2zero;
+        for (int i=0; i<n; i++) c = vec2_add(c, v[i]);
+        if (n > 0) c = vec2_div(c, n);
+    }
+
+    for (int i=0; i<n; i++) {
+        Vec2 edge = vec2_sub(v[(i + 1) % n], v[i]);
+        Vec2 nrm = vec2_normalize(vec2(-edge.y, edge.x));
+        if (vec2_dot(nrm, vec2_sub(v[i], c)) < 0) nrm = vec2_mult(nrm, -1);
+        normals[i] = nrm;
+    }
+    return c;
+}
+
+// polyv makes a poly of up to POLY_INLINE_VERTS vertices, use
+// poly_in_arena for more. More asserts, or without asserts gives an empty
+// poly that touches nothing. The vertices are copied, v can go away after.
+static inline Shape polyv(const Vec2 *v, int n)
+{
+    assert(n <= POLY_INLINE_VERTS);
+    if (n > POLY_INLINE_VERTS) n = 0;
+
+    Shape s = { .type = POLY };
+    s.poly.n = n;
+    for (int i=0; i<n; i++) s.poly.v[i] = v[i];
+    s.poly.centroid = poly_prepare(s.poly.v, s.poly.normals, n);
+    return s;
+}
+
+// poly makes a poly of the n vertices given after n, like polyv.
 static inline Shape poly(int n, Vec2 v1, ...)
 {
-    Vec2 *v = (Vec2*) malloc(sizeof(Vec2) * n);
+    Vec2 v[POLY_INLINE_VERTS];
+    assert(n <= POLY_INLINE_VERTS);
+    if (n > POLY_INLINE_VERTS) n = 0;
+    if (n > 0) v[0] = v1;
 
     va_list args;
     va_start(args, v1);
-    for (int i; i<n; i++) {
-        Vec2 va = va_arg(args, Vec2);
-        v[i] = va;
+    for (int i=1; i<n; i++) {
+        v[i] = va_arg(args, Vec2);
     }
     va_end(args);
 
-    return (Shape){
-        .type = POLY,
-        .poly = {
-            .n = n,
-            .v = v,
-        },
-    };
+    return polyv(v, n);
 }
 
+// poly_in_arena makes a poly of up to POLY_MAX_VERTS vertices. Small ones
+// are inline like polyv, bigger ones take their storage from the arena.
+extern Shape poly_in_arena(PolyArena *arena, const Vec2 *v, int n);
+extern void poly_arena_free(PolyArena *arena);
+
+// Polys own no memory, arena polys are freed with their arena. Kept so
+// code written for allocated polys still builds.
 static inline void poly_free(Poly p)
 {
-    free(p.v);
+    (void)p;
 }
 
-// Shape free can be called on any shape.
-// Only a allocated poly will be freed.
-// All other shapes will safely be ignored.
+// Shape free can be called on any shape. No shape owns memory, it only
+// exists for older code.
 static inline void shape_free(Shape s)
 {
-    if (s.type == POLY) poly_free(s.poly);
+    (void)s;
 }
 
+// AABB is an axis aligned bounding box
+typedef struct AABB {
+    Vec2 min;
+    Vec2 max;
+} AABB;
 
-// Collision
-typedef struct Collision {
-    bool hit;
-    Shape shapes[2]; 
-    Vec2 dir;
-} Collision;
+static inline bool aabb_overlap(AABB a, AABB b)
+{
+    return a.min.x <= b.max.x && b.min.x <= a.max.x
+        && a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
 
-static const Collision collision_miss = {0};
+static inline AABB aabb_offset(AABB box, Vec2 pos)
+{
+    return (AABB) {
+        .min = vec2_add(box.min, pos),
+        .max = vec2_add(box.max, pos),
+    };
+}
 
-// Collier is a collection of shapes
-typedef Shape *Collider;
+static inline AABB aabb_union(AABB a, AABB b)
+{
+    return (AABB) {
+        .min = vec2(min(a.min.x, b.min.x), min(a.min.y, b.min.y)),
+        .max = vec2(max(a.max.x, b.max.x), max(a.max.y, b.max.y)),
+    };
+}
 
-#define collider_add_shape(c, shape) arrput(c, shape)
-#define collider_free(c) arrfree(c)
+// shape_aabb returns the bounds of the shape. An empty poly gets bounds
+// that overlap nothing.
+extern AABB shape_aabb(Shape s);
+// shape_bounding_circle returns a circle around the shape, centered on its
+// bounds. Not the smallest one, but close for the shapes here.
+extern Circle shape_bounding_circle(Shape s);
 
 
-#endif // End PHYSICS2D_H
+/**
+ * Manifold
+ *
+ * The contact between two shapes: the normal, up to two contact points and
+ * the depth. Polygons touching along an edge get two points, everything
+ * else one. No contact points means the shapes miss, and the rest is zero.
+ *
+ * Each point sits midway between the surfaces of the two shapes. Its id
+ * names the feature of each shape it comes from, the first shape in the
+ * high byte and the second in the low one. A feature is a vertex index, or
+ * an edge index with CONTACT_EDGE set. The ids of a pair stay the same from
+ * frame to frame while the shapes touch the same way, so a solver can match
+ * points and keep their impulses.
+ */
+#define CONTACT_EDGE 0x80
+#define CONTACT_ID(f1, f2) ((uint16_t)(((f1) << 8) | (f2)))
 
+typedef struct Manifold {
+    // Direction to move the first shape out of the second
+    Vec2 normal;
+    Vec2 points[2];
+    // How far the first shape has to move along normal
+    p2_real depth;
+    uint16_t ids[2];
+    uint8_t count;
+} Manifold;
 
-/******************************************************************************/
+static const Manifold manifold_miss = {0};
 
+#define SHAPE_TYPE_COUNT (POLY + 1)
 
-#define PHYSICS2D_IMPLEMENTATION
-#ifdef PHYSICS2D_IMPLEMENTATION
+// ShapeCollideFunc tests two shapes for a collision, one entry in the
+// shape_collide dispatch table.
+typedef Manifold (*ShapeCollideFunc)(const Shape *s1, const Shape *s2);
 
+extern Manifold shape_collide(Shape s1, Shape s2);
 
-#define STB_DS_IMPLEMENTATION
-#include "stb_ds.h"
+// SatCache remembers the axis that last separated a pair of shapes. Keep
+// one per pair that is tested every frame. While the shapes stay apart the
+// next test only projects onto that axis.
+typedef struct SatCache {
+    Vec2 axis;
+    bool valid;
+} SatCache;
 
+extern Manifold shape_collide_cached(Shape s1, Shape s2, SatCache *cache);
 
-/**********************************************
+/**
+ * Circle batches
  *
- * Body
+ * circle_collide for many pairs at once, for a broadphase to hand over all
+ * its circle pairs in one call. Pairs come as columns, and the results go
+ * to columns plus a bitmask of the hits. Misses are found from the squared
+ * distance, only hits take a square root.
  *
- **********************************************/
+ * Uses the same SIMD level as the Vec2 array functions.
+ */
+typedef struct CirclePairs {
+    // Center and radius of the first circle of each pair
+    const p2_real *x1, *y1, *r1;
+    // and of the second
+    const p2_real *x2, *y2, *r2;
+    int n;
+} CirclePairs;
 
-extern Body *body_alloc()
-{
-    return (Body *) malloc(sizeof(Body));
-}
+typedef struct CircleHits {
+    // Bit i % 64 of mask[i / 64] is set when pair i hits, (n + 63) / 64 words
+    uint64_t *mask;
+    // Normal and depth of each hit as circle_collide gives them, n each.
+    // Left unspecified for misses.
+    p2_real *nx, *ny;
+    p2_real *depth;
+} CircleHits;
 
-void body_init(Body *body, Vec2 pos, double mass)
-{
-    body->pos = pos;
-    body->vel = vec2zero;
-    body->acc = vec2zero;
-    body->mass = mass;
-    body->max_speed = -1;
-}
+// circle_collide_n tests every pair and returns how many hit.
+extern int circle_collide_n(const CirclePairs *pairs, const CircleHits *hits);
 
-Body *body_new(Vec2 pos, float mass)
+static inline bool circle_hits_test(const CircleHits *hits, int i)
 {
-    // Can't have zero mass body
-    if (mass==0)
-        return NULL;
-
-    Body *body = body_alloc();
-    if (!body)
-        return NULL;
+    return (hits->mask[i >> 6] >> (i & 63)) & 1;
+}
 
-    body_init(body, pos, mass);
+/**
+ * GJK and EPA
+ *
+ * A general test for any two convex shapes, that only needs the support
+ * point of each shape (shape_support). GJK finds the distance and closest
+ * points of two shapes that don't touch, EPA the depth and direction out
+ * of two that overlap.
+ *
+ * GjkCache keeps the search directions of the last simplex of a pair.
+ * Passing the same cache next frame starts GJK from there, which for
+ * slowly moving shapes usually ends it in one or two iterations.
+ */
+typedef struct GjkCache {
+    int count;
+    Vec2 dir[3];
+} GjkCache;
 
-    return body;
-}
+typedef struct GjkResult {
+    bool hit;
+    // Distance between the shapes, 0 when they overlap
+    p2_real distance;
+    // Closest points on each shape, when they don't overlap
+    Vec2 point1;
+    Vec2 point2;
+    // When they overlap, the direction and depth to move the first shape out
+    Vec2 dir;
+    p2_real depth;
+    int iterations;
+} GjkResult;
 
-void body_apply_force(Body *body, const Vec2 force)
-{
-    // Newtons law
-    // ∑F = ma or a = F / m
-    Vec2 acc = vec2_div(force, body->mass);
-    body->acc = vec2_add(body->acc, acc);
-}
+extern Vec2 shape_support(const Shape *s, Vec2 dir);
+extern GjkResult gjk(const Shape *s1, const Shape *s2, GjkCache *cache);
+extern Manifold shape_collide_gjk(Shape s1, Shape s2, GjkCache *cache);
+extern p2_real shape_distance(Shape s1, Shape s2, Vec2 *point1, Vec2 *point2);
 
-void body_apply_gravity(Body *body, const Vec2 gravity)
+/**
+ * Contact Cache
+ *
+ * Keeps the manifold of each touching pair of shapes from one frame to the
+ * next, with the impulses a solver has accumulated on each contact point.
+ * When a pair touches again its new points are matched to the old ones by
+ * feature id, and matching points keep their impulses. A solver starting
+ * from them (warm starting) needs far fewer iterations to settle stacks.
+ *
+ * A frame is contact_cache_begin, contact_cache_update for every pair that
+ * was tested, then contact_cache_end, which drops the pairs that weren't
+ * updated. Test a pair in the same order every frame, so the manifold and
+ * the key agree.
+ */
+typedef struct ContactKey {
+    BodyHandle body1;
+    BodyHandle body2;
+    // Index of the shape in the collider of each body
+    uint16_t shape1;
+    uint16_t shape2;
+} ContactKey;
+
+typedef struct CachedContact {
+    Manifold manifold;
+    // Impulse accumulated on each point, along the normal and the tangent
+    p2_real normal_impulse[2];
+    p2_real tangent_impulse[2];
+    // Frame it was last updated
+    uint32_t frame;
+} CachedContact;
+
+typedef struct ContactCacheEntry {
+    ContactKey key;
+    CachedContact value;
+} ContactCacheEntry;
+
+typedef struct ContactCache {
+    // stb_ds hash map from ContactKey
+    ContactCacheEntry *map;
+    uint32_t frame;
+} ContactCache;
+
+static inline ContactKey contact_key(BodyHandle body1, int shape1, BodyHandle body2, int shape2)
 {
-    body->acc = vec2_add(body->acc, gravity);
+    return (ContactKey) {
+        .body1 = body1,
+        .body2 = body2,
+        .shape1 = shape1,
+        .shape2 = shape2,
+    };
 }
 
-void body_update(Body *body, const double dt)
+extern ContactCache contact_cache_new();
+extern void contact_cache_free(ContactCache *cache);
+extern int contact_cache_count(const ContactCache *cache);
+extern void contact_cache_begin(ContactCache *cache);
+extern CachedContact *contact_cache_update(ContactCache *cache, ContactKey key, Manifold m);
+extern CachedContact *contact_cache_get(ContactCache *cache, ContactKey key);
+extern int contact_cache_end(ContactCache *cache);
+
+// Collier is a collection of shapes, with the bounds of each shape and of
+// all of them. Bounds are in the collider's own space, offset them by the
+// body position to place them. collider_add_shape keeps them up to date.
+//
+// A zeroed Collider is empty.
+typedef struct Collider {
+    // stb_ds arrays, one entry per shape
+    Shape *shapes;
+    AABB *bounds;
+    Circle *circles;
+
+    // Bounds of all shapes
+    AABB bound;
+    Circle circle;
+} Collider;
+
+#define collider_add_shape(c, shape) collider_push(&(c), (shape))
+#define collider_free(c) collider_destroy(&(c))
+
+extern void collider_push(Collider *c, Shape shape);
+extern void collider_destroy(Collider *c);
+extern int collider_count(const Collider *c);
+
+static inline AABB collider_aabb(const Collider *c, Vec2 pos)
 {
-    // Mutiply by delta time
-    Vec2 acc = vec2_mult(body->acc, dt);
-    body->vel = vec2_add(body->vel, acc);
-
-    Vec2 vel = vec2_mult(body->vel, dt);
-    body->pos = vec2_add(body->pos, vel);
-
-    body->acc = vec2zero;
-    if (body->max_speed >= 0) {
-        body->vel = vec2_limit(body->vel, body->max_speed);
-    }
+    return aabb_offset(c->bound, pos);
 }
 
-Vec2 body_momentum(Body *body)
+static inline Circle collider_bounding_circle(const Collider *c, Vec2 pos)
 {
-    return vec2_mult(body->vel, body->mass);
+    return (Circle) {vec2_add(c->circle.center, pos), c->circle.radius};
 }
 
-// friction returns a force. 
-// f = -1 * u * N v
-// 
-// n normal force magnature
-// coff coffiefient of friction
-Vec2 friction(Vec2 vel, double coff, double n)
-{
-    vel = vec2_normalize(vel);
-    return vec2_mult(vel, -coff*n);
-}
+// ColliderContact is a contact between shape1 of one collider and shape2
+// of the other, by index.
+typedef struct ColliderContact {
+    Manifold manifold;
+    uint16_t shape1;
+    uint16_t shape2;
+} ColliderContact;
 
-Vec2 drag(Vec2 vel, double coff, double n)
-{
-    return vec2zero;
-}
+extern int collider_collide(Vec2 pos1, const Collider *c1, Vec2 pos2, const Collider *c2,
+        ColliderContact *contacts, int max_contacts);
 
 /**
- * Perlin Noise
+ * ShapeCache keeps the shapes of many colliders moved to their body
+ * positions, all in one array, with their bounds. Update it once a step
+ * with every collider and position. Only colliders that moved are moved
+ * again, and collision, queries and drawing read the placed shapes instead
+ * of calling shape_offset for every pair.
  *
+ * Colliders are known by their index in the update. When the number of
+ * colliders or of shapes in one changes everything is placed again. After
+ * changing a shape in place, call shape_cache_reset.
  */
-/* #define STB_PERLIN_IMPLEMENTATION */
-/* #include "stb_perlin.h" */
+typedef struct ShapeCache {
+    // stb_ds arrays. Collider i has shapes[first[i]] up to shapes[first[i + 1]]
+    Shape *shapes;
+    AABB *bounds;
+    int *first;
+
+    // Per collider, the position it is placed at and the bounds of all its shapes
+    Vec2 *pos;
+    AABB *box;
+
+    // Colliders placed by the last update
+    int moved;
+} ShapeCache;
+
+extern void shape_cache_free(ShapeCache *cache);
+extern void shape_cache_reset(ShapeCache *cache);
+extern int shape_cache_update(ShapeCache *cache, const Collider *const *colliders, const Vec2 *pos, int n);
+extern int shape_cache_count(const ShapeCache *cache);
+extern const Shape *shape_cache_shapes(const ShapeCache *cache, int i, int *n);
+extern int shape_cache_collide(const ShapeCache *cache, int a, int b,
+        ColliderContact *contacts, int max_contacts);
+extern int shape_caches_collide(const ShapeCache *cache1, int a, const ShapeCache *cache2, int b,
+        ColliderContact *contacts, int max_contacts);
 
-void noise_seed(int seed)
-{
+/**
+ * Grid is a broadphase. It finds the pairs of boxes that overlap without
+ * testing every pair. Each update hashes the boxes into square cells and
+ * only tests boxes that share a cell. A pair that shares many cells is only
+ * reported by the lowest one, so every pair comes once, with a < b.
+ *
+ * Boxes over GRID_MAX_CELLS cells, like walls around the world, are kept
+ * out of the cells and tested against every box instead.
+ *
+ * The cell size should be about the size of the common box. Leave it 0
+ * and every update takes the median of the largest side of the boxes.
+ */
+#define GRID_MAX_CELLS 64
+
+// A box in a cell, with the lowest cell of the box
+typedef struct GridEntry {
+    int x, y;
+    int x0, y0;
+    int index;
+} GridEntry;
+
+typedef struct Grid {
+    // Side of a cell, 0 to pick it from the boxes each update
+    p2_real cell_size;
+    // Side of a cell used by the last update
+    p2_real cell;
+
+    // Pairs found by the last update, stb_ds array
+    BodyPair *pairs;
+
+    // Scratch reused by every update, stb_ds arrays
+    GridEntry *entries;
+    GridEntry *sorted;
+    int *start;
+    int *big;
+    int *big_rank;
+    p2_real *sides;
+} Grid;
+
+extern void grid_free(Grid *grid);
+extern int grid_update(Grid *grid, const AABB *boxes, int n);
+
+/**
+ * AABBTree is a broadphase for boxes of any size, where a grid has no good
+ * cell size. Each item has a leaf with a fat box, its box grown by a
+ * margin, and the tree keeps every node around the boxes below it, as
+ * small as it can and balanced by rotations.
+ *
+ * An item that stays inside its fat box is not touched. Its pairs from the
+ * last update are kept and only items that left their fat box look for
+ * pairs again. Pairs are of fat boxes, so some don't quite overlap.
+ *
+ * Items are small ints like the index of a body. Either add them one by
+ * one and call aabb_tree_update_pairs, or hand every box to
+ * aabb_tree_update.
+ */
+#define AABB_TREE_NULL (-1)
+// Margin of the fat boxes, part of the larger side of the box
+#define AABB_TREE_FAT ((p2_real) 0.1)
+
+typedef struct AABBTreeNode {
+    // Fat box for leaves
+    AABB box;
+    // Next free node for free nodes
+    int parent;
+    // AABB_TREE_NULL for leaves
+    int child1, child2;
+    // 0 for leaves, -1 for free nodes
+    int height;
+    int item;
+} AABBTreeNode;
+
+typedef struct AABBTree {
+    // Fixed margin of the fat boxes, 0 to make it AABB_TREE_FAT of the box
+    p2_real margin;
+
+    // stb_ds array of nodes, valid from the first insert
+    AABBTreeNode *nodes;
+    int root;
+    int free_list;
+
+    // Per item, its leaf node or AABB_TREE_NULL, and if it moved since the
+    // pairs were found. stb_ds arrays.
+    int *leaves;
+    bool *moved;
+
+    // Pairs of items whose fat boxes overlap, stb_ds array
+    BodyPair *pairs;
+
+    // Scratch for finding pairs
+    int *found;
+} AABBTree;
+
+extern void aabb_tree_free(AABBTree *tree);
+extern void aabb_tree_insert(AABBTree *tree, int item, AABB box);
+extern void aabb_tree_remove(AABBTree *tree, int item);
+extern bool aabb_tree_move(AABBTree *tree, int item, AABB box);
+extern int aabb_tree_update_pairs(AABBTree *tree);
+extern int aabb_tree_update(AABBTree *tree, const AABB *boxes, int n);
+extern int aabb_tree_height(const AABBTree *tree);
+
+extern int aabb_tree_query(const AABBTree *tree, AABB box, int *items, int max_items);
+extern int aabb_tree_query_point(const AABBTree *tree, Vec2 point, int *items, int max_items);
+extern int aabb_tree_raycast(const AABBTree *tree, Vec2 from, Vec2 to, int *items, int max_items);
+
+/**
+ * SweepPrune is a broadphase for bodies spread along one axis that move a
+ * little each step, like a side scroller. It keeps the ends of the boxes
+ * on the axis sorted from update to update, so insertion sort puts them
+ * back in order in about O(n). Each time two ends swap a pair starts or
+ * stops overlapping on the axis, and only those pairs are tested on the
+ * other axis.
+ *
+ * Besides all pairs, every update tells which pairs were added and which
+ * removed since the last one. Changing the number of boxes, or emptying
+ * one, sorts everything again.
+ */
+typedef struct SweepEnd {
+    p2_real value;
+    int item;
+    bool max;
+} SweepEnd;
+
+typedef struct SweepOverlap {
+    BodyPair key;
+    // The boxes overlap on both axes, the pair is in pairs
+    bool value;
+} SweepOverlap;
+
+typedef struct SweepPrune {
+    // Axis to sweep, 0 for x and 1 for y
+    int axis;
+
+    // Ends of the boxes on the axis, sorted, stb_ds array
+    SweepEnd *ends;
+    // stb_ds hashmap of the pairs that overlap on the axis
+    SweepOverlap *overlaps;
+
+    // Boxes of the last update and if each one is in the ends
+    int n;
+    bool *present;
+
+    // All pairs, and the ones added and removed by the last update, stb_ds
+    // arrays
+    BodyPair *pairs;
+    BodyPair *added;
+    BodyPair *removed;
+
+    // Scratch for sorting everything
+    int *active;
+    int *slot;
+} SweepPrune;
+
+extern void sweep_prune_free(SweepPrune *sap);
+extern int sweep_prune_update(SweepPrune *sap, const AABB *boxes, int n);
+
+/**
+ * LBVH is a broadphase for scenes where everything moves every step, which
+ * an incremental tree has to redo anyway. Every update builds a new tree:
+ * the box centers get Morton codes, which are radix sorted so boxes near
+ * each other are near in the order, and the tree splits the order where
+ * the codes first differ. Each internal node is found on its own, so the
+ * build runs in parallel, and so does looking for the pairs.
+ *
+ * Built with OpenMP (-fopenmp) the loops run on every core, else on one.
+ */
+typedef struct LBVHNode {
+    AABB box;
+    // Internal nodes are 0 to n - 2, leaves n - 1 on, in code order
+    int child1, child2;
+    int parent;
+    // Last leaf below the node, in code order
+    int last;
+} LBVHNode;
+
+typedef struct LBVH {
+    // stb_ds arrays. n - 1 internal nodes and n leaves, each leaf is the
+    // box of items[i].
+    LBVHNode *nodes;
+    int *items;
+    uint32_t *codes;
+    int n;
+
+    // All pairs, stb_ds array
+    BodyPair *pairs;
+
+    // Scratch reused by every update
+    uint32_t *codes_tmp;
+    int *items_tmp;
+    int *visits;
+    BodyPair **thread_pairs;
+} LBVH;
+
+extern void lbvh_free(LBVH *bvh);
+extern int lbvh_update(LBVH *bvh, const AABB *boxes, int n);
+
+/**
+ * StaticTree holds the boxes of things that never move, like the walls and
+ * floors of a level. It is built once, top down, splitting where the
+ * surface area heuristic says queries will visit the fewest nodes, and
+ * only built again when the level changes. Moving bodies query it, the
+ * static boxes never look for pairs among themselves.
+ */
+// Leaves hold up to STATIC_TREE_LEAF boxes, more only if they can't split
+#define STATIC_TREE_LEAF 4
+#define STATIC_TREE_BINS 16
+
+typedef struct StaticTreeNode {
+    AABB box;
+    // AABB_TREE_NULL for leaves
+    int child1, child2;
+    // Leaves hold items[first] up to first + count
+    int first, count;
+} StaticTreeNode;
+
+typedef struct StaticTree {
+    // stb_ds arrays, the root is node 0
+    StaticTreeNode *nodes;
+    int *items;
+    // The box of each item
+    AABB *boxes;
+} StaticTree;
+
+extern void static_tree_free(StaticTree *tree);
+extern void static_tree_build(StaticTree *tree, const AABB *boxes, int n);
+extern int static_tree_query(const StaticTree *tree, AABB box, int *items, int max_items);
+
+/**
+ * Broadphase is any of the broadphases, picked by type, so the code that
+ * uses the pairs doesn't care which. The zero value is a grid.
+ */
+typedef enum BroadphaseType {
+    BROADPHASE_GRID,
+    BROADPHASE_TREE,
+    BROADPHASE_SAP,
+    BROADPHASE_LBVH,
+} BroadphaseType;
+
+typedef struct Broadphase {
+    BroadphaseType type;
+    Grid grid;
+    AABBTree tree;
+    SweepPrune sap;
+    LBVH lbvh;
+} Broadphase;
+
+extern void broadphase_free(Broadphase *bp);
+extern int broadphase_update(Broadphase *bp, const AABB *boxes, int n);
+extern const BodyPair *broadphase_pairs(const Broadphase *bp, int *n);
+
+
+#endif // End PHYSICS2D_H
+
+
+/******************************************************************************/
+
+
+#define PHYSICS2D_IMPLEMENTATION
+#ifdef PHYSICS2D_IMPLEMENTATION
+
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+
+
+/**********************************************
+ *
+ * Vec2 array functions
+ *
+ **********************************************/
+
+#if !defined(PHYSICS2D_NO_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#if defined(__x86_64__) || defined(__i386__)
+#define PHYSICS2D_SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PHYSICS2D_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+typedef struct Vec2Kernels {
+    void (*add_n)(Vec2 *out, const Vec2 *a, const Vec2 *b, int n);
+    void (*sub_n)(Vec2 *out, const Vec2 *a, const Vec2 *b, int n);
+    void (*mult_n)(Vec2 *out, const Vec2 *v, p2_real m, int n);
+    void (*add_scaled_n)(Vec2 *out, const Vec2 *a, const Vec2 *b, p2_real s, int n);
+    void (*set_mag_n)(Vec2 *out, const Vec2 *v, p2_real m, int n);
+    void (*limit_n)(Vec2 *out, const Vec2 *v, p2_real max, int n);
+    // Pairs from start on, ORs hit bits into a zeroed mask
+    void (*circle_collide_n)(const CirclePairs *p, const CircleHits *h, int start);
+} Vec2Kernels;
+
+// Scalar
+
+static void vec2_add_n_scalar(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    for (int i=0; i<n; i++) out[i] = vec2_add(a[i], b[i]);
+}
+
+static void vec2_sub_n_scalar(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    for (int i=0; i<n; i++) out[i] = vec2_sub(a[i], b[i]);
+}
+
+static void vec2_mult_n_scalar(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    for (int i=0; i<n; i++) out[i] = vec2_mult(v[i], m);
+}
+
+static void vec2_add_scaled_n_scalar(Vec2 *out, const Vec2 *a, const Vec2 *b, p2_real s, int n)
+{
+    for (int i=0; i<n; i++) out[i] = vec2_add(a[i], vec2_mult(b[i], s));
+}
+
+static void vec2_set_mag_n_scalar(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    for (int i=0; i<n; i++) out[i] = vec2_set_mag(v[i], m);
+}
+
+static void vec2_limit_n_scalar(Vec2 *out, const Vec2 *v, p2_real max, int n)
+{
+    for (int i=0; i<n; i++) out[i] = vec2_limit(v[i], max);
+}
+
+static void circle_collide_n_scalar(const CirclePairs *p, const CircleHits *h, int start)
+{
+    for (int i=start; i < p->n; i++) {
+        p2_real dx = p->x1[i] - p->x2[i];
+        p2_real dy = p->y1[i] - p->y2[i];
+        p2_real r = p->r1[i] + p->r2[i];
+        p2_real d2 = dx * dx + dy * dy;
+        if (d2 > r * r) continue;
+
+        p2_real dist = p2_sqrt(d2);
+        p2_real inv = dist > 0 ? 1 / dist : 0;
+        h->mask[i >> 6] |= (uint64_t)1 << (i & 63);
+        // Same center, push apart along x like circle_collide
+        h->nx[i] = dist > 0 ? dx * inv : 1;
+        h->ny[i] = dy * inv;
+        h->depth[i] = r - dist;
+    }
+}
+
+static const Vec2Kernels vec2_kernels_scalar = {
+    .add_n = vec2_add_n_scalar,
+    .sub_n = vec2_sub_n_scalar,
+    .mult_n = vec2_mult_n_scalar,
+    .add_scaled_n = vec2_add_scaled_n_scalar,
+    .set_mag_n = vec2_set_mag_n_scalar,
+    .limit_n = vec2_limit_n_scalar,
+    .circle_collide_n = circle_collide_n_scalar,
+};
+
+#ifdef PHYSICS2D_SIMD_X86
+
+// Register width depends on p2_real. P2_SSE(op) and P2_AVX(op) name the
+// _ps or _pd intrinsic, *_VECS is how many Vec2 fit in one register,
+// *_LANES how many p2_real and *_swap swaps x and y of every Vec2 in a
+// register.
+#ifdef PHYSICS2D_USE_FLOAT
+typedef __m128 p2_sse;
+typedef __m256 p2_avx;
+#define P2_SSE(op) _mm_##op##_ps
+#define P2_AVX(op) _mm256_##op##_ps
+#define P2_SSE_VECS 2
+#define P2_AVX_VECS 4
+#define P2_SSE_LANES 4
+#define P2_AVX_LANES 8
+#define p2_sse_swap(v) _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1))
+#define p2_avx_swap(v) _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1))
+#else
+typedef __m128d p2_sse;
+typedef __m256d p2_avx;
+#define P2_SSE(op) _mm_##op##_pd
+#define P2_AVX(op) _mm256_##op##_pd
+#define P2_SSE_VECS 1
+#define P2_AVX_VECS 2
+#define P2_SSE_LANES 2
+#define P2_AVX_LANES 4
+#define p2_sse_swap(v) _mm_shuffle_pd(v, v, 1)
+#define p2_avx_swap(v) _mm256_permute_pd(v, 0x5)
+#endif
+
+// SSE2. Any tail shorter than a register finishes with the scalar version.
+
+__attribute__((target("sse2")))
+static void vec2_add_n_sse2(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    int i = 0;
+    for (; i+P2_SSE_VECS<=n; i+=P2_SSE_VECS) {
+        p2_sse r = P2_SSE(add)(P2_SSE(loadu)(&a[i].x), P2_SSE(loadu)(&b[i].x));
+        P2_SSE(storeu)(&out[i].x, r);
+    }
+    vec2_add_n_scalar(out+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void vec2_sub_n_sse2(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    int i = 0;
+    for (; i+P2_SSE_VECS<=n; i+=P2_SSE_VECS) {
+        p2_sse r = P2_SSE(sub)(P2_SSE(loadu)(&a[i].x), P2_SSE(loadu)(&b[i].x));
+        P2_SSE(storeu)(&out[i].x, r);
+    }
+    vec2_sub_n_scalar(out+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void vec2_mult_n_sse2(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    p2_sse mm = P2_SSE(set1)(m);
+    int i = 0;
+    for (; i+P2_SSE_VECS<=n; i+=P2_SSE_VECS) {
+        P2_SSE(storeu)(&out[i].x, P2_SSE(mul)(P2_SSE(loadu)(&v[i].x), mm));
+    }
+    vec2_mult_n_scalar(out+i, v+i, m, n-i);
+}
+
+__attribute__((target("sse2")))
+static void vec2_add_scaled_n_sse2(Vec2 *out, const Vec2 *a, const Vec2 *b, p2_real s, int n)
+{
+    p2_sse ss = P2_SSE(set1)(s);
+    int i = 0;
+    for (; i+P2_SSE_VECS<=n; i+=P2_SSE_VECS) {
+        p2_sse r = P2_SSE(add)(P2_SSE(loadu)(&a[i].x), P2_SSE(mul)(P2_SSE(loadu)(&b[i].x), ss));
+        P2_SSE(storeu)(&out[i].x, r);
+    }
+    vec2_add_scaled_n_scalar(out+i, a+i, b+i, s, n-i);
+}
+
+// Magnitude of each vector in both of its lanes.
+__attribute__((target("sse2")))
+static inline p2_sse vec2_mag_sse2(p2_sse v)
+{
+    p2_sse sq = P2_SSE(mul)(v, v);
+    return P2_SSE(sqrt)(P2_SSE(add)(sq, p2_sse_swap(sq)));
+}
+
+__attribute__((target("sse2")))
+static void vec2_set_mag_n_sse2(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    p2_sse mm = P2_SSE(set1)(m);
+    p2_sse zero = P2_SSE(setzero)();
+    int i = 0;
+    for (; i+P2_SSE_VECS<=n; i+=P2_SSE_VECS) {
+        p2_sse x = P2_SSE(loadu)(&v[i].x);
+        p2_sse mag = vec2_mag_sse2(x);
+        p2_sse r = P2_SSE(mul)(x, P2_SSE(div)(mm, mag));
+        // Zero vectors stay zero
+        r = P2_SSE(and)(r, P2_SSE(cmpgt)(mag, zero));
+        P2_SSE(storeu)(&out[i].x, r);
+    }
+    vec2_set_mag_n_scalar(out+i, v+i, m, n-i);
+}
+
+__attribute__((target("sse2")))
+static void vec2_limit_n_sse2(Vec2 *out, const Vec2 *v, p2_real max, int n)
+{
+    p2_sse mm = P2_SSE(set1)(max);
+    p2_sse zero = P2_SSE(setzero)();
+    int i = 0;
+    for (; i+P2_SSE_VECS<=n; i+=P2_SSE_VECS) {
+        p2_sse x = P2_SSE(loadu)(&v[i].x);
+        p2_sse mag = vec2_mag_sse2(x);
+        p2_sse over = P2_SSE(and)(P2_SSE(cmpgt)(mag, mm), P2_SSE(cmpgt)(mag, zero));
+        p2_sse scaled = P2_SSE(mul)(x, P2_SSE(div)(mm, mag));
+        p2_sse r = P2_SSE(or)(P2_SSE(and)(over, scaled), P2_SSE(andnot)(over, x));
+        P2_SSE(storeu)(&out[i].x, r);
+    }
+    vec2_limit_n_scalar(out+i, v+i, max, n-i);
+}
+
+// Circle pairs go one per lane, P2_SSE_LANES at a time. Lanes divide 64,
+// so the hit bits of a register never straddle two mask words.
+__attribute__((target("sse2")))
+static void circle_collide_n_sse2(const CirclePairs *p, const CircleHits *h, int start)
+{
+    p2_sse zero = P2_SSE(setzero)();
+    p2_sse one = P2_SSE(set1)(1);
+    int i = start;
+    for (; i+P2_SSE_LANES<=p->n; i+=P2_SSE_LANES) {
+        p2_sse dx = P2_SSE(sub)(P2_SSE(loadu)(p->x1 + i), P2_SSE(loadu)(p->x2 + i));
+        p2_sse dy = P2_SSE(sub)(P2_SSE(loadu)(p->y1 + i), P2_SSE(loadu)(p->y2 + i));
+        p2_sse r = P2_SSE(add)(P2_SSE(loadu)(p->r1 + i), P2_SSE(loadu)(p->r2 + i));
+        p2_sse d2 = P2_SSE(add)(P2_SSE(mul)(dx, dx), P2_SSE(mul)(dy, dy));
+        int bits = P2_SSE(movemask)(P2_SSE(cmple)(d2, P2_SSE(mul)(r, r)));
+        if (bits == 0) continue;
+
+        h->mask[i >> 6] |= (uint64_t)bits << (i & 63);
+        p2_sse dist = P2_SSE(sqrt)(d2);
+        p2_sse apart = P2_SSE(cmpgt)(dist, zero);
+        p2_sse inv = P2_SSE(and)(apart, P2_SSE(div)(one, dist));
+        P2_SSE(storeu)(h->nx + i, P2_SSE(add)(P2_SSE(mul)(dx, inv), P2_SSE(andnot)(apart, one)));
+        P2_SSE(storeu)(h->ny + i, P2_SSE(mul)(dy, inv));
+        P2_SSE(storeu)(h->depth + i, P2_SSE(sub)(r, dist));
+    }
+    circle_collide_n_scalar(p, h, i);
+}
+
+static const Vec2Kernels vec2_kernels_sse2 = {
+    .add_n = vec2_add_n_sse2,
+    .sub_n = vec2_sub_n_sse2,
+    .mult_n = vec2_mult_n_sse2,
+    .add_scaled_n = vec2_add_scaled_n_sse2,
+    .set_mag_n = vec2_set_mag_n_sse2,
+    .limit_n = vec2_limit_n_sse2,
+    .circle_collide_n = circle_collide_n_sse2,
+};
+
+// AVX2. The tail finishes with SSE2.
+
+__attribute__((target("avx2")))
+static void vec2_add_n_avx2(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    int i = 0;
+    for (; i+P2_AVX_VECS<=n; i+=P2_AVX_VECS) {
+        p2_avx r = P2_AVX(add)(P2_AVX(loadu)(&a[i].x), P2_AVX(loadu)(&b[i].x));
+        P2_AVX(storeu)(&out[i].x, r);
+    }
+    vec2_add_n_sse2(out+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void vec2_sub_n_avx2(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    int i = 0;
+    for (; i+P2_AVX_VECS<=n; i+=P2_AVX_VECS) {
+        p2_avx r = P2_AVX(sub)(P2_AVX(loadu)(&a[i].x), P2_AVX(loadu)(&b[i].x));
+        P2_AVX(storeu)(&out[i].x, r);
+    }
+    vec2_sub_n_sse2(out+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void vec2_mult_n_avx2(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    p2_avx mm = P2_AVX(set1)(m);
+    int i = 0;
+    for (; i+P2_AVX_VECS<=n; i+=P2_AVX_VECS) {
+        P2_AVX(storeu)(&out[i].x, P2_AVX(mul)(P2_AVX(loadu)(&v[i].x), mm));
+    }
+    vec2_mult_n_sse2(out+i, v+i, m, n-i);
+}
+
+__attribute__((target("avx2")))
+static void vec2_add_scaled_n_avx2(Vec2 *out, const Vec2 *a, const Vec2 *b, p2_real s, int n)
+{
+    p2_avx ss = P2_AVX(set1)(s);
+    int i = 0;
+    for (; i+P2_AVX_VECS<=n; i+=P2_AVX_VECS) {
+        p2_avx r = P2_AVX(add)(P2_AVX(loadu)(&a[i].x), P2_AVX(mul)(P2_AVX(loadu)(&b[i].x), ss));
+        P2_AVX(storeu)(&out[i].x, r);
+    }
+    vec2_add_scaled_n_sse2(out+i, a+i, b+i, s, n-i);
+}
+
+// Magnitude of each vector in both of its lanes.
+__attribute__((target("avx2")))
+static inline p2_avx vec2_mag_avx2(p2_avx v)
+{
+    p2_avx sq = P2_AVX(mul)(v, v);
+    return P2_AVX(sqrt)(P2_AVX(add)(sq, p2_avx_swap(sq)));
+}
+
+__attribute__((target("avx2")))
+static void vec2_set_mag_n_avx2(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    p2_avx mm = P2_AVX(set1)(m);
+    p2_avx zero = P2_AVX(setzero)();
+    int i = 0;
+    for (; i+P2_AVX_VECS<=n; i+=P2_AVX_VECS) {
+        p2_avx x = P2_AVX(loadu)(&v[i].x);
+        p2_avx mag = vec2_mag_avx2(x);
+        p2_avx r = P2_AVX(mul)(x, P2_AVX(div)(mm, mag));
+        r = P2_AVX(and)(r, P2_AVX(cmp)(mag, zero, _CMP_GT_OQ));
+        P2_AVX(storeu)(&out[i].x, r);
+    }
+    vec2_set_mag_n_sse2(out+i, v+i, m, n-i);
+}
+
+__attribute__((target("avx2")))
+static void vec2_limit_n_avx2(Vec2 *out, const Vec2 *v, p2_real max, int n)
+{
+    p2_avx mm = P2_AVX(set1)(max);
+    p2_avx zero = P2_AVX(setzero)();
+    int i = 0;
+    for (; i+P2_AVX_VECS<=n; i+=P2_AVX_VECS) {
+        p2_avx x = P2_AVX(loadu)(&v[i].x);
+        p2_avx mag = vec2_mag_avx2(x);
+        p2_avx over = P2_AVX(and)(P2_AVX(cmp)(mag, mm, _CMP_GT_OQ),
+                P2_AVX(cmp)(mag, zero, _CMP_GT_OQ));
+        p2_avx scaled = P2_AVX(mul)(x, P2_AVX(div)(mm, mag));
+        P2_AVX(storeu)(&out[i].x, P2_AVX(blendv)(x, scaled, over));
+    }
+    vec2_limit_n_sse2(out+i, v+i, max, n-i);
+}
+
+__attribute__((target("avx2")))
+static void circle_collide_n_avx2(const CirclePairs *p, const CircleHits *h, int start)
+{
+    p2_avx zero = P2_AVX(setzero)();
+    p2_avx one = P2_AVX(set1)(1);
+    int i = start;
+    for (; i+P2_AVX_LANES<=p->n; i+=P2_AVX_LANES) {
+        p2_avx dx = P2_AVX(sub)(P2_AVX(loadu)(p->x1 + i), P2_AVX(loadu)(p->x2 + i));
+        p2_avx dy = P2_AVX(sub)(P2_AVX(loadu)(p->y1 + i), P2_AVX(loadu)(p->y2 + i));
+        p2_avx r = P2_AVX(add)(P2_AVX(loadu)(p->r1 + i), P2_AVX(loadu)(p->r2 + i));
+        p2_avx d2 = P2_AVX(add)(P2_AVX(mul)(dx, dx), P2_AVX(mul)(dy, dy));
+        int bits = P2_AVX(movemask)(P2_AVX(cmp)(d2, P2_AVX(mul)(r, r), _CMP_LE_OQ));
+        if (bits == 0) continue;
+
+        h->mask[i >> 6] |= (uint64_t)bits << (i & 63);
+        p2_avx dist = P2_AVX(sqrt)(d2);
+        p2_avx apart = P2_AVX(cmp)(dist, zero, _CMP_GT_OQ);
+        p2_avx inv = P2_AVX(and)(apart, P2_AVX(div)(one, dist));
+        P2_AVX(storeu)(h->nx + i, P2_AVX(add)(P2_AVX(mul)(dx, inv), P2_AVX(andnot)(apart, one)));
+        P2_AVX(storeu)(h->ny + i, P2_AVX(mul)(dy, inv));
+        P2_AVX(storeu)(h->depth + i, P2_AVX(sub)(r, dist));
+    }
+    circle_collide_n_sse2(p, h, i);
+}
+
+static const Vec2Kernels vec2_kernels_avx2 = {
+    .add_n = vec2_add_n_avx2,
+    .sub_n = vec2_sub_n_avx2,
+    .mult_n = vec2_mult_n_avx2,
+    .add_scaled_n = vec2_add_scaled_n_avx2,
+    .set_mag_n = vec2_set_mag_n_avx2,
+    .limit_n = vec2_limit_n_avx2,
+    .circle_collide_n = circle_collide_n_avx2,
+};
+
+#endif // PHYSICS2D_SIMD_X86
+
+#ifdef PHYSICS2D_SIMD_NEON
+
+// P2_NEON(op) names the f32 or f64 intrinsic, see the x86 section.
+#ifdef PHYSICS2D_USE_FLOAT
+typedef float32x4_t p2_neon;
+typedef uint32x4_t p2_neon_mask;
+#define P2_NEON(op) op##q_f32
+#define P2_NEON_N(op) op##q_n_f32
+#define P2_NEON_VECS 2
+#define P2_NEON_LANES 4
+#define p2_neon_swap(v) vrev64q_f32(v)
+#define p2_neon_and vandq_u32
+#else
+typedef float64x2_t p2_neon;
+typedef uint64x2_t p2_neon_mask;
+#define P2_NEON(op) op##q_f64
+#define P2_NEON_N(op) op##q_n_f64
+#define P2_NEON_VECS 1
+#define P2_NEON_LANES 2
+#define p2_neon_swap(v) vextq_f64(v, v, 1)
+#define p2_neon_and vandq_u64
+#endif
+
+static void vec2_add_n_neon(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    int i = 0;
+    for (; i+P2_NEON_VECS<=n; i+=P2_NEON_VECS) {
+        P2_NEON(vst1)(&out[i].x, P2_NEON(vadd)(P2_NEON(vld1)(&a[i].x), P2_NEON(vld1)(&b[i].x)));
+    }
+    vec2_add_n_scalar(out+i, a+i, b+i, n-i);
+}
+
+static void vec2_sub_n_neon(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    int i = 0;
+    for (; i+P2_NEON_VECS<=n; i+=P2_NEON_VECS) {
+        P2_NEON(vst1)(&out[i].x, P2_NEON(vsub)(P2_NEON(vld1)(&a[i].x), P2_NEON(vld1)(&b[i].x)));
+    }
+    vec2_sub_n_scalar(out+i, a+i, b+i, n-i);
+}
+
+static void vec2_mult_n_neon(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    int i = 0;
+    for (; i+P2_NEON_VECS<=n; i+=P2_NEON_VECS) {
+        P2_NEON(vst1)(&out[i].x, P2_NEON_N(vmul)(P2_NEON(vld1)(&v[i].x), m));
+    }
+    vec2_mult_n_scalar(out+i, v+i, m, n-i);
+}
+
+static void vec2_add_scaled_n_neon(Vec2 *out, const Vec2 *a, const Vec2 *b, p2_real s, int n)
+{
+    int i = 0;
+    for (; i+P2_NEON_VECS<=n; i+=P2_NEON_VECS) {
+        p2_neon r = P2_NEON(vadd)(P2_NEON(vld1)(&a[i].x), P2_NEON_N(vmul)(P2_NEON(vld1)(&b[i].x), s));
+        P2_NEON(vst1)(&out[i].x, r);
+    }
+    vec2_add_scaled_n_scalar(out+i, a+i, b+i, s, n-i);
+}
+
+// Magnitude of each vector in both of its lanes.
+static inline p2_neon vec2_mag_neon(p2_neon v)
+{
+    p2_neon sq = P2_NEON(vmul)(v, v);
+    return P2_NEON(vsqrt)(P2_NEON(vadd)(sq, p2_neon_swap(sq)));
+}
+
+static void vec2_set_mag_n_neon(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    p2_neon mm = P2_NEON_N(vdup)(m);
+    p2_neon zero = P2_NEON_N(vdup)(0);
+    int i = 0;
+    for (; i+P2_NEON_VECS<=n; i+=P2_NEON_VECS) {
+        p2_neon x = P2_NEON(vld1)(&v[i].x);
+        p2_neon mag = vec2_mag_neon(x);
+        p2_neon r = P2_NEON(vmul)(x, P2_NEON(vdiv)(mm, mag));
+        r = P2_NEON(vbsl)(P2_NEON(vcgt)(mag, zero), r, zero);
+        P2_NEON(vst1)(&out[i].x, r);
+    }
+    vec2_set_mag_n_scalar(out+i, v+i, m, n-i);
+}
+
+static void vec2_limit_n_neon(Vec2 *out, const Vec2 *v, p2_real max, int n)
+{
+    p2_neon mm = P2_NEON_N(vdup)(max);
+    p2_neon zero = P2_NEON_N(vdup)(0);
+    int i = 0;
+    for (; i+P2_NEON_VECS<=n; i+=P2_NEON_VECS) {
+        p2_neon x = P2_NEON(vld1)(&v[i].x);
+        p2_neon mag = vec2_mag_neon(x);
+        p2_neon_mask over = p2_neon_and(P2_NEON(vcgt)(mag, mm), P2_NEON(vcgt)(mag, zero));
+        p2_neon scaled = P2_NEON(vmul)(x, P2_NEON(vdiv)(mm, mag));
+        P2_NEON(vst1)(&out[i].x, P2_NEON(vbsl)(over, scaled, x));
+    }
+    vec2_limit_n_scalar(out+i, v+i, max, n-i);
+}
+
+// NEON has no movemask, the hit lanes go through memory as 0 or 1.
+static void circle_collide_n_neon(const CirclePairs *p, const CircleHits *h, int start)
+{
+    p2_neon zero = P2_NEON_N(vdup)(0);
+    p2_neon one = P2_NEON_N(vdup)(1);
+    int i = start;
+    for (; i+P2_NEON_LANES<=p->n; i+=P2_NEON_LANES) {
+        p2_neon dx = P2_NEON(vsub)(P2_NEON(vld1)(p->x1 + i), P2_NEON(vld1)(p->x2 + i));
+        p2_neon dy = P2_NEON(vsub)(P2_NEON(vld1)(p->y1 + i), P2_NEON(vld1)(p->y2 + i));
+        p2_neon r = P2_NEON(vadd)(P2_NEON(vld1)(p->r1 + i), P2_NEON(vld1)(p->r2 + i));
+        p2_neon d2 = P2_NEON(vadd)(P2_NEON(vmul)(dx, dx), P2_NEON(vmul)(dy, dy));
+        p2_neon_mask hit = P2_NEON(vcle)(d2, P2_NEON(vmul)(r, r));
+        if (P2_NEON(vmaxv)(P2_NEON(vbsl)(hit, one, zero)) == 0) continue;
+
+        p2_real lanes[P2_NEON_LANES];
+        P2_NEON(vst1)(lanes, P2_NEON(vbsl)(hit, one, zero));
+        for (int l=0; l < P2_NEON_LANES; l++) {
+            if (lanes[l] != 0) h->mask[(i + l) >> 6] |= (uint64_t)1 << ((i + l) & 63);
+        }
+
+        p2_neon dist = P2_NEON(vsqrt)(d2);
+        p2_neon_mask apart = P2_NEON(vcgt)(dist, zero);
+        p2_neon inv = P2_NEON(vbsl)(apart, P2_NEON(vdiv)(one, dist), zero);
+        P2_NEON(vst1)(h->nx + i, P2_NEON(vbsl)(apart, P2_NEON(vmul)(dx, inv), one));
+        P2_NEON(vst1)(h->ny + i, P2_NEON(vmul)(dy, inv));
+        P2_NEON(vst1)(h->depth + i, P2_NEON(vsub)(r, dist));
+    }
+    circle_collide_n_scalar(p, h, i);
+}
+
+static const Vec2Kernels vec2_kernels_neon = {
+    .add_n = vec2_add_n_neon,
+    .sub_n = vec2_sub_n_neon,
+    .mult_n = vec2_mult_n_neon,
+    .add_scaled_n = vec2_add_scaled_n_neon,
+    .set_mag_n = vec2_set_mag_n_neon,
+    .limit_n = vec2_limit_n_neon,
+    .circle_collide_n = circle_collide_n_neon,
+};
+
+#endif // PHYSICS2D_SIMD_NEON
+
+static bool simd_supported(SimdLevel level)
+{
+    switch (level) {
+        case SIMD_SCALAR: return true;
+#ifdef PHYSICS2D_SIMD_X86
+        case SIMD_SSE2: return __builtin_cpu_supports("sse2");
+        case SIMD_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+#ifdef PHYSICS2D_SIMD_NEON
+        case SIMD_NEON: return true;
+#endif
+        default: return false;
+    }
+}
+
+static const Vec2Kernels *vec2_kernels_for(SimdLevel level)
+{
+    switch (level) {
+#ifdef PHYSICS2D_SIMD_X86
+        case SIMD_SSE2: return &vec2_kernels_sse2;
+        case SIMD_AVX2: return &vec2_kernels_avx2;
+#endif
+#ifdef PHYSICS2D_SIMD_NEON
+        case SIMD_NEON: return &vec2_kernels_neon;
+#endif
+        default: return &vec2_kernels_scalar;
+    }
+}
+
+static SimdLevel simd_current = SIMD_SCALAR;
+static const Vec2Kernels *vec2_kernels_current = NULL;
+
+static const Vec2Kernels *vec2_kernels()
+{
+    if (vec2_kernels_current == NULL) {
+        SimdLevel best[] = {SIMD_AVX2, SIMD_NEON, SIMD_SSE2};
+        SimdLevel level = SIMD_SCALAR;
+        for (int i=0; i<sizeof(best)/sizeof(SimdLevel); i++) {
+            if (simd_supported(best[i])) {
+                level = best[i];
+                break;
+            }
+        }
+        simd_set_level(level);
+    }
+    return vec2_kernels_current;
+}
+
+SimdLevel simd_level()
+{
+    vec2_kernels();
+    return simd_current;
+}
+
+SimdLevel simd_set_level(SimdLevel level)
+{
+    if (!simd_supported(level)) level = SIMD_SCALAR;
+    simd_current = level;
+    vec2_kernels_current = vec2_kernels_for(level);
+    return level;
+}
+
+const char *simd_level_name(SimdLevel level)
+{
+    switch (level) {
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_SSE2: return "sse2";
+        case SIMD_AVX2: return "avx2";
+        case SIMD_NEON: return "neon";
+    }
+    return "unknown";
+}
+
+void vec2_add_n(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    vec2_kernels()->add_n(out, a, b, n);
+}
+
+void vec2_sub_n(Vec2 *out, const Vec2 *a, const Vec2 *b, int n)
+{
+    vec2_kernels()->sub_n(out, a, b, n);
+}
+
+void vec2_mult_n(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    vec2_kernels()->mult_n(out, v, m, n);
+}
+
+void vec2_add_scaled_n(Vec2 *out, const Vec2 *a, const Vec2 *b, p2_real s, int n)
+{
+    vec2_kernels()->add_scaled_n(out, a, b, s, n);
+}
+
+void vec2_normalize_n(Vec2 *out, const Vec2 *v, int n)
+{
+    vec2_kernels()->set_mag_n(out, v, 1, n);
+}
+
+void vec2_set_mag_n(Vec2 *out, const Vec2 *v, p2_real m, int n)
+{
+    vec2_kernels()->set_mag_n(out, v, m, n);
+}
+
+void vec2_limit_n(Vec2 *out, const Vec2 *v, p2_real max, int n)
+{
+    vec2_kernels()->limit_n(out, v, max, n);
+}
+
+static inline int bits_count(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (x * 0x0101010101010101ull) >> 56;
+#endif
+}
+
+int circle_collide_n(const CirclePairs *pairs, const CircleHits *hits)
+{
+    int words = (pairs->n + 63) / 64;
+    memset(hits->mask, 0, words * sizeof(uint64_t));
+    vec2_kernels()->circle_collide_n(pairs, hits, 0);
+
+    int count = 0;
+    for (int w=0; w < words; w++) count += bits_count(hits->mask[w]);
+    return count;
+}
+
+
+/**********************************************
+ *
+ * Random
+ *
+ **********************************************/
+
+void rng_seed(Rng *rng, uint64_t seed, uint64_t stream)
+{
+    rng->state = 0;
+    rng->inc = (stream << 1) | 1;
+    rng_next_u32(rng);
+    rng->state += seed;
+    rng_next_u32(rng);
+}
+
+Rng rng_new(uint64_t seed, uint64_t stream)
+{
+    Rng rng;
+    rng_seed(&rng, seed, stream);
+    return rng;
+}
+
+static _Thread_local Rng rng_thread;
+static _Thread_local bool rng_thread_seeded = false;
+static _Thread_local uint64_t rng_thread_stream;
+// Streams handed out so far
+static uint64_t rng_streams = 0;
+
+static void rng_thread_init(uint64_t seed)
+{
+    if (!rng_thread_seeded) {
+        rng_thread_stream = __atomic_fetch_add(&rng_streams, 1, __ATOMIC_RELAXED);
+    }
+    rng_seed(&rng_thread, seed, rng_thread_stream);
+    rng_thread_seeded = true;
+}
+
+Rng *rng_default()
+{
+    if (!rng_thread_seeded) rng_thread_init(0);
+    return &rng_thread;
+}
+
+void rng_seed_default(uint64_t seed)
+{
+    rng_thread_init(seed);
+}
+
+// rng_fill_uniform fills out with n numbers in [min, max). The state is
+// kept in a local so the loop runs out of registers.
+void rng_fill_uniform(Rng *rng, p2_real *out, int n, p2_real min, p2_real max)
+{
+    Rng r = *rng;
+    p2_real range = max - min;
+    for (int i=0; i<n; i++) {
+        out[i] = min + rng_uniform(&r) * range;
+    }
+    *rng = r;
+}
+
+// rng_fill_vec2 fills out with n vectors, both components in [min, max).
+void rng_fill_vec2(Rng *rng, Vec2 *out, int n, p2_real min, p2_real max)
+{
+    rng_fill_uniform(rng, (p2_real *) out, 2 * n, min, max);
+}
+
+/**********************************************
+ *
+ * Body
+ *
+ **********************************************/
+
+extern Body *body_alloc()
+{
+    return (Body *) malloc(sizeof(Body));
+}
+
+void body_init(Body *body, Vec2 pos, p2_real mass)
+{
+    body->pos = pos;
+    body->prev_pos = pos;
+    body->vel = vec2zero;
+    body->acc = vec2zero;
+    body->mass = mass;
+    body->max_speed = -1;
+    body->sleep_speed = BODY_SLEEP_SPEED;
+    body->sleep_time = 0;
+    body->sleeping = false;
+    body->island = -1;
+}
+
+Body *body_new(Vec2 pos, p2_real mass)
+{
+    // Can't have zero mass body
+    if (mass==0)
+        return NULL;
+
+    Body *body = body_alloc();
+    if (!body)
+        return NULL;
+
+    body_init(body, pos, mass);
+
+    return body;
+}
+
+void body_apply_force(Body *body, const Vec2 force)
+{
+    // Newtons law
+    // ∑F = ma or a = F / m
+    Vec2 acc = vec2_div(force, body->mass);
+    body->acc = vec2_add(body->acc, acc);
+
+    if (!vec2_equal(force, vec2zero)) body_wake(body);
+}
+
+void body_apply_gravity(Body *body, const Vec2 gravity)
+{
+    body->acc = vec2_add(body->acc, gravity);
+}
+
+void body_update(Body *body, const p2_real dt)
+{
+    body->prev_pos = body->pos;
+
+    if (body->sleeping) {
+        body->acc = vec2zero;
+        return;
+    }
+
+    // Mutiply by delta time
+    Vec2 acc = vec2_mult(body->acc, dt);
+    body->vel = vec2_add(body->vel, acc);
+
+    Vec2 vel = vec2_mult(body->vel, dt);
+    body->pos = vec2_add(body->pos, vel);
+
+    body->acc = vec2zero;
+    if (body->max_speed >= 0) {
+        body->vel = vec2_limit(body->vel, body->max_speed);
+    }
+}
+
+// Moves the body to pos without drawing it in between the old and
+// new position.
+void body_set_pos(Body *body, Vec2 pos)
+{
+    body->pos = pos;
+    body->prev_pos = pos;
+}
+
+// Position to draw the body at, alpha of the way from the position before
+// the last update to the current one.
+Vec2 body_lerp_pos(const Body *body, p2_real alpha)
+{
+    return vec2_lerp(body->prev_pos, body->pos, alpha);
+}
+
+Vec2 body_momentum(Body *body)
+{
+    return vec2_mult(body->vel, body->mass);
+}
+
+void body_wake(Body *body)
+{
+    body->sleeping = false;
+    body->sleep_time = 0;
+    body->island = -1;
+}
+
+static int island_find(int *parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static void island_union(int *parent, int a, int b)
+{
+    a = island_find(parent, a);
+    b = island_find(parent, b);
+    if (a != b) parent[b] = a;
+}
+
+// bodies_update_sleep updates the sleep timers of the bodies and then puts
+// bodies to sleep or wakes them up, a whole island at a time.
+//
+// An island is a group of bodies joined by contacts. Zero mass (static)
+// bodies never sleep and do not join islands, so everything resting on the
+// ground is not one big island. Bodies that fell asleep together stay one
+// island, so touching or pushing any of them wakes all of them.
+//
+// An island sleeps once every body in it has rested for time_to_sleep.
+//
+// scratch is an stb_ds array owned by the caller, grown as needed and
+// reused from step to step.
+void bodies_update_sleep(Body **bodies, int n,
+        const BodyPair *contacts, int num_contacts,
+        p2_real time_to_sleep, p2_real dt, int **scratch)
+{
+    arrsetlen(*scratch, n * 3);
+    int *parent = *scratch;
+    int *first_in_island = parent + n;
+    int *can_sleep = parent + 2 * n;
+
+    for (int i=0; i<n; i++) {
+        parent[i] = i;
+        first_in_island[i] = -1;
+        can_sleep[i] = true;
+    }
+
+    for (int i=0; i<n; i++) {
+        Body *body = bodies[i];
+        if (body->mass == 0 || body->sleeping) continue;
+
+        p2_real limit = body->sleep_speed;
+        if (limit >= 0 && vec2_mag_sq(body->vel) <= limit * limit) {
+            body->sleep_time += dt;
+        } else {
+            body->sleep_time = 0;
+        }
+    }
+
+    // Keep sleeping islands together
+    for (int i=0; i<n; i++) {
+        int island = bodies[i]->island;
+        if (!bodies[i]->sleeping || island < 0 || island >= n) continue;
+        if (first_in_island[island] < 0) {
+            first_in_island[island] = i;
+        } else {
+            island_union(parent, first_in_island[island], i);
+        }
+    }
+
+    for (int i=0; i<num_contacts; i++) {
+        BodyPair c = contacts[i];
+        if (bodies[c.a]->mass == 0 || bodies[c.b]->mass == 0) continue;
+        island_union(parent, c.a, c.b);
+    }
+
+    for (int i=0; i<n; i++) {
+        if (bodies[i]->mass == 0) continue;
+        if (bodies[i]->sleep_time < time_to_sleep) {
+            can_sleep[island_find(parent, i)] = false;
+        }
+    }
+
+    for (int i=0; i<n; i++) {
+        Body *body = bodies[i];
+        if (body->mass == 0) continue;
+
+        int island = island_find(parent, i);
+        if (can_sleep[island]) {
+            body->sleeping = true;
+            body->island = island;
+            body->vel = vec2zero;
+            body->acc = vec2zero;
+        } else if (body->sleeping) {
+            body_wake(body);
+        }
+    }
+}
+
+/**********************************************
+ *
+ * Body Pool
+ *
+ **********************************************/
+
+BodyPool body_pool_new()
+{
+    return (BodyPool){0};
+}
+
+void body_pool_free(BodyPool *pool)
+{
+    if (pool==NULL) return;
+
+    arrfree(pool->bodies);
+    arrfree(pool->dense_slot);
+    arrfree(pool->slots);
+    arrfree(pool->free_slots);
+}
+
+void body_pool_reserve(BodyPool *pool, int n)
+{
+    arrsetcap(pool->bodies, n);
+    arrsetcap(pool->dense_slot, n);
+    arrsetcap(pool->slots, n);
+    arrsetcap(pool->free_slots, n);
+}
+
+int body_pool_count(const BodyPool *pool)
+{
+    return arrlen(pool->bodies);
+}
+
+static inline BodyHandle body_handle(uint32_t slot, uint32_t gen)
+{
+    return (gen << BODY_HANDLE_INDEX_BITS) | slot;
+}
+
+// body_pool_create returns BODY_HANDLE_NONE when the pool is full.
+BodyHandle body_pool_create(BodyPool *pool, Vec2 pos, p2_real mass)
+{
+    uint32_t slot;
+    if (arrlen(pool->free_slots) > 0) {
+        slot = arrpop(pool->free_slots);
+    } else {
+        if (arrlen(pool->slots) >= BODY_POOL_MAX) return BODY_HANDLE_NONE;
+        slot = arrlen(pool->slots);
+        arrput(pool->slots, ((BodySlot){.gen = 1}));
+    }
+
+    Body body;
+    body_init(&body, pos, mass);
+
+    pool->slots[slot].dense = arrlen(pool->bodies);
+    arrput(pool->bodies, body);
+    arrput(pool->dense_slot, slot);
+
+    return body_handle(slot, pool->slots[slot].gen);
+}
+
+bool body_pool_valid(const BodyPool *pool, BodyHandle handle)
+{
+    uint32_t slot = handle & BODY_HANDLE_INDEX_MASK;
+    uint32_t gen = handle >> BODY_HANDLE_INDEX_BITS;
+    return slot < arrlen(pool->slots) && gen != 0 && pool->slots[slot].gen == gen;
+}
+
+bool body_pool_destroy(BodyPool *pool, BodyHandle handle)
+{
+    if (!body_pool_valid(pool, handle)) return false;
+
+    uint32_t slot = handle & BODY_HANDLE_INDEX_MASK;
+    uint32_t dense = pool->slots[slot].dense;
+
+    // Move the last body into the hole
+    uint32_t last_slot = arrlast(pool->dense_slot);
+    pool->slots[last_slot].dense = dense;
+    arrdelswap(pool->bodies, dense);
+    arrdelswap(pool->dense_slot, dense);
+
+    // Skip generation 0 so no handle is ever BODY_HANDLE_NONE
+    uint32_t gen = (pool->slots[slot].gen + 1) & BODY_HANDLE_GEN_MASK;
+    pool->slots[slot].gen = gen == 0 ? 1 : gen;
+    arrput(pool->free_slots, slot);
+
+    return true;
+}
+
+// body_pool_get returns NULL for a destroyed or invalid handle. The pointer
+// is good until the next body_pool_create or body_pool_destroy.
+Body *body_pool_get(BodyPool *pool, BodyHandle handle)
+{
+    if (!body_pool_valid(pool, handle)) return NULL;
+    return &pool->bodies[pool->slots[handle & BODY_HANDLE_INDEX_MASK].dense];
+}
+
+// body_pool_handle returns the handle of the i-th live body.
+BodyHandle body_pool_handle(const BodyPool *pool, int i)
+{
+    uint32_t slot = pool->dense_slot[i];
+    return body_handle(slot, pool->slots[slot].gen);
+}
+
+void body_pool_update_all(BodyPool *pool, const p2_real dt)
+{
+    int n = arrlen(pool->bodies);
+    Body *bodies = pool->bodies;
+    for (int i=0; i<n; i++) {
+        body_update(&bodies[i], dt);
+    }
+}
+
+/**********************************************
+ *
+ * Body Store
+ *
+ **********************************************/
+
+BodyStore body_store_new()
+{
+    return (BodyStore){0};
+}
+
+void body_store_free(BodyStore *store)
+{
+    if (store==NULL) return;
+
+    arrfree(store->pos_x);
+    arrfree(store->pos_y);
+    arrfree(store->vel_x);
+    arrfree(store->vel_y);
+    arrfree(store->acc_x);
+    arrfree(store->acc_y);
+    arrfree(store->mass);
+    arrfree(store->inv_mass);
+    arrfree(store->max_speed);
+    arrfree(store->scratch);
+    body_store_clear_forces(store);
+    arrfree(store->forces);
+}
+
+// Reserve room for n bodies in total, so adding bodies up to that
+// count will not reallocate the columns.
+void body_store_reserve(BodyStore *store, int n)
+{
+    arrsetcap(store->pos_x, n);
+    arrsetcap(store->pos_y, n);
+    arrsetcap(store->vel_x, n);
+    arrsetcap(store->vel_y, n);
+    arrsetcap(store->acc_x, n);
+    arrsetcap(store->acc_y, n);
+    arrsetcap(store->mass, n);
+    arrsetcap(store->inv_mass, n);
+    arrsetcap(store->max_speed, n);
+}
+
+int body_store_count(const BodyStore *store)
+{
+    return arrlen(store->pos_x);
+}
+
+BodyId body_store_push(BodyStore *store, Body body)
+{
+    BodyId id = body_store_count(store);
+
+    arrput(store->pos_x, body.pos.x);
+    arrput(store->pos_y, body.pos.y);
+    arrput(store->vel_x, body.vel.x);
+    arrput(store->vel_y, body.vel.y);
+    arrput(store->acc_x, body.acc.x);
+    arrput(store->acc_y, body.acc.y);
+    arrput(store->mass, body.mass);
+    arrput(store->inv_mass, body.mass == 0 ? 0 : 1 / body.mass);
+    arrput(store->max_speed, body.max_speed);
+
+    return id;
+}
+
+BodyId body_store_add(BodyStore *store, Vec2 pos, p2_real mass)
+{
+    Body body;
+    body_init(&body, pos, mass);
+    return body_store_push(store, body);
+}
+
+// Forces stop naming the removed body id, and name the last body, which
+// moves to id, by its new BodyId. Springs on id are dropped, the forces
+// after them move down one.
+static void body_store_remove_forces(BodyStore *store, BodyId id, BodyId last)
+{
+    for (int f=0; f < arrlen(store->forces); ) {
+        ForceGen *force = &store->forces[f];
+        if (force->type == FORCE_SPRING) {
+            if (force->a == id || force->b == id) {
+                arrfree(force->bodies);
+                arrdel(store->forces, f);
+                continue;
+            }
+            if (force->a == last) force->a = id;
+            if (force->b == last) force->b = id;
+        }
+
+        for (int j=0; j < arrlen(force->bodies); ) {
+            if (force->bodies[j] == id) {
+                arrdel(force->bodies, j);
+                continue;
+            }
+            if (force->bodies[j] == last) force->bodies[j] = id;
+            j++;
+        }
+        f++;
+    }
+}
+
+// Removes a body by moving the last body into its slot.
+// The BodyId of the last body becomes id, in the forces too.
+void body_store_remove(BodyStore *store, BodyId id)
+{
+    body_store_remove_forces(store, id, body_store_count(store) - 1);
+
+    arrdelswap(store->pos_x, id);
+    arrdelswap(store->pos_y, id);
+    arrdelswap(store->vel_x, id);
+    arrdelswap(store->vel_y, id);
+    arrdelswap(store->acc_x, id);
+    arrdelswap(store->acc_y, id);
+    arrdelswap(store->mass, id);
+    arrdelswap(store->inv_mass, id);
+    arrdelswap(store->max_speed, id);
+}
+
+const char *integrator_name(Integrator integrator)
+{
+    switch (integrator) {
+        case INTEGRATOR_EULER: return "euler";
+        case INTEGRATOR_VERLET: return "verlet";
+        case INTEGRATOR_RK4: return "rk4";
+    }
+    return "unknown";
+}
+
+// Returns column i of the scratch space, each column holds one value
+// per body.
+static p2_real *body_store_scratch(BodyStore *store, int columns, int i)
+{
+    int n = body_store_count(store);
+    if (arrlen(store->scratch) < columns * n) {
+        arrsetlen(store->scratch, columns * n);
+    }
+    return store->scratch + i * n;
+}
+
+// Applies a uniform or drag-like force to the bodies of force. Drag and
+// friction are computed per body from the velocity as f, then scaled by
+// inv_mass.
+static void body_store_eval_force(const BodyStore *store, const ForceGen *force,
+        const p2_real *restrict pos_x, const p2_real *restrict pos_y,
+        const p2_real *restrict vel_x, const p2_real *restrict vel_y,
+        p2_real *restrict acc_x, p2_real *restrict acc_y)
+{
+    const p2_real *restrict inv_mass = store->inv_mass;
+    int n = force->bodies == NULL ? body_store_count(store) : arrlen(force->bodies);
+
+// Runs body over every body of force, with i the BodyId. The whole store
+// is a plain loop so it vectorizes.
+#define FORCE_EACH(body) \
+    if (force->bodies == NULL) { \
+        for (int i=0; i<n; i++) { body } \
+    } else { \
+        for (int j=0; j<n; j++) { int i = force->bodies[j]; body } \
+    }
+
+    switch (force->type) {
+        case FORCE_GRAVITY: {
+            p2_real gx = force->gravity.x, gy = force->gravity.y;
+            // Zero mass bodies are static
+            FORCE_EACH(
+                p2_real has_mass = inv_mass[i] > 0;
+                acc_x[i] += gx * has_mass;
+                acc_y[i] += gy * has_mass;
+            )
+        } break;
+        case FORCE_LINEAR_DRAG: {
+            p2_real k = force->coefficient;
+            FORCE_EACH(
+                acc_x[i] -= k * vel_x[i] * inv_mass[i];
+                acc_y[i] -= k * vel_y[i] * inv_mass[i];
+            )
+        } break;
+        case FORCE_QUADRATIC_DRAG: {
+            p2_real k = force->coefficient;
+            FORCE_EACH(
+                p2_real speed = p2_sqrt(vel_x[i] * vel_x[i] + vel_y[i] * vel_y[i]);
+                p2_real s = k * speed * inv_mass[i];
+                acc_x[i] -= s * vel_x[i];
+                acc_y[i] -= s * vel_y[i];
+            )
+        } break;
+        case FORCE_FRICTION: {
+            p2_real f = force->coefficient * force->normal;
+            FORCE_EACH(
+                p2_real speed = p2_sqrt(vel_x[i] * vel_x[i] + vel_y[i] * vel_y[i]);
+                p2_real s = speed > 0 ? f * inv_mass[i] / speed : 0;
+                acc_x[i] -= s * vel_x[i];
+                acc_y[i] -= s * vel_y[i];
+            )
+        } break;
+        case FORCE_ATTRACTOR: {
+            p2_real px = force->point.x, py = force->point.y;
+            p2_real strength = force->strength;
+            p2_real min_dist_sq = force->min_dist * force->min_dist;
+            FORCE_EACH(
+                p2_real dx = px - pos_x[i];
+                p2_real dy = py - pos_y[i];
+                p2_real d2 = dx * dx + dy * dy;
+                p2_real r2 = d2 > min_dist_sq ? d2 : min_dist_sq;
+                p2_real s = d2 > 0 ? strength / (r2 * p2_sqrt(d2)) : 0;
+                acc_x[i] += s * dx * (inv_mass[i] > 0);
+                acc_y[i] += s * dy * (inv_mass[i] > 0);
+            )
+        } break;
+        case FORCE_SPRING: {
+            BodyId a = force->a, b = force->b;
+            p2_real bx = b < 0 ? force->anchor.x : pos_x[b];
+            p2_real by = b < 0 ? force->anchor.y : pos_y[b];
+            p2_real bvx = b < 0 ? 0 : vel_x[b];
+            p2_real bvy = b < 0 ? 0 : vel_y[b];
+
+            p2_real dx = pos_x[a] - bx;
+            p2_real dy = pos_y[a] - by;
+            p2_real len = p2_sqrt(dx * dx + dy * dy);
+            if (len == 0) break;
+            dx /= len;
+            dy /= len;
+
+            // Hooke's law plus damping along the spring
+            p2_real rel_vel = (vel_x[a] - bvx) * dx + (vel_y[a] - bvy) * dy;
+            p2_real f = -force->stiffness * (len - force->rest_length) - force->damping * rel_vel;
+
+            acc_x[a] += f * dx * inv_mass[a];
+            acc_y[a] += f * dy * inv_mass[a];
+            if (b >= 0) {
+                acc_x[b] -= f * dx * inv_mass[b];
+                acc_y[b] -= f * dy * inv_mass[b];
+            }
+        } break;
+    }
+
+#undef FORCE_EACH
+}
+
+static inline bool body_store_has_fields(const BodyStore *store)
+{
+    return store->accel != NULL || arrlen(store->forces) > 0;
+}
+
+// Total acceleration at the given state: the applied forces plus the
+// accel field and force generators.
+static void body_store_eval_accel(BodyStore *store,
+        const p2_real *pos_x, const p2_real *pos_y,
+        const p2_real *vel_x, const p2_real *vel_y,
+        p2_real *acc_x, p2_real *acc_y)
+{
+    int n = body_store_count(store);
+    if (store->accel == NULL) {
+        memcpy(acc_x, store->acc_x, n * sizeof(p2_real));
+        memcpy(acc_y, store->acc_y, n * sizeof(p2_real));
+    } else {
+        store->accel(store, store->accel_ctx, pos_x, pos_y, vel_x, vel_y, acc_x, acc_y);
+        for (int i=0; i<n; i++) {
+            acc_x[i] += store->acc_x[i];
+            acc_y[i] += store->acc_y[i];
+        }
+    }
+
+    for (int f=0; f < arrlen(store->forces); f++) {
+        body_store_eval_force(store, &store->forces[f], pos_x, pos_y, vel_x, vel_y, acc_x, acc_y);
+    }
+}
+
+// v += a dt, x += v dt
+static void body_store_integrate_euler(BodyStore *store, const p2_real dt)
+{
+    int n = body_store_count(store);
+
+    p2_real *restrict pos_x = store->pos_x;
+    p2_real *restrict pos_y = store->pos_y;
+    p2_real *restrict vel_x = store->vel_x;
+    p2_real *restrict vel_y = store->vel_y;
+    const p2_real *restrict acc_x = store->acc_x;
+    const p2_real *restrict acc_y = store->acc_y;
+
+    if (body_store_has_fields(store)) {
+        p2_real *ax = body_store_scratch(store, 2, 0);
+        p2_real *ay = body_store_scratch(store, 2, 1);
+        body_store_eval_accel(store, pos_x, pos_y, vel_x, vel_y, ax, ay);
+        acc_x = ax;
+        acc_y = ay;
+    }
+
+    for (int i=0; i<n; i++) {
+        vel_x[i] += acc_x[i] * dt;
+        vel_y[i] += acc_y[i] * dt;
+        pos_x[i] += vel_x[i] * dt;
+        pos_y[i] += vel_y[i] * dt;
+    }
+}
+
+// x += v dt + a0 dt^2 / 2, v += (a0 + a1) dt / 2
+// where a1 is the acceleration at the new position.
+static void body_store_integrate_verlet(BodyStore *store, const p2_real dt)
+{
+    int n = body_store_count(store);
+
+    p2_real *restrict pos_x = store->pos_x;
+    p2_real *restrict pos_y = store->pos_y;
+    p2_real *restrict vel_x = store->vel_x;
+    p2_real *restrict vel_y = store->vel_y;
+    p2_real *restrict a0x = body_store_scratch(store, 6, 0);
+    p2_real *restrict a0y = body_store_scratch(store, 6, 1);
+    p2_real *restrict a1x = body_store_scratch(store, 6, 2);
+    p2_real *restrict a1y = body_store_scratch(store, 6, 3);
+    // Predicted velocity, for velocity dependent fields
+    p2_real *restrict vpx = body_store_scratch(store, 6, 4);
+    p2_real *restrict vpy = body_store_scratch(store, 6, 5);
+
+    body_store_eval_accel(store, pos_x, pos_y, vel_x, vel_y, a0x, a0y);
+
+    p2_real half_dt2 = 0.5 * dt * dt;
+    for (int i=0; i<n; i++) {
+        pos_x[i] += vel_x[i] * dt + a0x[i] * half_dt2;
+        pos_y[i] += vel_y[i] * dt + a0y[i] * half_dt2;
+        vpx[i] = vel_x[i] + a0x[i] * dt;
+        vpy[i] = vel_y[i] + a0y[i] * dt;
+    }
+
+    body_store_eval_accel(store, pos_x, pos_y, vpx, vpy, a1x, a1y);
+
+    p2_real half_dt = 0.5 * dt;
+    for (int i=0; i<n; i++) {
+        vel_x[i] += (a0x[i] + a1x[i]) * half_dt;
+        vel_y[i] += (a0y[i] + a1y[i]) * half_dt;
+    }
+}
+
+// Classic RK4 on the state (x, v) with derivative (v, a).
+static void body_store_integrate_rk4(BodyStore *store, const p2_real dt)
+{
+    int n = body_store_count(store);
+
+    p2_real *restrict pos_x = store->pos_x;
+    p2_real *restrict pos_y = store->pos_y;
+    p2_real *restrict vel_x = store->vel_x;
+    p2_real *restrict vel_y = store->vel_y;
+
+    // Stage state
+    p2_real *restrict tx = body_store_scratch(store, 10, 0);
+    p2_real *restrict ty = body_store_scratch(store, 10, 1);
+    p2_real *restrict tvx = body_store_scratch(store, 10, 2);
+    p2_real *restrict tvy = body_store_scratch(store, 10, 3);
+    // Stage acceleration
+    p2_real *restrict ax = body_store_scratch(store, 10, 4);
+    p2_real *restrict ay = body_store_scratch(store, 10, 5);
+    // Weighted sum of the stage derivatives
+    p2_real *restrict sx = body_store_scratch(store, 10, 6);
+    p2_real *restrict sy = body_store_scratch(store, 10, 7);
+    p2_real *restrict svx = body_store_scratch(store, 10, 8);
+    p2_real *restrict svy = body_store_scratch(store, 10, 9);
+
+    memcpy(tx, pos_x, n * sizeof(p2_real));
+    memcpy(ty, pos_y, n * sizeof(p2_real));
+    memcpy(tvx, vel_x, n * sizeof(p2_real));
+    memcpy(tvy, vel_y, n * sizeof(p2_real));
+    memset(sx, 0, n * sizeof(p2_real));
+    memset(sy, 0, n * sizeof(p2_real));
+    memset(svx, 0, n * sizeof(p2_real));
+    memset(svy, 0, n * sizeof(p2_real));
+
+    const p2_real weight[4] = {1, 2, 2, 1};
+    const p2_real step[4] = {0.5, 0.5, 1, 0};
+
+    for (int k=0; k<4; k++) {
+        body_store_eval_accel(store, tx, ty, tvx, tvy, ax, ay);
+
+        p2_real w = weight[k];
+        p2_real h = step[k] * dt;
+        for (int i=0; i<n; i++) {
+            sx[i] += w * tvx[i];
+            sy[i] += w * tvy[i];
+            svx[i] += w * ax[i];
+            svy[i] += w * ay[i];
+            // State for the next stage
+            tx[i] = pos_x[i] + h * tvx[i];
+            ty[i] = pos_y[i] + h * tvy[i];
+            tvx[i] = vel_x[i] + h * ax[i];
+            tvy[i] = vel_y[i] + h * ay[i];
+        }
+    }
+
+    p2_real sixth_dt = dt / 6;
+    for (int i=0; i<n; i++) {
+        pos_x[i] += sx[i] * sixth_dt;
+        pos_y[i] += sy[i] * sixth_dt;
+        vel_x[i] += svx[i] * sixth_dt;
+        vel_y[i] += svy[i] * sixth_dt;
+    }
+}
+
+// Integrates every body in the store with store->integrator. With the
+// default INTEGRATOR_EULER and no accel field this is the same as calling
+// body_update on each of them.
+void body_store_update_all(BodyStore *store, const p2_real dt)
+{
+    int n = body_store_count(store);
+
+    switch (store->integrator) {
+        case INTEGRATOR_EULER: body_store_integrate_euler(store, dt); break;
+        case INTEGRATOR_VERLET: body_store_integrate_verlet(store, dt); break;
+        case INTEGRATOR_RK4: body_store_integrate_rk4(store, dt); break;
+    }
+
+    p2_real *restrict vel_x = store->vel_x;
+    p2_real *restrict vel_y = store->vel_y;
+    const p2_real *restrict max_speed = store->max_speed;
+
+    memset(store->acc_x, 0, n * sizeof(p2_real));
+    memset(store->acc_y, 0, n * sizeof(p2_real));
+
+    // Speed limit is a second pass so the integration loops stay branch free.
+    for (int i=0; i<n; i++) {
+        p2_real limit = max_speed[i];
+        p2_real mag_sq = vel_x[i] * vel_x[i] + vel_y[i] * vel_y[i];
+        if (limit >= 0 && mag_sq > limit * limit) {
+            p2_real scale = limit / p2_sqrt(mag_sq);
+            vel_x[i] *= scale;
+            vel_y[i] *= scale;
+        }
+    }
+}
+
+Body body_store_get(const BodyStore *store, BodyId id)
+{
+    return (Body){
+        .pos = vec2(store->pos_x[id], store->pos_y[id]),
+        .prev_pos = vec2(store->pos_x[id], store->pos_y[id]),
+        .vel = vec2(store->vel_x[id], store->vel_y[id]),
+        .acc = vec2(store->acc_x[id], store->acc_y[id]),
+        .mass = store->mass[id],
+        .max_speed = store->max_speed[id],
+        .sleep_speed = -1,
+        .island = -1,
+    };
+}
+
+void body_store_set(BodyStore *store, BodyId id, Body body)
+{
+    store->pos_x[id] = body.pos.x;
+    store->pos_y[id] = body.pos.y;
+    store->vel_x[id] = body.vel.x;
+    store->vel_y[id] = body.vel.y;
+    store->acc_x[id] = body.acc.x;
+    store->acc_y[id] = body.acc.y;
+    store->mass[id] = body.mass;
+    store->inv_mass[id] = body.mass == 0 ? 0 : 1 / body.mass;
+    store->max_speed[id] = body.max_speed;
+}
+
+Vec2 body_store_pos(const BodyStore *store, BodyId id)
+{
+    return vec2(store->pos_x[id], store->pos_y[id]);
+}
+
+Vec2 body_store_vel(const BodyStore *store, BodyId id)
+{
+    return vec2(store->vel_x[id], store->vel_y[id]);
+}
+
+void body_store_set_pos(BodyStore *store, BodyId id, Vec2 pos)
+{
+    store->pos_x[id] = pos.x;
+    store->pos_y[id] = pos.y;
+}
+
+void body_store_set_vel(BodyStore *store, BodyId id, Vec2 vel)
+{
+    store->vel_x[id] = vel.x;
+    store->vel_y[id] = vel.y;
+}
+
+void body_store_apply_force(BodyStore *store, BodyId id, const Vec2 force)
+{
+    // a = F / m
+    store->acc_x[id] += force.x * store->inv_mass[id];
+    store->acc_y[id] += force.y * store->inv_mass[id];
+}
+
+void body_store_apply_gravity(BodyStore *store, BodyId id, const Vec2 gravity)
+{
+    store->acc_x[id] += gravity.x;
+    store->acc_y[id] += gravity.y;
+}
+
+// body_store_add_force registers force with the store, which takes
+// ownership of force.bodies. Returns the index of the force.
+int body_store_add_force(BodyStore *store, ForceGen force)
+{
+    arrput(store->forces, force);
+    return arrlen(store->forces) - 1;
+}
+
+void body_store_clear_forces(BodyStore *store)
+{
+    for (int i=0; i < arrlen(store->forces); i++) {
+        arrfree(store->forces[i].bodies);
+    }
+    arrsetlen(store->forces, 0);
+}
+
+// bodies_apply_forces evaluates the forces for bodies that are not in a
+// store, one pass per force like a store does, and adds the result to the
+// acceleration of each body. BodyIds of the forces index bodies. The
+// bodies are copied into the columns of scratch, which the caller keeps
+// from step to step. Sleeping bodies are left asleep, a steady force like
+// gravity would never let them rest.
+void bodies_apply_forces(Body **bodies, int n, const ForceGen *forces, int num_forces,
+        BodyStore *scratch)
+{
+    if (num_forces == 0) return;
+
+    arrsetlen(scratch->pos_x, n);
+    arrsetlen(scratch->pos_y, n);
+    arrsetlen(scratch->vel_x, n);
+    arrsetlen(scratch->vel_y, n);
+    arrsetlen(scratch->acc_x, n);
+    arrsetlen(scratch->acc_y, n);
+    arrsetlen(scratch->inv_mass, n);
+    for (int i=0; i<n; i++) {
+        const Body *body = bodies[i];
+        scratch->pos_x[i] = body->pos.x;
+        scratch->pos_y[i] = body->pos.y;
+        scratch->vel_x[i] = body->vel.x;
+        scratch->vel_y[i] = body->vel.y;
+        scratch->acc_x[i] = 0;
+        scratch->acc_y[i] = 0;
+        scratch->inv_mass[i] = body->mass == 0 ? 0 : 1 / body->mass;
+    }
+
+    for (int f=0; f<num_forces; f++) {
+        body_store_eval_force(scratch, &forces[f],
+                scratch->pos_x, scratch->pos_y, scratch->vel_x, scratch->vel_y,
+                scratch->acc_x, scratch->acc_y);
+    }
+
+    for (int i=0; i<n; i++) {
+        if (bodies[i]->sleeping) continue;
+        bodies[i]->acc = vec2_add(bodies[i]->acc, vec2(scratch->acc_x[i], scratch->acc_y[i]));
+    }
+}
+
+/**********************************************
+ *
+ * Forces
+ *
+ **********************************************/
+
+ForceGen force_gravity(Vec2 gravity)
+{
+    return (ForceGen){.type = FORCE_GRAVITY, .gravity = gravity};
+}
+
+ForceGen force_linear_drag(p2_real k)
+{
+    return (ForceGen){.type = FORCE_LINEAR_DRAG, .coefficient = k};
+}
+
+ForceGen force_quadratic_drag(p2_real k)
+{
+    return (ForceGen){.type = FORCE_QUADRATIC_DRAG, .coefficient = k};
+}
+
+ForceGen force_friction(p2_real coff, p2_real normal)
+{
+    return (ForceGen){.type = FORCE_FRICTION, .coefficient = coff, .normal = normal};
+}
+
+ForceGen force_attractor(Vec2 point, p2_real strength, p2_real min_dist)
+{
+    return (ForceGen){
+        .type = FORCE_ATTRACTOR,
+        .point = point,
+        .strength = strength,
+        .min_dist = min_dist,
+    };
+}
+
+ForceGen force_spring(BodyId a, BodyId b, p2_real stiffness, p2_real damping, p2_real rest_length)
+{
+    return (ForceGen){
+        .type = FORCE_SPRING,
+        .a = a,
+        .b = b,
+        .stiffness = stiffness,
+        .damping = damping,
+        .rest_length = rest_length,
+    };
+}
+
+ForceGen force_anchored_spring(BodyId a, Vec2 anchor, p2_real stiffness, p2_real damping, p2_real rest_length)
+{
+    ForceGen force = force_spring(a, -1, stiffness, damping, rest_length);
+    force.anchor = anchor;
+    return force;
+}
+
+// force_add_body limits force to the given bodies, instead of every body.
+void force_add_body(ForceGen *force, BodyId id)
+{
+    arrput(force->bodies, id);
+}
+
+const char *force_name(ForceType type)
+{
+    switch (type) {
+        case FORCE_GRAVITY: return "gravity";
+        case FORCE_LINEAR_DRAG: return "linear drag";
+        case FORCE_QUADRATIC_DRAG: return "quadratic drag";
+        case FORCE_FRICTION: return "friction";
+        case FORCE_ATTRACTOR: return "attractor";
+        case FORCE_SPRING: return "spring";
+    }
+    return "unknown";
+}
+
+// friction returns a force. 
+// f = -1 * u * N v
+// 
+// n normal force magnature
+// coff coffiefient of friction
+Vec2 friction(Vec2 vel, p2_real coff, p2_real n)
+{
+    vel = vec2_normalize(vel);
+    return vec2_mult(vel, -coff*n);
+}
+
+// drag returns a force against the velocity.
+// f = -1 * c |v|^n v/|v|
+//
+// n power of the speed, 1 for linear drag and 2 for quadratic drag
+// coff drag coffiefient
+Vec2 drag(Vec2 vel, p2_real coff, p2_real n)
+{
+    p2_real speed = vec2_mag(vel);
+    if (speed == 0) return vec2zero;
+    return vec2_mult(vel, -coff * pow(speed, n - 1));
+}
+
+/**********************************************
+ *
+ * Fixed point
+ *
+ **********************************************/
+
+// isqrt64 is floor(sqrt(n)), one result bit per iteration.
+uint64_t isqrt64(uint64_t n)
+{
+    uint64_t res = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > n) bit >>= 2;
+
+    while (bit != 0) {
+        if (n >= res + bit) {
+            n -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
+
+// fix_sqrt of a negative number is 0.
+p2_fixed fix_sqrt(p2_fixed a)
+{
+    if (a <= 0) return 0;
+    return (p2_fixed) isqrt64((uint64_t) a << FIX_SHIFT);
+}
+
+FixVec2 fixvec2_normalize(FixVec2 v)
+{
+    p2_fixed mag = fixvec2_mag(v);
+    if (mag == 0) return fixvec2zero;
+    return fixvec2_div(v, mag);
+}
+
+FixVec2 fixvec2_set_mag(FixVec2 v, p2_fixed m)
+{
+    p2_fixed mag = fixvec2_mag(v);
+    if (mag == 0) return fixvec2zero;
+    // Scale before dividing to keep the precision of small vectors
+    return fixvec2(
+        (p2_fixed) ((int64_t) v.x * m / mag),
+        (p2_fixed) ((int64_t) v.y * m / mag));
+}
+
+FixVec2 fixvec2_limit(FixVec2 v, p2_fixed max)
+{
+    if (fixvec2_mag_sq_wide(v) <= (uint64_t) ((int64_t) max * max)) return v;
+    return fixvec2_set_mag(v, max);
+}
+
+void fix_body_init(FixBody *body, FixVec2 pos, p2_fixed mass)
+{
+    body->pos = pos;
+    body->vel = fixvec2zero;
+    body->acc = fixvec2zero;
+    body->inv_mass = mass == 0 ? 0 : fix_div(FIX_ONE, mass);
+    body->max_speed = -1;
+}
+
+void fix_body_apply_force(FixBody *body, FixVec2 force)
+{
+    body->acc = fixvec2_add(body->acc, fixvec2_mult(force, body->inv_mass));
+}
+
+void fix_body_apply_gravity(FixBody *body, FixVec2 gravity)
+{
+    body->acc = fixvec2_add(body->acc, gravity);
+}
+
+// fix_body_update is body_update in fixed point.
+void fix_body_update(FixBody *body, p2_fixed dt)
+{
+    body->vel = fixvec2_add(body->vel, fixvec2_mult(body->acc, dt));
+    body->pos = fixvec2_add(body->pos, fixvec2_mult(body->vel, dt));
+    body->acc = fixvec2zero;
+    if (body->max_speed >= 0) {
+        body->vel = fixvec2_limit(body->vel, body->max_speed);
+    }
+}
+
+uint64_t fix_bodies_checksum(const FixBody *bodies, int n)
+{
+    uint64_t hash = CHECKSUM_INIT;
+    for (int i=0; i<n; i++) {
+        hash = checksum_bytes(hash, &bodies[i].pos, sizeof(FixVec2));
+        hash = checksum_bytes(hash, &bodies[i].vel, sizeof(FixVec2));
+    }
+    return hash;
+}
+
+FixContact fix_circle_collide(FixCircle a, FixCircle b)
+{
+    FixContact contact = {0};
+    FixVec2 d = fixvec2_sub(b.center, a.center);
+    // Below 2^32, so its square fits in 64 unsigned bits
+    int64_t r = (int64_t) a.radius + b.radius;
+    if (r <= 0 || fixvec2_mag_sq_wide(d) >= (uint64_t) r * (uint64_t) r) return contact;
+
+    p2_fixed dist = fixvec2_mag(d);
+    contact.hit = true;
+    contact.depth = fix_saturate(r - dist);
+    // Same center, push apart along x
+    contact.normal = dist == 0 ? fixvec2(FIX_ONE, 0) : fixvec2_div(d, dist);
+    return contact;
+}
+
+FixContact fix_rect_collide(FixRect a, FixRect b)
+{
+    FixContact contact = {0};
+    p2_fixed overlap_x = fix_sub(fix_min(fix_add(a.pos.x, a.width), fix_add(b.pos.x, b.width)), fix_max(a.pos.x, b.pos.x));
+    p2_fixed overlap_y = fix_sub(fix_min(fix_add(a.pos.y, a.height), fix_add(b.pos.y, b.height)), fix_max(a.pos.y, b.pos.y));
+    if (overlap_x <= 0 || overlap_y <= 0) return contact;
+
+    contact.hit = true;
+    // Separate along the axis of least overlap
+    if (overlap_x < overlap_y) {
+        contact.depth = overlap_x;
+        bool right = (int64_t) b.pos.x * 2 + b.width > (int64_t) a.pos.x * 2 + a.width;
+        contact.normal = fixvec2(right ? FIX_ONE : -FIX_ONE, 0);
+    } else {
+        contact.depth = overlap_y;
+        bool down = (int64_t) b.pos.y * 2 + b.height > (int64_t) a.pos.y * 2 + a.height;
+        contact.normal = fixvec2(0, down ? FIX_ONE : -FIX_ONE);
+    }
+    return contact;
+}
+
+static inline p2_fixed fix_clamp(p2_fixed a, p2_fixed lo, p2_fixed hi)
+{
+    return a < lo ? lo : a > hi ? hi : a;
+}
+
+FixContact fix_circle_rect_collide(FixCircle a, FixRect b)
+{
+    FixContact contact = {0};
+    FixVec2 closest = fixvec2(
+        fix_clamp(a.center.x, b.pos.x, fix_add(b.pos.x, b.width)),
+        fix_clamp(a.center.y, b.pos.y, fix_add(b.pos.y, b.height)));
+
+    FixVec2 d = fixvec2_sub(closest, a.center);
+    uint64_t r2 = (uint64_t) ((int64_t) a.radius * a.radius);
+    if (fixvec2_mag_sq_wide(d) >= r2) return contact;
+
+    p2_fixed dist = fixvec2_mag(d);
+    contact.hit = true;
+    if (dist == 0) {
+        // Center inside the rect, push out through the nearest side
+        p2_fixed left = fix_sub(a.center.x, b.pos.x);
+        p2_fixed right = fix_sub(fix_add(b.pos.x, b.width), a.center.x);
+        p2_fixed top = fix_sub(a.center.y, b.pos.y);
+        p2_fixed bottom = fix_sub(fix_add(b.pos.y, b.height), a.center.y);
+        p2_fixed near = fix_min(fix_min(left, right), fix_min(top, bottom));
+        contact.depth = fix_add(near, a.radius);
+        if (near == left) contact.normal = fixvec2(FIX_ONE, 0);
+        else if (near == right) contact.normal = fixvec2(-FIX_ONE, 0);
+        else if (near == top) contact.normal = fixvec2(0, FIX_ONE);
+        else contact.normal = fixvec2(0, -FIX_ONE);
+    } else {
+        contact.depth = fix_sub(a.radius, dist);
+        contact.normal = fixvec2_div(d, dist);
+    }
+    return contact;
+}
+
+uint64_t checksum_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i=0; i<size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// body_store_checksum hashes the position and velocity of every body, to
+// compare once per frame between peers. Bit identical only when every peer
+// runs the same build on the same kind of machine, use FixBody for more.
+uint64_t body_store_checksum(const BodyStore *store)
+{
+    int n = body_store_count(store);
+    uint64_t hash = CHECKSUM_INIT;
+    hash = checksum_bytes(hash, store->pos_x, n * sizeof(p2_real));
+    hash = checksum_bytes(hash, store->pos_y, n * sizeof(p2_real));
+    hash = checksum_bytes(hash, store->vel_x, n * sizeof(p2_real));
+    hash = checksum_bytes(hash, store->vel_y, n * sizeof(p2_real));
+    return hash;
+}
+
+/**
+ * Perlin Noise
+ *
+ */
+/* #define STB_PERLIN_IMPLEMENTATION */
+/* #include "stb_perlin.h" */
+
+void noise_seed(int seed)
+{
     /* stb_perlin_noise3_seed(x, y, z, 0, 0, 0, seed); */
 }
-double noise(double x);
-double noise2(double x, double y);
-double noise3(double x, double y, double z)
+double noise(double x);
+double noise2(double x, double y);
+double noise3(double x, double y, double z)
+{
+    /* return stb_perlin_noise3(x, y, z, 0, 0, 0); */
+    return 0;
+}
+
+void destroy_noise();
+
+/**********************************************
+ *
+ * Shapes
+ *
+ **********************************************/
+
+
+// https://happycoding.io/tutorials/processing/collision-detection
+// https://www.jeffreythompson.org/collision-detection/index.php
+
+/**
+ * Poly storage
+ *
+ */
+
+static Vec2 *poly_arena_alloc(PolyArena *arena, int n)
+{
+    if (arrlen(arena->blocks) == 0 || arena->used + n > POLY_ARENA_BLOCK) {
+        arrput(arena->blocks, (Vec2*) malloc(sizeof(Vec2) * POLY_ARENA_BLOCK));
+        arena->used = 0;
+    }
+    Vec2 *v = arrlast(arena->blocks) + arena->used;
+    arena->used += n;
+    return v;
+}
+
+void poly_arena_free(PolyArena *arena)
+{
+    for (int i=0; i < arrlen(arena->blocks); i++) free(arena->blocks[i]);
+    arrfree(arena->blocks);
+    arena->used = 0;
+}
+
+Shape poly_in_arena(PolyArena *arena, const Vec2 *v, int n)
+{
+    if (n <= POLY_INLINE_VERTS) return polyv(v, n);
+
+    // Like polyv, too many asserts or gives an empty poly
+    assert(n <= POLY_MAX_VERTS);
+    if (n > POLY_MAX_VERTS) return polyv(v, 0);
+
+    Shape s = { .type = POLY };
+    s.poly.n = n;
+    s.poly.ext = poly_arena_alloc(arena, 2 * n);
+    memcpy(s.poly.ext, v, sizeof(Vec2) * n);
+    s.poly.centroid = poly_prepare(s.poly.ext, s.poly.ext + n, n);
+    return s;
+}
+
+static inline const Vec2 *poly_normals(const Poly *p)
+{
+    return p->ext ? p->ext + p->n : p->normals;
+}
+
+/**
+ * Area functions
+ * 
+ */
+
+p2_real point_area(Point p)
+{
+    return 1;
+}
+
+p2_real line_area(Line l)
+{
+    return 0;
+}
+
+p2_real circle_area(Circle p)
+{
+    return M_PI * p.radius  * p.radius;
+}
+
+p2_real triangle_area(Triangle t)
+{
+    return -1; // TODO
+}
+
+p2_real rect_area(Rect r)
+{
+    return r.width * r.height;
+}
+
+p2_real quad_area(Quad q)
+{
+    return -1; // TODO
+}
+
+
+p2_real poly_area(Poly p)
+{
+    const Vec2 *v = p.ext ? p.ext : p.v;
+    p2_real area = 0;
+    for (int i=0; i < p.n; i++) {
+        Vec2 a = v[i], b = v[(i + 1) % p.n];
+        area += a.x * b.y - a.y * b.x;
+    }
+    return p2_fabs(area) / 2;
+}
+
+p2_real shape_area(Shape s) {
+    switch (s.type) {
+        case POINT: return point_area(s.point); break;
+        case LINE: return line_area(s.line); break;
+        case CIRCLE: return circle_area(s.circle); break;
+        case TRIANGLE: return triangle_area(s.triangle); break;
+        case QUAD: return quad_area(s.quad); break;
+        case RECT: return rect_area(s.rect); break;
+        case POLY: return poly_area(s.poly); break;
+    }
+    return false;
+}
+
+/**
+ * Collision functions
+ * 
+ */
+
+// Each pair of shape types has one collide function, named after the two
+// types in ShapeType order. shape_collide swaps the shapes for the mirrored
+// pair.
+
+static void manifold_points(const Shape *s1, const Shape *s2, Manifold *m);
+
+Manifold point_collide(Point p1, Point p2)
+{
+    int p1x = p1.x;
+    int p1y = p1.y;
+    int p2x = p2.x;
+    int p2y = p2.y;
+    if (p1x != p2x || p1y != p2y) return manifold_miss;
+
+    // Nothing to tell which way out
+    return (Manifold) {
+        .points = {p1},
+        .count = 1,
+    };
+}
+
+Manifold point_collide_circle(Point p, Circle c)
+{
+    Vec2 d = vec2_sub(p, c.center);
+    if (vec2_mag_sq(d) > c.radius * c.radius) return manifold_miss;
+
+    Manifold m = {
+        .normal = vec2_normalize(d),
+        .depth = c.radius - vec2_mag(d),
+        .count = 1,
+    };
+    m.points[0] = vec2_add(p, vec2_mult(m.normal, m.depth / 2));
+    return m;
+}
+
+Manifold circle_collide(Circle c1, Circle c2)
+{ 
+  // get distance between the circle's centers
+  // use the Pythagorean Theorem to compute the distance
+  p2_real distX = c1.center.x - c2.center.x;
+  p2_real distY = c1.center.y - c2.center.y;
+  p2_real distance = p2_sqrt( (distX*distX) + (distY*distY) );
+
+  // if the distance is less than the sum of the circle's
+  // radii, the circles are touching!
+  if (distance > c1.radius+c2.radius) return manifold_miss;
+
+  Manifold m = {
+    // Same center, push apart along x
+    .normal = distance > 0 ? vec2_mult(vec2(distX, distY), 1 / distance) : vec2(1, 0),
+    .depth = c1.radius + c2.radius - distance,
+    .count = 1,
+  };
+  // Midway between the deepest points of the two circles
+  m.points[0] = vec2_add(c1.center, vec2_mult(m.normal, m.depth / 2 - c1.radius));
+  return m;
+}
+
+Manifold rect_collide(Rect r1, Rect r2)
+{
+    p2_real overlap_x = min(r1.pos.x + r1.width, r2.pos.x + r2.width) - max(r1.pos.x, r2.pos.x);
+    p2_real overlap_y = min(r1.pos.y + r1.height, r2.pos.y + r2.height) - max(r1.pos.y, r2.pos.y);
+    if (overlap_x < 0 || overlap_y < 0) return manifold_miss;
+
+    // Out along the axis of least overlap
+    Manifold m = {0};
+    if (overlap_x < overlap_y) {
+        m.normal = vec2(r1.pos.x + r1.width / 2 < r2.pos.x + r2.width / 2 ? -1 : 1, 0);
+    } else {
+        m.normal = vec2(0, r1.pos.y + r1.height / 2 < r2.pos.y + r2.height / 2 ? -1 : 1);
+    }
+    m.depth = min(overlap_x, overlap_y);
+
+    Shape s1 = { .type = RECT, .rect = r1 };
+    Shape s2 = { .type = RECT, .rect = r2 };
+    manifold_points(&s1, &s2, &m);
+    return m;
+}
+
+Manifold poly_collide(Poly p1, Poly p2);
+
+/**
+ * Separating axis test
+ *
+ * Two convex shapes miss each other if and only if there is an axis where
+ * their projections don't overlap. For polygons it is enough to try the
+ * edge normals of both, a circle adds the axis from its center to the
+ * closest vertex of the other shape. When they all overlap the shapes hit,
+ * and the axis with the least overlap is the way out.
+ *
+ * Every pair with a line, rect, triangle, quad or poly uses it, except
+ * rect x rect which has its own faster test.
+ */
+
+// SHAPE_MAX_VERTS is the most vertices shape_verts puts in the buffer.
+// Polys hand out their own vertices.
+#define SHAPE_MAX_VERTS 4
+
+// shape_verts returns the vertices of s, in buf unless s is a POLY.
+static const Vec2 *shape_verts(const Shape *s, Vec2 *buf, int *n)
+{
+    switch (s->type) {
+        case POINT:
+            buf[0] = s->point;
+            *n = 1;
+            break;
+        case LINE:
+            buf[0] = s->line.v1;
+            buf[1] = s->line.v2;
+            *n = 2;
+            break;
+        case CIRCLE:
+            buf[0] = s->circle.center;
+            *n = 1;
+            break;
+        case RECT: {
+            Quad q = rect_to_quad(s->rect);
+            buf[0] = q.v1; buf[1] = q.v2; buf[2] = q.v3; buf[3] = q.v4;
+            *n = 4;
+        } break;
+        case TRIANGLE:
+            buf[0] = s->triangle.v1;
+            buf[1] = s->triangle.v2;
+            buf[2] = s->triangle.v3;
+            *n = 3;
+            break;
+        case QUAD:
+            buf[0] = s->quad.v1;
+            buf[1] = s->quad.v2;
+            buf[2] = s->quad.v3;
+            buf[3] = s->quad.v4;
+            *n = 4;
+            break;
+        case POLY: {
+            const Poly *p = &s->poly;
+            *n = p->n;
+            // Moved arena polys are flattened before they get here
+            return p->ext ? p->ext : p->v;
+        }
+    }
+    return buf;
+}
+
+#if defined(__GNUC__)
+#define P2_NOINLINE __attribute__((noinline))
+#else
+#define P2_NOINLINE
+#endif
+
+// An arena poly moved by an offset has no vertices where it is. The pair
+// tests copy them moved into a PolyFlat first, in a function of its own
+// so the vertex buffers of all other tests stay SHAPE_MAX_VERTS small.
+typedef struct PolyFlat {
+    Shape shape;
+    Vec2 v[2 * POLY_MAX_VERTS];
+} PolyFlat;
+
+static inline bool poly_moved(const Shape *s)
+{
+    return s->type == POLY && s->poly.ext
+        && (s->poly.offset.x != 0 || s->poly.offset.y != 0);
+}
+
+static const Shape *poly_flatten(const Shape *s, PolyFlat *flat)
+{
+    if (!poly_moved(s)) return s;
+
+    const Poly *p = &s->poly;
+    for (int i=0; i < p->n; i++) {
+        flat->v[i] = vec2_add(p->ext[i], p->offset);
+        flat->v[p->n + i] = p->ext[p->n + i];
+    }
+    flat->shape = *s;
+    flat->shape.poly.ext = flat->v;
+    flat->shape.poly.offset = vec2zero;
+    return &flat->shape;
+}
+
+// The shape with a moved arena poly put back where its vertices are, for
+// answers that only need moving by the offset after.
+static inline Vec2 poly_unmove(Shape *s)
+{
+    Vec2 offset = s->poly.offset;
+    s->poly.offset = vec2zero;
+    s->poly.centroid = vec2_sub(s->poly.centroid, offset);
+    return offset;
+}
+
+static void shape_project(const Shape *s, const Vec2 *v, int n, Vec2 axis,
+        p2_real *lo, p2_real *hi)
+{
+    if (s->type == CIRCLE) {
+        p2_real c = vec2_dot(s->circle.center, axis);
+        *lo = c - s->circle.radius;
+        *hi = c + s->circle.radius;
+        return;
+    }
+
+    *lo = *hi = vec2_dot(v[0], axis);
+    for (int i=1; i<n; i++) {
+        p2_real d = vec2_dot(v[i], axis);
+        if (d < *lo) *lo = d;
+        if (d > *hi) *hi = d;
+    }
+}
+
+static Vec2 verts_center(const Vec2 *v, int n)
+{
+    Vec2 c = vec2zero;
+    for (int i=0; i<n; i++) c = vec2_add(c, v[i]);
+    return vec2_div(c, n);
+}
+
+// Middle of a shape with vertices v, polys know theirs
+static Vec2 shape_middle(const Shape *s, const Vec2 *v, int n)
+{
+    if (s->type == POLY) return s->poly.centroid;
+    return verts_center(v, n);
+}
+
+// Axis from center to the closest vertex, for circles
+static Vec2 verts_closest_axis(const Vec2 *v, int n, Vec2 center)
+{
+    Vec2 closest = v[0];
+    for (int i=1; i<n; i++) {
+        if (vec2_mag_sq(vec2_sub(v[i], center)) < vec2_mag_sq(vec2_sub(closest, center))) closest = v[i];
+    }
+    return vec2_normalize(vec2_sub(closest, center));
+}
+
+/**
+ * Contact points
+ *
+ * manifold_points fills in where two shapes touch, from the normal and
+ * depth of the hit. A circle or a point touches in one spot, its deepest
+ * point. Between two shapes with edges, each gives the edge that faces the
+ * other most. The one more square to the normal is the reference edge, the
+ * other the incident edge. The incident edge is clipped to the sides of the
+ * reference edge, and the clipped points below it are the contacts.
+ */
+
+typedef struct ClipVertex {
+    Vec2 p;
+    // Feature of the incident and of the reference shape
+    uint8_t inc;
+    uint8_t ref;
+} ClipVertex;
+
+#define CONTACT_FEATURE(i) ((uint8_t)((i) & ~CONTACT_EDGE))
+
+// Index of the vertex farthest in dir
+static int verts_support(const Vec2 *v, int n, Vec2 dir)
+{
+    int best = 0;
+    p2_real best_dot = vec2_dot(v[0], dir);
+    for (int i=1; i<n; i++) {
+        p2_real d = vec2_dot(v[i], dir);
+        if (d > best_dot) {
+            best = i;
+            best_dot = d;
+        }
+    }
+    return best;
+}
+
+// Start of the edge that faces dir most, the edge from v[i] to v[i + 1]
+static int verts_best_edge(const Vec2 *v, int n, Vec2 dir)
+{
+    if (n == 2) return 0;
+
+    // One of the two edges at the farthest vertex, the one more square to dir
+    int k = verts_support(v, n, dir);
+    int prev = (k + n - 1) % n;
+    Vec2 e_prev = vec2_normalize(vec2_sub(v[k], v[prev]));
+    Vec2 e_next = vec2_normalize(vec2_sub(v[(k + 1) % n], v[k]));
+    return p2_fabs(vec2_dot(e_prev, dir)) <= p2_fabs(vec2_dot(e_next, dir)) ? prev : k;
+}
+
+// Keeps the part of the segment with dot(normal, p) <= offset. A point made
+// by the cut lies on incident edge inc, at reference vertex ref.
+static int clip_segment(ClipVertex out[2], const ClipVertex in[2], Vec2 normal, p2_real offset,
+        uint8_t inc, uint8_t ref)
+{
+    p2_real d0 = vec2_dot(normal, in[0].p) - offset;
+    p2_real d1 = vec2_dot(normal, in[1].p) - offset;
+
+    int n = 0;
+    if (d0 <= 0) out[n++] = in[0];
+    if (d1 <= 0) out[n++] = in[1];
+    if (d0 * d1 < 0) {
+        out[n].p = vec2_lerp(in[0].p, in[1].p, d0 / (d0 - d1));
+        out[n].inc = inc;
+        out[n].ref = ref;
+        n++;
+    }
+    return n;
+}
+
+static void manifold_points(const Shape *s1, const Shape *s2, Manifold *m)
+{
+    Vec2 buf1[SHAPE_MAX_VERTS], buf2[SHAPE_MAX_VERTS];
+    int n1, n2;
+    const Vec2 *v1 = shape_verts(s1, buf1, &n1);
+    const Vec2 *v2 = shape_verts(s2, buf2, &n2);
+    Vec2 normal = m->normal;
+
+    m->count = 1;
+    if (vec2_equal(normal, vec2zero)) {
+        m->points[0] = verts_center(v1, n1);
+        m->ids[0] = 0;
+        return;
+    }
+
+    // One point, in case there is no edge to clip or clipping fails
+    int k1 = verts_support(v1, n1, vec2_mult(normal, -1));
+    int k2 = verts_support(v2, n2, normal);
+    m->ids[0] = CONTACT_ID(CONTACT_FEATURE(k1), CONTACT_FEATURE(k2));
+    if (s2->type == CIRCLE || n2 < 2) {
+        Vec2 deep = s2->type == CIRCLE
+            ? vec2_add(s2->circle.center, vec2_mult(normal, s2->circle.radius))
+            : v2[k2];
+        m->points[0] = vec2_sub(deep, vec2_mult(normal, m->depth / 2));
+        return;
+    }
+    Vec2 deep = s1->type == CIRCLE
+        ? vec2_sub(s1->circle.center, vec2_mult(normal, s1->circle.radius))
+        : v1[k1];
+    m->points[0] = vec2_add(deep, vec2_mult(normal, m->depth / 2));
+    if (s1->type == CIRCLE || n1 < 2) return;
+
+    int e1 = verts_best_edge(v1, n1, vec2_mult(normal, -1));
+    int e2 = verts_best_edge(v2, n2, normal);
+    Vec2 edge1 = vec2_normalize(vec2_sub(v1[(e1 + 1) % n1], v1[e1]));
+    Vec2 edge2 = vec2_normalize(vec2_sub(v2[(e2 + 1) % n2], v2[e2]));
+
+    // flip when the reference edge is on s1, toward points out of it
+    bool flip = p2_fabs(vec2_dot(edge1, normal)) < p2_fabs(vec2_dot(edge2, normal));
+    const Vec2 *rv = flip ? v1 : v2, *iv = flip ? v2 : v1;
+    int rn = flip ? n1 : n2, in = flip ? n2 : n1;
+    int re = flip ? e1 : e2, ie = flip ? e2 : e1;
+    Vec2 toward = flip ? vec2_mult(normal, -1) : normal;
+
+    uint8_t ref_edge = CONTACT_FEATURE(re) | CONTACT_EDGE;
+    uint8_t inc_edge = CONTACT_FEATURE(ie) | CONTACT_EDGE;
+    ClipVertex inc[2] = {
+        {iv[ie], CONTACT_FEATURE(ie), ref_edge},
+        {iv[(ie + 1) % in], CONTACT_FEATURE((ie + 1) % in), ref_edge},
+    };
+
+    // Clip to the sides of the reference edge
+    Vec2 r1 = rv[re], r2 = rv[(re + 1) % rn];
+    Vec2 t = vec2_normalize(vec2_sub(r2, r1));
+    ClipVertex clip1[2], clip2[2];
+    if (clip_segment(clip1, inc, vec2_mult(t, -1), -vec2_dot(t, r1),
+                inc_edge, CONTACT_FEATURE(re)) < 2) return;
+    if (clip_segment(clip2, clip1, t, vec2_dot(t, r2),
+                inc_edge, CONTACT_FEATURE((re + 1) % rn)) < 2) return;
+
+    Vec2 face = vec2_normalize(vec2(r1.y - r2.y, r2.x - r1.x));
+    if (vec2_dot(face, toward) < 0) face = vec2_mult(face, -1);
+
+    int count = 0;
+    for (int i=0; i<2; i++) {
+        p2_real sep = vec2_dot(face, vec2_sub(clip2[i].p, r1));
+        if (sep > 0) continue;
+        m->points[count] = vec2_sub(clip2[i].p, vec2_mult(face, sep / 2));
+        m->ids[count] = flip
+            ? CONTACT_ID(clip2[i].ref, clip2[i].inc)
+            : CONTACT_ID(clip2[i].inc, clip2[i].ref);
+        count++;
+    }
+    if (count > 0) m->count = count;
+}
+
+#undef CONTACT_FEATURE
+
+typedef struct SatState {
+    const Shape *s1, *s2;
+    const Vec2 *v1, *v2;
+    int n1, n2;
+    p2_real depth;
+    Vec2 axis;
+} SatState;
+
+// Tests one axis, false when it separates the shapes.
+static bool sat_axis(SatState *sat, Vec2 axis)
+{
+    if (vec2_equal(axis, vec2zero)) return true;
+
+    p2_real lo1, hi1, lo2, hi2;
+    shape_project(sat->s1, sat->v1, sat->n1, axis, &lo1, &hi1);
+    shape_project(sat->s2, sat->v2, sat->n2, axis, &lo2, &hi2);
+    if (hi1 < lo2 || hi2 < lo1) return false;
+
+    p2_real depth = min(hi1 - lo2, hi2 - lo1);
+    if (depth < sat->depth) {
+        sat->depth = depth;
+        sat->axis = axis;
+    }
+    return true;
+}
+
+// Tests the edge normals of v, false with the axis in *sep when one separates.
+static bool sat_edges(SatState *sat, const Vec2 *v, int n, Vec2 *sep)
+{
+    // A line has one edge, a point none
+    int edges = n == 2 ? 1 : n < 2 ? 0 : n;
+    for (int i=0; i<edges; i++) {
+        Vec2 edge = vec2_sub(v[(i + 1) % n], v[i]);
+        Vec2 axis = vec2_normalize(vec2(-edge.y, edge.x));
+        if (!sat_axis(sat, axis)) {
+            *sep = axis;
+            return false;
+        }
+    }
+    // Collinear lines only separate along the line itself
+    if (n == 2) {
+        Vec2 axis = vec2_normalize(vec2_sub(v[1], v[0]));
+        if (!sat_axis(sat, axis)) {
+            *sep = axis;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Tests the shape's edge normals, polys have them ready.
+static bool sat_shape_edges(SatState *sat, const Shape *s, const Vec2 *v, int n, Vec2 *sep)
+{
+    if (s->type != POLY || n < 3) return sat_edges(sat, v, n, sep);
+
+    const Vec2 *normals = poly_normals(&s->poly);
+    for (int i=0; i<n; i++) {
+        if (!sat_axis(sat, normals[i])) {
+            *sep = normals[i];
+            return false;
+        }
+    }
+    return true;
+}
+
+// sat_collide tests two convex shapes. If they miss and sep is not NULL,
+// the separating axis is stored in it.
+static Manifold sat_collide(const Shape *s1, const Shape *s2, Vec2 *sep)
+{
+    Vec2 buf1[SHAPE_MAX_VERTS], buf2[SHAPE_MAX_VERTS];
+    SatState sat = {
+        .s1 = s1,
+        .s2 = s2,
+        .depth = P2_REAL_MAX,
+    };
+    sat.v1 = shape_verts(s1, buf1, &sat.n1);
+    sat.v2 = shape_verts(s2, buf2, &sat.n2);
+
+    if (sat.n1 == 0 || sat.n2 == 0) return manifold_miss;
+
+    Vec2 axis;
+    bool hit = true;
+    if (s1->type != CIRCLE) hit = sat_shape_edges(&sat, s1, sat.v1, sat.n1, &axis);
+    if (hit && s2->type != CIRCLE) hit = sat_shape_edges(&sat, s2, sat.v2, sat.n2, &axis);
+    if (hit && s1->type == CIRCLE) {
+        axis = verts_closest_axis(sat.v2, sat.n2, s1->circle.center);
+        hit = sat_axis(&sat, axis);
+    }
+    if (hit && s2->type == CIRCLE) {
+        axis = verts_closest_axis(sat.v1, sat.n1, s2->circle.center);
+        hit = sat_axis(&sat, axis);
+    }
+
+    if (!hit) {
+        if (sep) *sep = axis;
+        return manifold_miss;
+    }
+
+    // Point dir from s2 to s1
+    Vec2 d = vec2_sub(shape_middle(s1, sat.v1, sat.n1), shape_middle(s2, sat.v2, sat.n2));
+    if (vec2_dot(d, sat.axis) < 0) sat.axis = vec2_mult(sat.axis, -1);
+
+    Manifold m = {
+        .normal = sat.axis,
+        .depth = sat.depth,
+    };
+    manifold_points(s1, s2, &m);
+    return m;
+}
+
+static Manifold sat_collide_shapes(const Shape *s1, const Shape *s2)
+{
+    return sat_collide(s1, s2, NULL);
+}
+
+Manifold poly_collide(Poly p1, Poly p2)
+{
+    Shape s1 = { .type = POLY, .poly = p1 };
+    Shape s2 = { .type = POLY, .poly = p2 };
+    return sat_collide(&s1, &s2, NULL);
+}
+
+/**
+ * GJK and EPA
+ *
+ * GJK works on the Minkowski difference s1 - s2, the set of all a - b, which
+ * holds the origin exactly when the shapes overlap. Its support point in
+ * dir is support(s1, dir) - support(s2, -dir). GJK walks a simplex of up to
+ * three such points toward the origin. Either the simplex ends up holding
+ * the origin (hit) or it stops getting closer, and the closest simplex
+ * point is the distance vector.
+ *
+ * For a hit EPA grows the simplex into a polygon, always pushing out the
+ * edge closest to the origin, until that edge is on the boundary. Its
+ * normal and distance are the way out and the depth.
+ */
+
+#define GJK_MAX_ITERATIONS 32
+#define EPA_MAX_VERTS 32
+#define GJK_TOLERANCE ((p2_real) 1e-6)
+
+// Shape with its vertices looked up once, for the many support calls
+typedef struct GjkShape {
+    const Shape *shape;
+    const Vec2 *v;
+    int n;
+    Vec2 buf[SHAPE_MAX_VERTS];
+} GjkShape;
+
+static void gjk_shape_init(GjkShape *g, const Shape *s)
+{
+    g->shape = s;
+    g->v = shape_verts(s, g->buf, &g->n);
+}
+
+static Vec2 gjk_support(const GjkShape *g, Vec2 dir)
+{
+    if (g->shape->type == CIRCLE) {
+        Circle c = g->shape->circle;
+        return vec2_add(c.center, vec2_mult(vec2_normalize(dir), c.radius));
+    }
+    if (g->n == 0) return vec2zero;
+
+    const Vec2 *v = g->v;
+    int best = 0;
+    p2_real best_dot = vec2_dot(v[0], dir);
+    for (int i=1; i < g->n; i++) {
+        p2_real d = vec2_dot(v[i], dir);
+        if (d > best_dot) {
+            best = i;
+            best_dot = d;
+        }
+    }
+    return v[best];
+}
+
+static Vec2 gjk_middle(const GjkShape *g)
+{
+    if (g->shape->type == CIRCLE) return g->shape->circle.center;
+    return g->n == 0 ? vec2zero : shape_middle(g->shape, g->v, g->n);
+}
+
+// shape_support is the point of s farthest in dir.
+Vec2 shape_support(const Shape *s, Vec2 dir)
+{
+    if (poly_moved(s)) {
+        Shape local = *s;
+        Vec2 offset = poly_unmove(&local);
+        return vec2_add(shape_support(&local, dir), offset);
+    }
+
+    GjkShape g;
+    gjk_shape_init(&g, s);
+    return gjk_support(&g, dir);
+}
+
+// Point of the Minkowski difference, with the points on each shape
+typedef struct GjkVertex {
+    Vec2 a;
+    Vec2 b;
+    Vec2 w;
+    Vec2 dir;
+} GjkVertex;
+
+static GjkVertex gjk_vertex(const GjkShape *s1, const GjkShape *s2, Vec2 dir)
+{
+    GjkVertex v = {
+        .a = gjk_support(s1, dir),
+        .b = gjk_support(s2, vec2_mult(dir, -1)),
+        .dir = dir,
+    };
+    v.w = vec2_sub(v.a, v.b);
+    return v;
+}
+
+typedef struct GjkSimplex {
+    GjkVertex v[3];
+    // Barycentric weights of the closest point
+    p2_real weight[3];
+    int count;
+} GjkSimplex;
+
+static inline p2_real vec2_cross(Vec2 a, Vec2 b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+// Closest point to the origin on segment v[i]-v[j], as weight of v[j]
+static p2_real gjk_segment(const GjkSimplex *simplex, int i, int j)
+{
+    Vec2 w0 = simplex->v[i].w;
+    Vec2 e = vec2_sub(simplex->v[j].w, w0);
+    p2_real len_sq = vec2_mag_sq(e);
+    if (len_sq == 0) return 0;
+    return max(0, min(1, -vec2_dot(w0, e) / len_sq));
+}
+
+// gjk_solve reduces the simplex to the smallest part holding the point
+// closest to the origin, and returns that point. Returns true if the
+// simplex holds the origin.
+static bool gjk_solve(GjkSimplex *simplex, Vec2 *closest)
+{
+    if (simplex->count == 1) {
+        simplex->weight[0] = 1;
+        *closest = simplex->v[0].w;
+        return false;
+    }
+
+    if (simplex->count == 2) {
+        p2_real t = gjk_segment(simplex, 0, 1);
+        if (t == 0) {
+            simplex->count = 1;
+        } else if (t == 1) {
+            simplex->v[0] = simplex->v[1];
+            simplex->count = 1;
+        } else {
+            simplex->weight[0] = 1 - t;
+            simplex->weight[1] = t;
+        }
+        if (simplex->count == 1) simplex->weight[0] = 1;
+        *closest = vec2_add(vec2_mult(simplex->v[0].w, simplex->weight[0]),
+                simplex->count == 2 ? vec2_mult(simplex->v[1].w, simplex->weight[1]) : vec2zero);
+        return false;
+    }
+
+    // Triangle, inside when the origin is on the same side of every edge
+    Vec2 a = simplex->v[0].w, b = simplex->v[1].w, c = simplex->v[2].w;
+    p2_real area = vec2_cross(vec2_sub(b, a), vec2_sub(c, a));
+    if (area != 0) {
+        p2_real u = vec2_cross(b, c) / area;
+        p2_real v = vec2_cross(c, a) / area;
+        p2_real w = 1 - u - v;
+        if (u >= 0 && v >= 0 && w >= 0) {
+            simplex->weight[0] = u;
+            simplex->weight[1] = v;
+            simplex->weight[2] = w;
+            *closest = vec2zero;
+            return true;
+        }
+    }
+
+    // Outside, keep the closest edge
+    int edges[3][2] = {{0, 1}, {1, 2}, {2, 0}};
+    int best = 0;
+    p2_real best_dist = P2_REAL_MAX;
+    for (int e=0; e<3; e++) {
+        p2_real t = gjk_segment(simplex, edges[e][0], edges[e][1]);
+        Vec2 p = vec2_lerp(simplex->v[edges[e][0]].w, simplex->v[edges[e][1]].w, t);
+        p2_real dist = vec2_mag_sq(p);
+        if (dist < best_dist) {
+            best = e;
+            best_dist = dist;
+        }
+    }
+    GjkVertex v0 = simplex->v[edges[best][0]];
+    GjkVertex v1 = simplex->v[edges[best][1]];
+    simplex->v[0] = v0;
+    simplex->v[1] = v1;
+    simplex->count = 2;
+    return gjk_solve(simplex, closest);
+}
+
+// Adds the vertex in dir if it is not already in the simplex
+static bool gjk_try_add(const GjkShape *s1, const GjkShape *s2, GjkSimplex *simplex, Vec2 dir)
+{
+    GjkVertex v = gjk_vertex(s1, s2, dir);
+    for (int i=0; i < simplex->count; i++) {
+        if (vec2_mag_sq(vec2_sub(v.w, simplex->v[i].w)) < GJK_TOLERANCE * GJK_TOLERANCE) return false;
+    }
+    simplex->v[simplex->count++] = v;
+    return true;
+}
+
+// gjk_grow makes a simplex that ended on the origin with one or two
+// vertices into a triangle for EPA.
+static bool gjk_grow(const GjkShape *s1, const GjkShape *s2, GjkSimplex *simplex)
+{
+    Vec2 axes[] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+    for (int i=0; i<4 && simplex->count == 1; i++) {
+        gjk_try_add(s1, s2, simplex, axes[i]);
+    }
+    if (simplex->count == 2) {
+        Vec2 e = vec2_sub(simplex->v[1].w, simplex->v[0].w);
+        Vec2 perp = vec2(-e.y, e.x);
+        if (!gjk_try_add(s1, s2, simplex, perp)) gjk_try_add(s1, s2, simplex, vec2_mult(perp, -1));
+    }
+    if (simplex->count < 3) return false;
+
+    Vec2 a = simplex->v[0].w, b = simplex->v[1].w, c = simplex->v[2].w;
+    return vec2_cross(vec2_sub(b, a), vec2_sub(c, a)) != 0;
+}
+
+// epa grows the triangle simplex, which holds the origin, to find the depth.
+static void epa(const GjkShape *s1, const GjkShape *s2, const GjkSimplex *simplex, GjkResult *result)
+{
+    Vec2 poly[EPA_MAX_VERTS];
+    int n = 3;
+    for (int i=0; i<3; i++) poly[i] = simplex->v[i].w;
+
+    // Counter clockwise, so (e.y, -e.x) is the outward normal
+    if (vec2_cross(vec2_sub(poly[1], poly[0]), vec2_sub(poly[2], poly[0])) < 0) {
+        Vec2 t = poly[1];
+        poly[1] = poly[2];
+        poly[2] = t;
+    }
+
+    Vec2 normal = vec2zero;
+    p2_real depth = 0;
+    for (int iter=0; iter < GJK_MAX_ITERATIONS; iter++) {
+        int best = 0;
+        p2_real best_dist = P2_REAL_MAX;
+        for (int i=0; i<n; i++) {
+            Vec2 e = vec2_sub(poly[(i + 1) % n], poly[i]);
+            Vec2 nrm = vec2_normalize(vec2(e.y, -e.x));
+            p2_real dist = vec2_dot(nrm, poly[i]);
+            if (dist < best_dist) {
+                best = i;
+                best_dist = dist;
+                normal = nrm;
+            }
+        }
+        depth = best_dist;
+
+        Vec2 w = gjk_vertex(s1, s2, normal).w;
+        if (vec2_dot(w, normal) - best_dist < GJK_TOLERANCE || n == EPA_MAX_VERTS) break;
+
+        // Insert w after poly[best]
+        for (int i=n; i > best + 1; i--) poly[i] = poly[i - 1];
+        poly[best + 1] = w;
+        n++;
+    }
+
+    result->dir = vec2_mult(normal, -1);
+    result->depth = depth;
+}
+
+// gjk runs GJK, and EPA when the shapes overlap. cache may be NULL.
+static P2_NOINLINE GjkResult gjk_flat(const Shape *s1, const Shape *s2, GjkCache *cache)
+{
+    PolyFlat f1, f2;
+    return gjk(poly_flatten(s1, &f1), poly_flatten(s2, &f2), cache);
+}
+
+GjkResult gjk(const Shape *s1, const Shape *s2, GjkCache *cache)
+{
+    if (poly_moved(s1) || poly_moved(s2)) return gjk_flat(s1, s2, cache);
+
+    GjkResult result = {0};
+    GjkSimplex simplex = {0};
+    GjkShape g1, g2;
+    gjk_shape_init(&g1, s1);
+    gjk_shape_init(&g2, s2);
+
+    if (cache != NULL && cache->count > 0) {
+        for (int i=0; i < cache->count; i++) {
+            simplex.v[i] = gjk_vertex(&g1, &g2, cache->dir[i]);
+        }
+        simplex.count = cache->count;
+    } else {
+        Vec2 dir = vec2_sub(gjk_middle(&g2), gjk_middle(&g1));
+        if (vec2_equal(dir, vec2zero)) dir = vec2(1, 0);
+        simplex.v[0] = gjk_vertex(&g1, &g2, dir);
+        simplex.count = 1;
+    }
+
+    Vec2 closest = vec2zero;
+    bool hit = false;
+    for (int iter=0; iter < GJK_MAX_ITERATIONS; iter++) {
+        result.iterations = iter + 1;
+
+        hit = gjk_solve(&simplex, &closest);
+        p2_real dist_sq = vec2_mag_sq(closest);
+        if (hit || dist_sq < GJK_TOLERANCE * GJK_TOLERANCE) {
+            hit = true;
+            break;
+        }
+
+        // Search toward the origin, stop when that gets no closer
+        Vec2 dir = vec2_mult(closest, -1);
+        GjkVertex v = gjk_vertex(&g1, &g2, dir);
+        if (dist_sq - vec2_dot(v.w, closest) <= GJK_TOLERANCE * dist_sq) break;
+
+        simplex.v[simplex.count++] = v;
+    }
+
+    if (cache != NULL) {
+        cache->count = simplex.count;
+        for (int i=0; i < simplex.count; i++) cache->dir[i] = simplex.v[i].dir;
+    }
+
+    result.hit = hit;
+    if (!hit) {
+        result.point1 = result.point2 = vec2zero;
+        for (int i=0; i < simplex.count; i++) {
+            result.point1 = vec2_add(result.point1, vec2_mult(simplex.v[i].a, simplex.weight[i]));
+            result.point2 = vec2_add(result.point2, vec2_mult(simplex.v[i].b, simplex.weight[i]));
+        }
+        result.distance = vec2_mag(closest);
+        return result;
+    }
+
+    // The origin is on a vertex or an edge, grow a triangle around it.
+    // Fails only for shapes with no area, which have no depth.
+    if (!gjk_grow(&g1, &g2, &simplex)) {
+        result.dir = vec2_normalize(vec2_sub(gjk_middle(&g1), gjk_middle(&g2)));
+        return result;
+    }
+
+    epa(&g1, &g2, &simplex, &result);
+    return result;
+}
+
+// shape_collide_gjk tests any two convex shapes with GJK and EPA. cache
+// may be NULL.
+static P2_NOINLINE Manifold shape_collide_gjk_flat(const Shape *s1, const Shape *s2, GjkCache *cache)
+{
+    PolyFlat f1, f2;
+    return shape_collide_gjk(*poly_flatten(s1, &f1), *poly_flatten(s2, &f2), cache);
+}
+
+Manifold shape_collide_gjk(Shape s1, Shape s2, GjkCache *cache)
+{
+    if (poly_moved(&s1) || poly_moved(&s2)) return shape_collide_gjk_flat(&s1, &s2, cache);
+
+    GjkResult result = gjk(&s1, &s2, cache);
+    if (!result.hit) return manifold_miss;
+
+    Manifold m = {
+        .normal = result.dir,
+        .depth = result.depth,
+    };
+    manifold_points(&s1, &s2, &m);
+    return m;
+}
+
+static Manifold gjk_collide_shapes(const Shape *s1, const Shape *s2)
+{
+    return shape_collide_gjk(*s1, *s2, NULL);
+}
+
+// shape_distance returns the distance between two shapes, 0 when they
+// overlap, and the closest points on each. point1 and point2 may be NULL.
+p2_real shape_distance(Shape s1, Shape s2, Vec2 *point1, Vec2 *point2)
+{
+    GjkResult result = gjk(&s1, &s2, NULL);
+    if (point1) *point1 = result.point1;
+    if (point2) *point2 = result.point2;
+    return result.distance;
+}
+
+// Adapts a collide function to ShapeCollideFunc
+#define SHAPE_COLLIDE(func, f1, f2) \
+    static Manifold func##_shapes(const Shape *s1, const Shape *s2) \
+    { \
+        return func(s1->f1, s2->f2); \
+    }
+
+SHAPE_COLLIDE(point_collide, point, point)
+SHAPE_COLLIDE(point_collide_circle, point, circle)
+SHAPE_COLLIDE(circle_collide, circle, circle)
+SHAPE_COLLIDE(rect_collide, rect, rect)
+
+#undef SHAPE_COLLIDE
+
+typedef struct ShapeCollideEntry {
+    ShapeCollideFunc func;
+    // Call func with the shapes swapped, then swap the result back
+    bool swap;
+} ShapeCollideEntry;
+
+// Fills [t1][t2] and the mirrored [t2][t1]
+#define SHAPE_PAIR(t1, t2, func) \
+    [t1][t2] = {func##_shapes, false}, \
+    [t2][t1] = {func##_shapes, true}
+
+#define SHAPE_SAME(t, func) \
+    [t][t] = {func##_shapes, false}
+
+static const ShapeCollideEntry shape_collide_table[SHAPE_TYPE_COUNT][SHAPE_TYPE_COUNT] = {
+    SHAPE_SAME(POINT, point_collide),
+    SHAPE_PAIR(POINT, LINE, gjk_collide),
+    SHAPE_PAIR(POINT, CIRCLE, point_collide_circle),
+    SHAPE_PAIR(POINT, RECT, sat_collide),
+    SHAPE_PAIR(POINT, TRIANGLE, sat_collide),
+    SHAPE_PAIR(POINT, QUAD, sat_collide),
+    SHAPE_PAIR(POINT, POLY, sat_collide),
+
+    SHAPE_SAME(LINE, sat_collide),
+    SHAPE_PAIR(LINE, CIRCLE, sat_collide),
+    SHAPE_PAIR(LINE, RECT, sat_collide),
+    SHAPE_PAIR(LINE, TRIANGLE, sat_collide),
+    SHAPE_PAIR(LINE, QUAD, sat_collide),
+    SHAPE_PAIR(LINE, POLY, sat_collide),
+
+    SHAPE_SAME(CIRCLE, circle_collide),
+    SHAPE_PAIR(CIRCLE, RECT, sat_collide),
+    SHAPE_PAIR(CIRCLE, TRIANGLE, sat_collide),
+    SHAPE_PAIR(CIRCLE, QUAD, sat_collide),
+    SHAPE_PAIR(CIRCLE, POLY, sat_collide),
+
+    SHAPE_SAME(RECT, rect_collide),
+    SHAPE_PAIR(RECT, TRIANGLE, sat_collide),
+    SHAPE_PAIR(RECT, QUAD, sat_collide),
+    SHAPE_PAIR(RECT, POLY, sat_collide),
+
+    SHAPE_SAME(TRIANGLE, sat_collide),
+    SHAPE_PAIR(TRIANGLE, QUAD, sat_collide),
+    SHAPE_PAIR(TRIANGLE, POLY, sat_collide),
+
+    SHAPE_SAME(QUAD, sat_collide),
+    SHAPE_PAIR(QUAD, POLY, sat_collide),
+
+    SHAPE_SAME(POLY, sat_collide),
+};
+
+#undef SHAPE_PAIR
+#undef SHAPE_SAME
+
+// shape_collide looks up the collide function for the two shape types. The
+// mirrored pair (CIRCLE, POINT) uses the (POINT, CIRCLE) function with the
+// shapes swapped, then flips the normal and swaps the features in the ids.
+// The points sit midway between the shapes, so they stay.
+//
+// shape_collide_ptr does it without copying the shapes, for the loops over
+// placed shapes.
+static Manifold shape_collide_ptr(const Shape *s1, const Shape *s2);
+
+static P2_NOINLINE Manifold shape_collide_flat(const Shape *s1, const Shape *s2)
+{
+    PolyFlat f1, f2;
+    return shape_collide_ptr(poly_flatten(s1, &f1), poly_flatten(s2, &f2));
+}
+
+static Manifold shape_collide_ptr(const Shape *s1, const Shape *s2)
+{
+    if (poly_moved(s1) || poly_moved(s2)) return shape_collide_flat(s1, s2);
+
+    ShapeCollideEntry entry = shape_collide_table[s1->type][s2->type];
+    if (!entry.swap) return entry.func(s1, s2);
+
+    Manifold m = entry.func(s2, s1);
+    m.normal = vec2_mult(m.normal, -1);
+    for (int i=0; i < m.count; i++) {
+        m.ids[i] = CONTACT_ID(m.ids[i] & 0xff, m.ids[i] >> 8);
+    }
+    return m;
+}
+
+Manifold shape_collide(Shape s1, Shape s2)
+{
+    return shape_collide_ptr(&s1, &s2);
+}
+
+// shape_collide_cached is shape_collide for a pair tested every frame. If
+// the cached axis still separates the shapes that is the only test, else
+// the full test runs and remembers the new separating axis, if any.
+//
+// Shapes don't rotate, so the axis stays good while they move.
+static P2_NOINLINE Manifold shape_collide_cached_flat(const Shape *s1, const Shape *s2, SatCache *cache)
+{
+    PolyFlat f1, f2;
+    return shape_collide_cached(*poly_flatten(s1, &f1), *poly_flatten(s2, &f2), cache);
+}
+
+Manifold shape_collide_cached(Shape s1, Shape s2, SatCache *cache)
+{
+    if (poly_moved(&s1) || poly_moved(&s2)) return shape_collide_cached_flat(&s1, &s2, cache);
+    if (shape_collide_table[s1.type][s2.type].func != sat_collide_shapes) {
+        return shape_collide(s1, s2);
+    }
+
+    Vec2 buf1[SHAPE_MAX_VERTS], buf2[SHAPE_MAX_VERTS];
+    int n1, n2;
+    const Vec2 *v1 = shape_verts(&s1, buf1, &n1);
+    const Vec2 *v2 = shape_verts(&s2, buf2, &n2);
+
+    if (cache->valid && n1 > 0 && n2 > 0) {
+        p2_real lo1, hi1, lo2, hi2;
+        shape_project(&s1, v1, n1, cache->axis, &lo1, &hi1);
+        shape_project(&s2, v2, n2, cache->axis, &lo2, &hi2);
+        if (hi1 < lo2 || hi2 < lo1) return manifold_miss;
+    }
+
+    Manifold m = sat_collide(&s1, &s2, &cache->axis);
+    cache->valid = m.count == 0;
+    return m;
+}
+
+/**********************************************
+ *
+ * Contact Cache
+ *
+ **********************************************/
+
+ContactCache contact_cache_new()
+{
+    return (ContactCache){0};
+}
+
+void contact_cache_free(ContactCache *cache)
+{
+    if (cache==NULL) return;
+
+    hmfree(cache->map);
+}
+
+int contact_cache_count(const ContactCache *cache)
+{
+    return hmlen(cache->map);
+}
+
+void contact_cache_begin(ContactCache *cache)
+{
+    cache->frame++;
+}
+
+// contact_cache_update stores the manifold of the pair, with the impulses
+// of the old points that have the same feature ids. New points start at
+// zero. A miss removes the pair and returns NULL. The pointer is good until
+// the next update or end.
+CachedContact *contact_cache_update(ContactCache *cache, ContactKey key, Manifold m)
+{
+    ContactCacheEntry *entry = hmgetp_null(cache->map, key);
+    if (m.count == 0) {
+        if (entry != NULL) (void)hmdel(cache->map, key);
+        return NULL;
+    }
+
+    CachedContact contact = {
+        .manifold = m,
+        .frame = cache->frame,
+    };
+    if (entry == NULL) {
+        hmput(cache->map, key, contact);
+        return &hmgetp(cache->map, key)->value;
+    }
+
+    const CachedContact *old = &entry->value;
+    for (int i=0; i < m.count; i++) {
+        for (int j=0; j < old->manifold.count; j++) {
+            if (m.ids[i] != old->manifold.ids[j]) continue;
+            contact.normal_impulse[i] = old->normal_impulse[j];
+            contact.tangent_impulse[i] = old->tangent_impulse[j];
+            break;
+        }
+    }
+    entry->value = contact;
+    return &entry->value;
+}
+
+// contact_cache_get returns the cached contact of the pair, or NULL.
+CachedContact *contact_cache_get(ContactCache *cache, ContactKey key)
+{
+    ContactCacheEntry *entry = hmgetp_null(cache->map, key);
+    return entry == NULL ? NULL : &entry->value;
+}
+
+// contact_cache_end drops the pairs not updated since contact_cache_begin,
+// and returns how many.
+int contact_cache_end(ContactCache *cache)
+{
+    int removed = 0;
+    // hmdel moves the last entry into the hole, go from the back
+    for (int i = hmlen(cache->map) - 1; i >= 0; i--) {
+        if (cache->map[i].value.frame == cache->frame) continue;
+        ContactKey key = cache->map[i].key;
+        (void)hmdel(cache->map, key);
+        removed++;
+    }
+    return removed;
+}
+
+Shape shape_offset(Vec2 start, Shape shape)
+{
+    Vec2 v1, v2, v3;
+    switch (shape.type) {
+        case POINT:
+            shape.point = vec2_add(start, shape.point);
+            break;
+        case LINE:
+            shape.line.v1 = vec2_add(start, shape.line.v1);
+            shape.line.v2 = vec2_add(start, shape.line.v2);
+            break;
+        case CIRCLE:
+            shape.circle.center = vec2_add(start, shape.circle.center);
+            break;
+        case RECT:
+            shape.rect.pos = vec2_add(start, shape.rect.pos);
+            break;
+        case TRIANGLE:
+            shape.triangle.v1 = vec2_add(start, shape.triangle.v1);
+            shape.triangle.v2 = vec2_add(start, shape.triangle.v2);
+            shape.triangle.v3 = vec2_add(start, shape.triangle.v3);
+            break;
+        case QUAD:
+            shape.quad.v1 = vec2_add(start, shape.quad.v1);
+            shape.quad.v2 = vec2_add(start, shape.quad.v2);
+            shape.quad.v3 = vec2_add(start, shape.quad.v3);
+            shape.quad.v4 = vec2_add(start, shape.quad.v4);
+            break;
+        case POLY:
+            // Arena vertices are shared with the unmoved poly
+            if (shape.poly.ext) {
+                shape.poly.offset = vec2_add(start, shape.poly.offset);
+            } else {
+                for (int i=0; i < shape.poly.n; i++) {
+                    shape.poly.v[i] = vec2_add(start, shape.poly.v[i]);
+                }
+            }
+            shape.poly.centroid = vec2_add(start, shape.poly.centroid);
+            break;
+    }
+    return shape;
+}
+
+AABB shape_aabb(Shape s)
+{
+    if (poly_moved(&s)) {
+        Vec2 offset = poly_unmove(&s);
+        return aabb_offset(shape_aabb(s), offset);
+    }
+    if (s.type == CIRCLE) {
+        Vec2 r = vec2(s.circle.radius, s.circle.radius);
+        return (AABB) {
+            .min = vec2_sub(s.circle.center, r),
+            .max = vec2_add(s.circle.center, r),
+        };
+    }
+
+    Vec2 buf[SHAPE_MAX_VERTS];
+    int n;
+    const Vec2 *v = shape_verts(&s, buf, &n);
+    AABB box = {
+        .min = vec2(P2_REAL_MAX, P2_REAL_MAX),
+        .max = vec2(-P2_REAL_MAX, -P2_REAL_MAX),
+    };
+    for (int i=0; i<n; i++) {
+        box.min = vec2(min(box.min.x, v[i].x), min(box.min.y, v[i].y));
+        box.max = vec2(max(box.max.x, v[i].x), max(box.max.y, v[i].y));
+    }
+    return box;
+}
+
+Circle shape_bounding_circle(Shape s)
+{
+    if (poly_moved(&s)) {
+        Vec2 offset = poly_unmove(&s);
+        Circle c = shape_bounding_circle(s);
+        c.center = vec2_add(c.center, offset);
+        return c;
+    }
+    if (s.type == CIRCLE) return s.circle;
+
+    Vec2 buf[SHAPE_MAX_VERTS];
+    int n;
+    const Vec2 *v = shape_verts(&s, buf, &n);
+    if (n == 0) return (Circle){0};
+
+    AABB box = shape_aabb(s);
+    Circle c = {vec2_mult(vec2_add(box.min, box.max), 0.5), 0};
+    for (int i=0; i<n; i++) {
+        c.radius = max(c.radius, vec2_mag(vec2_sub(v[i], c.center)));
+    }
+    return c;
+}
+
+Vec2 shape_center(Shape s1, Shape s2);
+
+// TODO: delete me, just for testing purposes
+static inline p2_real kinamatic(p2_real acc, p2_real vel, p2_real pos, p2_real t)
+{
+    return 0.5f * acc * t * t * vel * t + pos;
+}
+
+/**********************************************
+ *
+ * Collider
+ *
+ **********************************************/
+
+// collider_push adds a shape and its bounds, and grows the bounds of the
+// collider to hold it.
+void collider_push(Collider *c, Shape shape)
+{
+    AABB box = shape_aabb(shape);
+    arrput(c->shapes, shape);
+    arrput(c->bounds, box);
+    arrput(c->circles, shape_bounding_circle(shape));
+
+    int n = arrlen(c->shapes);
+    c->bound = n == 1 ? box : aabb_union(c->bound, box);
+
+    // Around the middle of the bounds, far enough for every shape
+    c->circle.center = vec2_mult(vec2_add(c->bound.min, c->bound.max), 0.5);
+    c->circle.radius = 0;
+    for (int i=0; i<n; i++) {
+        p2_real r = vec2_mag(vec2_sub(c->circles[i].center, c->circle.center)) + c->circles[i].radius;
+        c->circle.radius = max(c->circle.radius, r);
+    }
+}
+
+void collider_destroy(Collider *c)
+{
+    arrfree(c->shapes);
+    arrfree(c->bounds);
+    arrfree(c->circles);
+    *c = (Collider){0};
+}
+
+int collider_count(const Collider *c)
+{
+    return arrlen(c->shapes);
+}
+
+Collider collider(Shape shapes[], int num_shapes)
+{
+    Collider collider = {0};
+    for (int i = 0; i < num_shapes; i++) {
+        collider_push(&collider, shapes[i]);
+    }
+    return collider;
+}
+
+// Shapes of a collider moved to its position, with their bounds and index.
+// Only the shapes inside the other collider's bounds are kept. Small
+// colliders fit in the stack buffer. A Shape is about 300 bytes since polys
+// keep their vertices inline, so collider_collide's two buffers take about
+// 5 KB of stack. Bigger colliders are malloced.
+#define COLLIDER_STACK_SHAPES 8
+
+typedef struct PlacedShapes {
+    Shape *shapes;
+    AABB *bounds;
+    uint16_t *index;
+    int n;
+    Shape shapes_buf[COLLIDER_STACK_SHAPES];
+    AABB bounds_buf[COLLIDER_STACK_SHAPES];
+    uint16_t index_buf[COLLIDER_STACK_SHAPES];
+} PlacedShapes;
+
+static void placed_shapes_init(PlacedShapes *placed, Vec2 pos, const Collider *c, AABB other)
+{
+    int n = collider_count(c);
+    placed->shapes = placed->shapes_buf;
+    placed->bounds = placed->bounds_buf;
+    placed->index = placed->index_buf;
+    if (n > COLLIDER_STACK_SHAPES) {
+        placed->shapes = malloc(n * sizeof(Shape));
+        placed->bounds = malloc(n * sizeof(AABB));
+        placed->index = malloc(n * sizeof(uint16_t));
+    }
+
+    placed->n = 0;
+    for (int i=0; i<n; i++) {
+        AABB box = aabb_offset(c->bounds[i], pos);
+        if (!aabb_overlap(box, other)) continue;
+
+        placed->shapes[placed->n] = shape_offset(pos, c->shapes[i]);
+        placed->bounds[placed->n] = box;
+        placed->index[placed->n] = i;
+        placed->n++;
+    }
+}
+
+static void placed_shapes_free(PlacedShapes *placed)
+{
+    if (placed->shapes != placed->shapes_buf) free(placed->shapes);
+    if (placed->bounds != placed->bounds_buf) free(placed->bounds);
+    if (placed->index != placed->index_buf) free(placed->index);
+}
+
+// Placed shapes of one collider. index may be NULL when they are all of
+// the collider, in order.
+typedef struct ShapeSpan {
+    const Shape *shapes;
+    const AABB *bounds;
+    const uint16_t *index;
+    int n;
+} ShapeSpan;
+
+// Tests every pair of placed shapes whose bounds overlap.
+static int placed_collide(const ShapeSpan *p1, Vec2 pos1, const ShapeSpan *p2, Vec2 pos2,
+        ColliderContact *contacts, int max_contacts)
+{
+    int count = 0;
+    for (int i=0; i < p1->n && count < max_contacts; i++) {
+        for (int j=0; j < p2->n; j++) {
+            if (!aabb_overlap(p1->bounds[i], p2->bounds[j])) continue;
+
+            Manifold m = shape_collide_ptr(&p1->shapes[i], &p2->shapes[j]);
+            if (m.count == 0) continue;
+
+            // Shapes that don't give a direction, push apart the bodies
+            if (vec2_equal(m.normal, vec2zero)) {
+                m.normal = vec2_normalize(vec2_sub(pos1, pos2));
+            }
+            contacts[count++] = (ColliderContact) {
+                .manifold = m,
+                .shape1 = p1->index ? p1->index[i] : i,
+                .shape2 = p2->index ? p2->index[j] : j,
+            };
+            if (count == max_contacts) break;
+        }
+    }
+    return count;
+}
+
+// collider_collide finds the contacts between every pair of shapes of the
+// two colliders, and writes up to max_contacts of them. Returns how many
+// were written, when that is max_contacts there may be more.
+//
+// The cached bounds cull first, the colliders against each other, then
+// each shape against the other collider and last shape against shape. Each
+// shape left is moved to its collider's position once.
+int collider_collide(Vec2 pos1, const Collider *c1, Vec2 pos2, const Collider *c2,
+        ColliderContact *contacts, int max_contacts)
+{
+    if (collider_count(c1) == 0 || collider_count(c2) == 0 || max_contacts <= 0) return 0;
+
+    AABB box1 = collider_aabb(c1, pos1);
+    AABB box2 = collider_aabb(c2, pos2);
+    if (!aabb_overlap(box1, box2)) return 0;
+
+    PlacedShapes p1, p2;
+    placed_shapes_init(&p1, pos1, c1, box2);
+    placed_shapes_init(&p2, pos2, c2, box1);
+
+    ShapeSpan span1 = {p1.shapes, p1.bounds, p1.index, p1.n};
+    ShapeSpan span2 = {p2.shapes, p2.bounds, p2.index, p2.n};
+    int count = placed_collide(&span1, pos1, &span2, pos2, contacts, max_contacts);
+
+    placed_shapes_free(&p1);
+    placed_shapes_free(&p2);
+    return count;
+}
+
+/**********************************************
+ *
+ * Shape Cache
+ *
+ **********************************************/
+
+void shape_cache_free(ShapeCache *cache)
+{
+    if (cache==NULL) return;
+
+    arrfree(cache->shapes);
+    arrfree(cache->bounds);
+    arrfree(cache->first);
+    arrfree(cache->pos);
+    arrfree(cache->box);
+}
+
+void shape_cache_reset(ShapeCache *cache)
+{
+    arrsetlen(cache->first, 0);
+    arrsetlen(cache->pos, 0);
+}
+
+int shape_cache_count(const ShapeCache *cache)
+{
+    return arrlen(cache->pos);
+}
+
+static void shape_cache_place(ShapeCache *cache, int i, const Collider *c, Vec2 pos)
+{
+    int first = cache->first[i];
+    for (int j=0; j < collider_count(c); j++) {
+        cache->shapes[first + j] = shape_offset(pos, c->shapes[j]);
+        cache->bounds[first + j] = aabb_offset(c->bounds[j], pos);
+    }
+    cache->pos[i] = pos;
+    cache->box[i] = collider_aabb(c, pos);
+    cache->moved++;
+}
+
+// shape_cache_update places the shapes of the colliders that moved since
+// the last update, and returns how many that were.
+int shape_cache_update(ShapeCache *cache, const Collider *const *colliders, const Vec2 *pos, int n)
+{
+    cache->moved = 0;
+
+    bool layout = arrlen(cache->pos) == n && arrlen(cache->first) == n + 1;
+    for (int i=0; i<n && layout; i++) {
+        layout = cache->first[i + 1] - cache->first[i] == collider_count(colliders[i]);
+    }
+
+    if (!layout) {
+        arrsetlen(cache->first, n + 1);
+        cache->first[0] = 0;
+        for (int i=0; i<n; i++) {
+            cache->first[i + 1] = cache->first[i] + collider_count(colliders[i]);
+        }
+        arrsetlen(cache->shapes, cache->first[n]);
+        arrsetlen(cache->bounds, cache->first[n]);
+        arrsetlen(cache->pos, n);
+        arrsetlen(cache->box, n);
+        for (int i=0; i<n; i++) {
+            shape_cache_place(cache, i, colliders[i], pos[i]);
+        }
+        return cache->moved;
+    }
+
+    for (int i=0; i<n; i++) {
+        if (vec2_equal(cache->pos[i], pos[i])) continue;
+        shape_cache_place(cache, i, colliders[i], pos[i]);
+    }
+    return cache->moved;
+}
+
+// shape_cache_shapes returns the placed shapes of collider i, n of them.
+const Shape *shape_cache_shapes(const ShapeCache *cache, int i, int *n)
+{
+    *n = cache->first[i + 1] - cache->first[i];
+    return cache->shapes + cache->first[i];
+}
+
+// shape_cache_collide is collider_collide on the placed shapes of
+// colliders a and b.
+int shape_cache_collide(const ShapeCache *cache, int a, int b,
+        ColliderContact *contacts, int max_contacts)
+{
+    return shape_caches_collide(cache, a, cache, b, contacts, max_contacts);
+}
+
+// shape_caches_collide is shape_cache_collide for collider a of one cache
+// and collider b of another, like moving bodies and static ones.
+int shape_caches_collide(const ShapeCache *cache1, int a, const ShapeCache *cache2, int b,
+        ColliderContact *contacts, int max_contacts)
+{
+    if (max_contacts <= 0 || !aabb_overlap(cache1->box[a], cache2->box[b])) return 0;
+
+    ShapeSpan p1 = {
+        .shapes = cache1->shapes + cache1->first[a],
+        .bounds = cache1->bounds + cache1->first[a],
+        .n = cache1->first[a + 1] - cache1->first[a],
+    };
+    ShapeSpan p2 = {
+        .shapes = cache2->shapes + cache2->first[b],
+        .bounds = cache2->bounds + cache2->first[b],
+        .n = cache2->first[b + 1] - cache2->first[b],
+    };
+    return placed_collide(&p1, cache1->pos[a], &p2, cache2->pos[b], contacts, max_contacts);
+}
+
+// collider_detect_collisions returns the first contact between the two
+// colliders, see collider_collide for all of them.
+Manifold collider_detect_collisions(Vec2 pos1, const Collider *c1, Vec2 pos2, const Collider *c2)
+{
+    ColliderContact contact;
+    if (collider_collide(pos1, c1, pos2, c2, &contact, 1) == 0) return manifold_miss;
+    return contact.manifold;
+}
+
+/**********************************************
+ *
+ * Grid
+ *
+ **********************************************/
+
+void grid_free(Grid *grid)
+{
+    arrfree(grid->pairs);
+    arrfree(grid->entries);
+    arrfree(grid->sorted);
+    arrfree(grid->start);
+    arrfree(grid->big);
+    arrfree(grid->big_rank);
+    arrfree(grid->sides);
+}
+
+static bool aabb_empty(AABB box)
+{
+    return !(box.min.x <= box.max.x && box.min.y <= box.max.y);
+}
+
+// Median of v, which gets reordered
+static p2_real grid_median(p2_real *v, int n)
+{
+    int lo = 0, hi = n - 1, k = n / 2;
+    while (lo < hi) {
+        p2_real pivot = v[(lo + hi) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i <= j) {
+                p2_real t = v[i];
+                v[i++] = v[j];
+                v[j--] = t;
+            }
+        }
+        if (k <= j) hi = j;
+        else if (k >= i) lo = i;
+        else break;
+    }
+    return v[k];
+}
+
+static p2_real grid_cell_size(Grid *grid, const AABB *boxes, int n)
+{
+    if (grid->cell_size > 0) return grid->cell_size;
+
+    arrsetlen(grid->sides, 0);
+    for (int i=0; i<n; i++) {
+        if (aabb_empty(boxes[i])) continue;
+        Vec2 size = vec2_sub(boxes[i].max, boxes[i].min);
+        arrput(grid->sides, max(size.x, size.y));
+    }
+    p2_real cell = arrlen(grid->sides) > 0 ? grid_median(grid->sides, arrlen(grid->sides)) : 1;
+    return cell > 0 ? cell : 1;
+}
+
+static inline int grid_coord(p2_real v, p2_real cell)
+{
+    p2_real c = p2_floor(v / cell);
+    // Far away boxes share the edge cells instead of overflowing
+    if (c < -(1 << 30)) return -(1 << 30);
+    if (c > (1 << 30)) return 1 << 30;
+    return (int) c;
+}
+
+static inline uint32_t grid_hash(int x, int y)
+{
+    return ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u);
+}
+
+static inline void grid_pair(Grid *grid, int a, int b)
+{
+    if (a > b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    arrput(grid->pairs, ((BodyPair){a, b}));
+}
+
+// grid_update finds the overlapping pairs of the n boxes, by index, in
+// grid->pairs. Empty boxes overlap nothing. Returns the number of pairs.
+int grid_update(Grid *grid, const AABB *boxes, int n)
+{
+    p2_real cell = grid->cell = grid_cell_size(grid, boxes, n);
+
+    arrsetlen(grid->pairs, 0);
+    arrsetlen(grid->entries, 0);
+    arrsetlen(grid->big, 0);
+    for (int i=0; i<n; i++) {
+        AABB box = boxes[i];
+        if (aabb_empty(box)) continue;
+
+        int x0 = grid_coord(box.min.x, cell), x1 = grid_coord(box.max.x, cell);
+        int y0 = grid_coord(box.min.y, cell), y1 = grid_coord(box.max.y, cell);
+        if (((int64_t) x1 - x0 + 1) * ((int64_t) y1 - y0 + 1) > GRID_MAX_CELLS) {
+            arrput(grid->big, i);
+            continue;
+        }
+        for (int y=y0; y<=y1; y++) {
+            for (int x=x0; x<=x1; x++) {
+                arrput(grid->entries, ((GridEntry){x, y, x0, y0, i}));
+            }
+        }
+    }
+
+    // Counting sort of the entries by bucket. Twice as many buckets as
+    // entries keeps few cells in each.
+    int entries = arrlen(grid->entries);
+    uint32_t buckets = 1;
+    while (buckets < 2 * (uint32_t) entries) buckets <<= 1;
+    uint32_t mask = buckets - 1;
+
+    arrsetlen(grid->start, buckets + 1);
+    memset(grid->start, 0, sizeof(int) * (buckets + 1));
+    for (int i=0; i<entries; i++) {
+        grid->start[(grid_hash(grid->entries[i].x, grid->entries[i].y) & mask) + 1]++;
+    }
+    for (uint32_t b=0; b<buckets; b++) grid->start[b + 1] += grid->start[b];
+
+    arrsetlen(grid->sorted, entries);
+    for (int i=0; i<entries; i++) {
+        GridEntry e = grid->entries[i];
+        uint32_t b = grid_hash(e.x, e.y) & mask;
+        grid->sorted[grid->start[b]++] = e;
+    }
+    // Filling moved each start to where the next bucket starts
+    for (uint32_t b=buckets; b>0; b--) grid->start[b] = grid->start[b - 1];
+    grid->start[0] = 0;
+
+    for (uint32_t b=0; b<buckets; b++) {
+        int end = grid->start[b + 1];
+        for (int i=grid->start[b]; i<end; i++) {
+            GridEntry e1 = grid->sorted[i];
+            AABB box1 = boxes[e1.index];
+            for (int j=i+1; j<end; j++) {
+                GridEntry e2 = grid->sorted[j];
+                // Other cells can land in the same bucket
+                if (e1.x != e2.x || e1.y != e2.y) continue;
+                // Only the cell with the low corner of the overlap reports
+                if ((e1.x0 > e2.x0 ? e1.x0 : e2.x0) != e1.x) continue;
+                if ((e1.y0 > e2.y0 ? e1.y0 : e2.y0) != e1.y) continue;
+                if (aabb_overlap(box1, boxes[e2.index])) grid_pair(grid, e1.index, e2.index);
+            }
+        }
+    }
+
+    // Big boxes against every box, and against each other once
+    int nbig = arrlen(grid->big);
+    if (nbig == 0) return arrlen(grid->pairs);
+
+    arrsetlen(grid->big_rank, n);
+    for (int i=0; i<n; i++) grid->big_rank[i] = nbig;
+    for (int k=0; k<nbig; k++) grid->big_rank[grid->big[k]] = k;
+    for (int k=0; k<nbig; k++) {
+        int a = grid->big[k];
+        for (int i=0; i<n; i++) {
+            if (grid->big_rank[i] <= k || aabb_empty(boxes[i])) continue;
+            if (aabb_overlap(boxes[a], boxes[i])) grid_pair(grid, a, i);
+        }
+    }
+    return arrlen(grid->pairs);
+}
+
+/**********************************************
+ *
+ * AABB Tree
+ *
+ **********************************************/
+
+// Built on the dynamic tree of Box2D by Erin Catto
+
+void aabb_tree_free(AABBTree *tree)
+{
+    arrfree(tree->nodes);
+    arrfree(tree->leaves);
+    arrfree(tree->moved);
+    arrfree(tree->pairs);
+    arrfree(tree->found);
+}
+
+static void aabb_tree_init(AABBTree *tree)
+{
+    if (tree->nodes != NULL) return;
+    arrsetcap(tree->nodes, 16);
+    tree->root = AABB_TREE_NULL;
+    tree->free_list = AABB_TREE_NULL;
+}
+
+static inline p2_real aabb_perimeter(AABB box)
+{
+    return 2 * ((box.max.x - box.min.x) + (box.max.y - box.min.y));
+}
+
+static inline bool aabb_contains(AABB outer, AABB inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y
+        && inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+}
+
+static int aabb_tree_alloc(AABBTree *tree)
+{
+    int id = tree->free_list;
+    if (id != AABB_TREE_NULL) {
+        tree->free_list = tree->nodes[id].parent;
+    } else {
+        id = arrlen(tree->nodes);
+        arrput(tree->nodes, (AABBTreeNode){0});
+    }
+    tree->nodes[id] = (AABBTreeNode){
+        .parent = AABB_TREE_NULL,
+        .child1 = AABB_TREE_NULL,
+        .child2 = AABB_TREE_NULL,
+        .item = -1,
+    };
+    return id;
+}
+
+static void aabb_tree_release(AABBTree *tree, int id)
+{
+    tree->nodes[id].parent = tree->free_list;
+    tree->nodes[id].height = -1;
+    tree->free_list = id;
+}
+
+static inline bool aabb_tree_leaf(const AABBTreeNode *node)
 {
-    /* return stb_perlin_noise3(x, y, z, 0, 0, 0); */
-    return 0;
+    return node->child1 == AABB_TREE_NULL;
 }
 
-void destroy_noise();
+static void aabb_tree_fix(AABBTree *tree, int id)
+{
+    AABBTreeNode *n = tree->nodes;
+    int c1 = n[id].child1, c2 = n[id].child2;
+    n[id].height = 1 + (n[c1].height > n[c2].height ? n[c1].height : n[c2].height);
+    n[id].box = aabb_union(n[c1].box, n[c2].box);
+}
+
+static void aabb_tree_replace_child(AABBTree *tree, int parent, int old_child, int new_child)
+{
+    if (parent == AABB_TREE_NULL) {
+        tree->root = new_child;
+    } else if (tree->nodes[parent].child1 == old_child) {
+        tree->nodes[parent].child1 = new_child;
+    } else {
+        tree->nodes[parent].child2 = new_child;
+    }
+}
+
+// Rotates a child of a up if one side is two levels taller. Returns the
+// node now where a was.
+static int aabb_tree_balance(AABBTree *tree, int a)
+{
+    AABBTreeNode *n = tree->nodes;
+    if (aabb_tree_leaf(&n[a]) || n[a].height < 2) return a;
+
+    int b = n[a].child1, c = n[a].child2;
+    int balance = n[c].height - n[b].height;
+    if (balance >= -1 && balance <= 1) return a;
+
+    // The taller child goes up, a takes its shorter child
+    int up = balance > 1 ? c : b;
+    int f = n[up].child1, g = n[up].child2;
+
+    n[up].child1 = a;
+    n[up].parent = n[a].parent;
+    n[a].parent = up;
+    aabb_tree_replace_child(tree, n[up].parent, a, up);
+
+    int tall = n[f].height > n[g].height ? f : g;
+    int low = tall == f ? g : f;
+    n[up].child2 = tall;
+    if (balance > 1) n[a].child2 = low;
+    else n[a].child1 = low;
+    n[low].parent = a;
+
+    aabb_tree_fix(tree, a);
+    aabb_tree_fix(tree, up);
+    return up;
+}
+
+// Walks up from id fixing boxes and heights and balancing
+static void aabb_tree_refit(AABBTree *tree, int id)
+{
+    while (id != AABB_TREE_NULL) {
+        id = aabb_tree_balance(tree, id);
+        aabb_tree_fix(tree, id);
+        id = tree->nodes[id].parent;
+    }
+}
+
+static void aabb_tree_insert_leaf(AABBTree *tree, int leaf)
+{
+    if (tree->root == AABB_TREE_NULL) {
+        tree->root = leaf;
+        tree->nodes[leaf].parent = AABB_TREE_NULL;
+        return;
+    }
+
+    // Go down to the sibling that grows the perimeters the least
+    AABBTreeNode *n = tree->nodes;
+    AABB box = n[leaf].box;
+    int id = tree->root;
+    while (!aabb_tree_leaf(&n[id])) {
+        int c1 = n[id].child1, c2 = n[id].child2;
+        p2_real combined = aabb_perimeter(aabb_union(n[id].box, box));
+
+        // Pairing with this node makes a parent of combined, and every
+        // node above grows by as much as this one
+        p2_real cost = 2 * combined;
+        p2_real inherited = 2 * (combined - aabb_perimeter(n[id].box));
+
+        p2_real cost1 = aabb_perimeter(aabb_union(box, n[c1].box)) + inherited;
+        if (!aabb_tree_leaf(&n[c1])) cost1 -= aabb_perimeter(n[c1].box);
+        p2_real cost2 = aabb_perimeter(aabb_union(box, n[c2].box)) + inherited;
+        if (!aabb_tree_leaf(&n[c2])) cost2 -= aabb_perimeter(n[c2].box);
+
+        if (cost < cost1 && cost < cost2) break;
+        id = cost1 < cost2 ? c1 : c2;
+    }
+
+    int sibling = id;
+    int parent = aabb_tree_alloc(tree);
+    n = tree->nodes;
+    int old_parent = n[sibling].parent;
+    n[parent].parent = old_parent;
+    n[parent].child1 = sibling;
+    n[parent].child2 = leaf;
+    n[sibling].parent = parent;
+    n[leaf].parent = parent;
+    aabb_tree_replace_child(tree, old_parent, sibling, parent);
+
+    aabb_tree_refit(tree, parent);
+}
+
+static void aabb_tree_remove_leaf(AABBTree *tree, int leaf)
+{
+    AABBTreeNode *n = tree->nodes;
+    if (leaf == tree->root) {
+        tree->root = AABB_TREE_NULL;
+        return;
+    }
+
+    int parent = n[leaf].parent;
+    int grand = n[parent].parent;
+    int sibling = n[parent].child1 == leaf ? n[parent].child2 : n[parent].child1;
+
+    aabb_tree_replace_child(tree, grand, parent, sibling);
+    n[sibling].parent = grand;
+    aabb_tree_release(tree, parent);
+    aabb_tree_refit(tree, grand);
+}
+
+static AABB aabb_tree_fatten(const AABBTree *tree, AABB box)
+{
+    p2_real m = tree->margin;
+    if (m <= 0) m = AABB_TREE_FAT * max(box.max.x - box.min.x, box.max.y - box.min.y);
+    return (AABB) {
+        .min = vec2(box.min.x - m, box.min.y - m),
+        .max = vec2(box.max.x + m, box.max.y + m),
+    };
+}
+
+// aabb_tree_insert adds an item with its box. An item already in the tree
+// is moved instead.
+void aabb_tree_insert(AABBTree *tree, int item, AABB box)
+{
+    aabb_tree_init(tree);
+    while (arrlen(tree->leaves) <= item) {
+        arrput(tree->leaves, AABB_TREE_NULL);
+        arrput(tree->moved, false);
+    }
+    if (tree->leaves[item] != AABB_TREE_NULL) {
+        aabb_tree_move(tree, item, box);
+        return;
+    }
+
+    int leaf = aabb_tree_alloc(tree);
+    tree->nodes[leaf].box = aabb_tree_fatten(tree, box);
+    tree->nodes[leaf].item = item;
+    aabb_tree_insert_leaf(tree, leaf);
+    tree->leaves[item] = leaf;
+    tree->moved[item] = true;
+}
+
+void aabb_tree_remove(AABBTree *tree, int item)
+{
+    if (item >= arrlen(tree->leaves) || tree->leaves[item] == AABB_TREE_NULL) return;
+
+    int leaf = tree->leaves[item];
+    aabb_tree_remove_leaf(tree, leaf);
+    aabb_tree_release(tree, leaf);
+    tree->leaves[item] = AABB_TREE_NULL;
+    tree->moved[item] = true;
+}
+
+// aabb_tree_move gives the item a new box. Only if it left its fat box the
+// leaf is put in again, and then it returns true.
+bool aabb_tree_move(AABBTree *tree, int item, AABB box)
+{
+    if (item >= arrlen(tree->leaves) || tree->leaves[item] == AABB_TREE_NULL) {
+        aabb_tree_insert(tree, item, box);
+        return true;
+    }
+
+    int leaf = tree->leaves[item];
+    if (aabb_contains(tree->nodes[leaf].box, box)) return false;
+
+    aabb_tree_remove_leaf(tree, leaf);
+    tree->nodes[leaf].box = aabb_tree_fatten(tree, box);
+    aabb_tree_insert_leaf(tree, leaf);
+    tree->moved[item] = true;
+    return true;
+}
+
+int aabb_tree_height(const AABBTree *tree)
+{
+    if (tree->nodes == NULL || tree->root == AABB_TREE_NULL) return 0;
+    return tree->nodes[tree->root].height;
+}
+
+// Deep enough for any balanced tree that fits in memory
+#define AABB_TREE_STACK 256
+
+// Walks the tree down the nodes that test true, putting the items of the
+// leaves in items. test is a macro on the node box b.
+#define AABB_TREE_WALK(tree, items, max_items, test) \
+    do { \
+        if ((tree)->nodes == NULL || (tree)->root == AABB_TREE_NULL) return 0; \
+        int stack[AABB_TREE_STACK]; \
+        int top = 0, count = 0; \
+        stack[top++] = (tree)->root; \
+        while (top > 0) { \
+            const AABBTreeNode *node = &(tree)->nodes[stack[--top]]; \
+            AABB b = node->box; \
+            if (!(test)) continue; \
+            if (aabb_tree_leaf(node)) { \
+                if (count < (max_items)) (items)[count] = node->item; \
+                count++; \
+            } else { \
+                assert(top + 2 <= AABB_TREE_STACK); \
+                stack[top++] = node->child1; \
+                stack[top++] = node->child2; \
+            } \
+        } \
+        return count < (max_items) ? count : (max_items); \
+    } while (0)
+
+// aabb_tree_query finds the items whose fat boxes overlap box, up to
+// max_items of them. Returns how many it found.
+int aabb_tree_query(const AABBTree *tree, AABB box, int *items, int max_items)
+{
+    AABB_TREE_WALK(tree, items, max_items, aabb_overlap(b, box));
+}
+
+// aabb_tree_query_point finds the items whose fat boxes hold the point.
+int aabb_tree_query_point(const AABBTree *tree, Vec2 point, int *items, int max_items)
+{
+    AABB box = {point, point};
+    AABB_TREE_WALK(tree, items, max_items, aabb_overlap(b, box));
+}
+
+// Slab test of the segment from + t * d for t in 0 to 1
+static bool aabb_segment(AABB box, Vec2 from, Vec2 d)
+{
+    p2_real t0 = 0, t1 = 1;
+    p2_real o[2] = {from.x, from.y}, dir[2] = {d.x, d.y};
+    p2_real lo[2] = {box.min.x, box.min.y}, hi[2] = {box.max.x, box.max.y};
+    for (int i=0; i<2; i++) {
+        if (dir[i] == 0) {
+            if (o[i] < lo[i] || o[i] > hi[i]) return false;
+            continue;
+        }
+        p2_real inv = 1 / dir[i];
+        p2_real a = (lo[i] - o[i]) * inv, b = (hi[i] - o[i]) * inv;
+        if (a > b) {
+            p2_real t = a;
+            a = b;
+            b = t;
+        }
+        if (a > t0) t0 = a;
+        if (b < t1) t1 = b;
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+// aabb_tree_raycast finds the items whose fat boxes the segment from from
+// to to crosses, in no order.
+int aabb_tree_raycast(const AABBTree *tree, Vec2 from, Vec2 to, int *items, int max_items)
+{
+    Vec2 d = vec2_sub(to, from);
+    AABB_TREE_WALK(tree, items, max_items, aabb_segment(b, from, d));
+}
+
+#undef AABB_TREE_WALK
+
+// aabb_tree_update_pairs finds the pairs of items whose fat boxes overlap,
+// in tree->pairs. Pairs of items that didn't move are kept from the last
+// time, the moved items look for theirs in the tree.
+int aabb_tree_update_pairs(AABBTree *tree)
+{
+    int items = arrlen(tree->leaves);
+
+    int kept = 0;
+    for (int i=0; i < arrlen(tree->pairs); i++) {
+        BodyPair p = tree->pairs[i];
+        if (p.b >= items || tree->moved[p.a] || tree->moved[p.b]) continue;
+        tree->pairs[kept++] = p;
+    }
+    arrsetlen(tree->pairs, kept);
+
+    for (int m=0; m<items; m++) {
+        if (!tree->moved[m] || tree->leaves[m] == AABB_TREE_NULL) continue;
+
+        AABB box = tree->nodes[tree->leaves[m]].box;
+        int found;
+        while ((found = aabb_tree_query(tree, box, tree->found, arrlen(tree->found))) == arrlen(tree->found)) {
+            // Maybe more, look again with room for them
+            arrsetlen(tree->found, 2 * found + 16);
+        }
+        for (int k=0; k<found; k++) {
+            int o = tree->found[k];
+            // Two moved items find each other, keep one
+            if (o == m || (tree->moved[o] && o < m)) continue;
+            arrput(tree->pairs, ((BodyPair){m < o ? m : o, m < o ? o : m}));
+        }
+    }
+
+    for (int m=0; m<items; m++) tree->moved[m] = false;
+    return arrlen(tree->pairs);
+}
+
+// aabb_tree_update makes box i the box of item i, for n items, and finds
+// the pairs. Items of empty boxes and from n up are removed.
+int aabb_tree_update(AABBTree *tree, const AABB *boxes, int n)
+{
+    for (int i = arrlen(tree->leaves) - 1; i >= n; i--) aabb_tree_remove(tree, i);
+    for (int i=0; i<n; i++) {
+        if (aabb_empty(boxes[i])) aabb_tree_remove(tree, i);
+        else aabb_tree_move(tree, i, boxes[i]);
+    }
+    if (arrlen(tree->leaves) > n) {
+        arrsetlen(tree->leaves, n);
+        arrsetlen(tree->moved, n);
+    }
+    return aabb_tree_update_pairs(tree);
+}
 
 /**********************************************
  *
- * Shapes
+ * Sweep and Prune
  *
  **********************************************/
 
+void sweep_prune_free(SweepPrune *sap)
+{
+    arrfree(sap->ends);
+    hmfree(sap->overlaps);
+    arrfree(sap->present);
+    arrfree(sap->pairs);
+    arrfree(sap->added);
+    arrfree(sap->removed);
+    arrfree(sap->active);
+    arrfree(sap->slot);
+    sap->n = 0;
+}
 
-// https://happycoding.io/tutorials/processing/collision-detection
-// https://www.jeffreythompson.org/collision-detection/index.php
-
-/**
- * Area functions
- * 
- */
+static inline p2_real sweep_value(const SweepPrune *sap, AABB box, bool max)
+{
+    Vec2 v = max ? box.max : box.min;
+    return sap->axis == 0 ? v.x : v.y;
+}
 
-double point_area(Point p)
+// Order of the ends. A min goes before a max of the same value, so boxes
+// that touch overlap like in aabb_overlap.
+static inline bool sweep_less(SweepEnd a, SweepEnd b)
 {
-    return 1;
+    return a.value < b.value || (a.value == b.value && !a.max && b.max);
 }
 
-double line_area(Line l)
+static int sweep_compare(const void *a, const void *b)
 {
+    SweepEnd e1 = *(const SweepEnd*) a, e2 = *(const SweepEnd*) b;
+    if (sweep_less(e1, e2)) return -1;
+    if (sweep_less(e2, e1)) return 1;
     return 0;
 }
 
-double circle_area(Circle p)
+static inline BodyPair sweep_pair(int a, int b)
 {
-    return M_PI * p.radius  * p.radius;
+    return a < b ? (BodyPair){a, b} : (BodyPair){b, a};
 }
 
-double triangle_area(Triangle t)
+static void sweep_overlap_add(SweepPrune *sap, int a, int b)
 {
-    return -1; // TODO
+    hmput(sap->overlaps, sweep_pair(a, b), false);
 }
 
-double rect_area(Rect r)
+static void sweep_overlap_remove(SweepPrune *sap, int a, int b)
 {
-    return r.width * r.height;
+    BodyPair key = sweep_pair(a, b);
+    SweepOverlap *o = hmgetp_null(sap->overlaps, key);
+    if (o == NULL) return;
+    if (o->value) arrput(sap->removed, key);
+    (void)hmdel(sap->overlaps, key);
 }
 
-double quad_area(Quad q)
+// Sorts the ends from nothing and sweeps them for the overlaps. Pairs that
+// were in pairs before stay in, the ones that are gone are removed.
+static void sweep_prune_rebuild(SweepPrune *sap, const AABB *boxes, int n)
 {
-    return -1; // TODO
+    SweepOverlap *old = sap->overlaps;
+    sap->overlaps = NULL;
+
+    arrsetlen(sap->present, n);
+    arrsetlen(sap->ends, 0);
+    for (int i=0; i<n; i++) {
+        sap->present[i] = !aabb_empty(boxes[i]);
+        if (!sap->present[i]) continue;
+        arrput(sap->ends, ((SweepEnd){sweep_value(sap, boxes[i], false), i, false}));
+        arrput(sap->ends, ((SweepEnd){sweep_value(sap, boxes[i], true), i, true}));
+    }
+    qsort(sap->ends, arrlen(sap->ends), sizeof(SweepEnd), sweep_compare);
+
+    // Boxes open at this point of the sweep, with where each one is in active
+    arrsetlen(sap->active, 0);
+    arrsetlen(sap->slot, n);
+    for (int i=0; i < arrlen(sap->ends); i++) {
+        SweepEnd e = sap->ends[i];
+        if (!e.max) {
+            for (int k=0; k < arrlen(sap->active); k++) {
+                BodyPair key = sweep_pair(e.item, sap->active[k]);
+                SweepOverlap *o = hmgetp_null(old, key);
+                hmput(sap->overlaps, key, o != NULL && o->value);
+            }
+            sap->slot[e.item] = arrlen(sap->active);
+            arrput(sap->active, e.item);
+        } else {
+            int k = sap->slot[e.item];
+            int last = arrpop(sap->active);
+            if (last != e.item) {
+                sap->active[k] = last;
+                sap->slot[last] = k;
+            }
+        }
+    }
+
+    for (int i=0; i < hmlen(old); i++) {
+        if (old[i].value && hmgetp_null(sap->overlaps, old[i].key) == NULL) {
+            arrput(sap->removed, old[i].key);
+        }
+    }
+    hmfree(old);
+    sap->n = n;
+}
+
+// sweep_prune_update finds the pairs of the n boxes that overlap, by index,
+// in sap->pairs, and the pairs added and removed since the last update in
+// sap->added and sap->removed. Empty boxes overlap nothing. Returns the
+// number of pairs.
+int sweep_prune_update(SweepPrune *sap, const AABB *boxes, int n)
+{
+    arrsetlen(sap->added, 0);
+    arrsetlen(sap->removed, 0);
+
+    bool rebuild = n != sap->n;
+    for (int i=0; i<n && !rebuild; i++) {
+        rebuild = sap->present[i] == aabb_empty(boxes[i]);
+    }
+
+    if (rebuild) {
+        sweep_prune_rebuild(sap, boxes, n);
+    } else {
+        // Insertion sort. Moving an end down past another starts or stops
+        // an overlap when one is a min and the other a max.
+        SweepEnd *ends = sap->ends;
+        for (int i=0; i < arrlen(ends); i++) {
+            ends[i].value = sweep_value(sap, boxes[ends[i].item], ends[i].max);
+        }
+        for (int i=1; i < arrlen(sap->ends); i++) {
+            SweepEnd e = sap->ends[i];
+            int j = i - 1;
+            while (j >= 0 && sweep_less(e, sap->ends[j])) {
+                SweepEnd other = sap->ends[j];
+                if (!e.max && other.max) sweep_overlap_add(sap, e.item, other.item);
+                if (e.max && !other.max) sweep_overlap_remove(sap, e.item, other.item);
+                sap->ends[j + 1] = other;
+                j--;
+            }
+            sap->ends[j + 1] = e;
+        }
+    }
+
+    // Test the other axis of the pairs that overlap on this one
+    arrsetlen(sap->pairs, 0);
+    for (int i=0; i < hmlen(sap->overlaps); i++) {
+        SweepOverlap *o = &sap->overlaps[i];
+        bool overlap = aabb_overlap(boxes[o->key.a], boxes[o->key.b]);
+        if (overlap && !o->value) arrput(sap->added, o->key);
+        if (!overlap && o->value) arrput(sap->removed, o->key);
+        o->value = overlap;
+        if (overlap) arrput(sap->pairs, o->key);
+    }
+    return arrlen(sap->pairs);
+}
+
+/**********************************************
+ *
+ * LBVH
+ *
+ **********************************************/
+
+// Based on "Maximizing Parallelism in the Construction of BVHs, Octrees,
+// and k-d Trees" by Tero Karras
+
+#ifdef _OPENMP
+#define P2_PARALLEL_FOR _Pragma("omp parallel for schedule(static)")
+#define P2_PARALLEL_FOR_DYNAMIC _Pragma("omp parallel for schedule(dynamic, 256)")
+#define p2_thread() omp_get_thread_num()
+#define p2_threads() omp_get_max_threads()
+#else
+#define P2_PARALLEL_FOR
+#define P2_PARALLEL_FOR_DYNAMIC
+#define p2_thread() 0
+#define p2_threads() 1
+#endif
+
+void lbvh_free(LBVH *bvh)
+{
+    arrfree(bvh->nodes);
+    arrfree(bvh->items);
+    arrfree(bvh->codes);
+    arrfree(bvh->pairs);
+    arrfree(bvh->codes_tmp);
+    arrfree(bvh->items_tmp);
+    arrfree(bvh->visits);
+    for (int i=0; i < arrlen(bvh->thread_pairs); i++) arrfree(bvh->thread_pairs[i]);
+    arrfree(bvh->thread_pairs);
+    bvh->n = 0;
 }
 
+// Spreads the low 16 bits of v to the even bits
+static inline uint32_t morton_spread(uint32_t v)
+{
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
 
-double poly_area(Poly p)
+static inline uint32_t morton_code(Vec2 p, Vec2 lo, Vec2 scale)
 {
-    return -1; // TODO
+    p2_real x = (p.x - lo.x) * scale.x, y = (p.y - lo.y) * scale.y;
+    uint32_t ix = x <= 0 ? 0 : x >= 65535 ? 65535 : (uint32_t) x;
+    uint32_t iy = y <= 0 ? 0 : y >= 65535 ? 65535 : (uint32_t) y;
+    return morton_spread(ix) | (morton_spread(iy) << 1);
 }
 
-double shape_area(Shape s) {
-    switch (s.type) {
-        case POINT: return point_area(s.point); break;
-        case LINE: return line_area(s.line); break;
-        case CIRCLE: return circle_area(s.circle); break;
-        case TRIANGLE: return triangle_area(s.triangle); break;
-        case QUAD: return quad_area(s.quad); break;
-        case RECT: return rect_area(s.rect); break;
-        case POLY: return poly_area(s.poly); break;
+// Sorts codes and items along with them, 8 bits at a time
+static void lbvh_sort(LBVH *bvh, int n)
+{
+    uint32_t *codes = bvh->codes, *codes_tmp = bvh->codes_tmp;
+    int *items = bvh->items, *items_tmp = bvh->items_tmp;
+    for (int shift=0; shift<32; shift += 8) {
+        int count[257] = {0};
+        for (int i=0; i<n; i++) count[((codes[i] >> shift) & 0xff) + 1]++;
+        for (int b=0; b<256; b++) count[b + 1] += count[b];
+        for (int i=0; i<n; i++) {
+            int k = count[(codes[i] >> shift) & 0xff]++;
+            codes_tmp[k] = codes[i];
+            items_tmp[k] = items[i];
+        }
+        uint32_t *c = codes; codes = codes_tmp; codes_tmp = c;
+        int *t = items; items = items_tmp; items_tmp = t;
     }
-    return false;
+    // Four passes, so the sorted ones are back in codes and items
 }
 
-/**
- * Collision functions
- * 
- */
+static inline int p2_clz(uint32_t v)
+{
+#if defined(__GNUC__)
+    return v == 0 ? 32 : __builtin_clz(v);
+#else
+    int n = 0;
+    while (n < 32 && !(v & (0x80000000u >> n))) n++;
+    return n;
+#endif
+}
 
-Collision point_collide(Point p1, Point p2)
+// Length of the common prefix of the codes of leaves i and j, -1 outside.
+// Equal codes go on by the index, so every leaf is different.
+static inline int lbvh_delta(const uint32_t *codes, int n, int i, int j)
 {
-    int p1x = p1.x;
-    int p1y = p1.y;
-    int p2x = p2.x;
-    int p2y = p2.y;
-    return (Collision) {
-        .hit = p1x == p2x && p1y == p2y,
-        .shapes = {
-            { .type = POINT, .point = p1, },
-            { .type = POINT, .point = p2, },
-        },
-    };
+    if (j < 0 || j >= n) return -1;
+    if (codes[i] == codes[j]) return 32 + p2_clz((uint32_t) i ^ (uint32_t) j);
+    return p2_clz(codes[i] ^ codes[j]);
+}
+
+// Finds the leaves under internal node i and where they split
+static void lbvh_build_node(LBVH *bvh, int n, int i)
+{
+    const uint32_t *codes = bvh->codes;
+    LBVHNode *nodes = bvh->nodes;
+
+    // Grow toward the neighbour with the longer common prefix
+    int d = lbvh_delta(codes, n, i, i + 1) > lbvh_delta(codes, n, i, i - 1) ? 1 : -1;
+    int delta_min = lbvh_delta(codes, n, i, i - d);
+
+    int lmax = 2;
+    while (lbvh_delta(codes, n, i, i + lmax * d) > delta_min) lmax *= 2;
+    int l = 0;
+    for (int t = lmax / 2; t >= 1; t /= 2) {
+        if (lbvh_delta(codes, n, i, i + (l + t) * d) > delta_min) l += t;
+    }
+    int j = i + l * d;
+
+    // Split where the prefix of the range ends
+    int delta_node = lbvh_delta(codes, n, i, j);
+    int s = 0, t = l;
+    do {
+        t = (t + 1) / 2;
+        if (lbvh_delta(codes, n, i, i + (s + t) * d) > delta_node) s += t;
+    } while (t > 1);
+    int split = i + s * d + (d < 0 ? -1 : 0);
+
+    int first = i < j ? i : j, last = i < j ? j : i;
+    int leaves = n - 1;
+    int c1 = first == split ? leaves + split : split;
+    int c2 = last == split + 1 ? leaves + split + 1 : split + 1;
+    nodes[i].child1 = c1;
+    nodes[i].child2 = c2;
+    nodes[i].last = last;
+    nodes[c1].parent = i;
+    nodes[c2].parent = i;
 }
 
-Collision point_collide_line(Point p, Line l) { return collision_miss; }
-Collision point_collide_circle(Point p, Circle c) { return collision_miss; }
-Collision point_collide_triangle(Point p, Triangle t) { return collision_miss; }
-Collision point_collide_rect(Point p, Rect r) { return collision_miss; }
-Collision point_collide_poly(Point p, Poly poly) { return collision_miss; }
+// Counts a visit from a child, returns the visits before it
+static inline int lbvh_visit(int *visits)
+{
+#if defined(__GNUC__)
+    return __atomic_fetch_add(visits, 1, __ATOMIC_ACQ_REL);
+#else
+    return (*visits)++;
+#endif
+}
 
-Collision line_collide(Line l1, Line l2) { return collision_miss; }
-Collision line_collide_point(Line l, Point p) { return collision_miss; }
-Collision line_collide_circle(Line l, Circle c) { return collision_miss; }
-Collision line_collide_triangle(Line l, Triangle t) { return collision_miss; }
-Collision line_collide_rect(Line l, Rect r) { return collision_miss; }
-Collision line_collide_poly(Line l, Poly poly) { return collision_miss; }
+// Deep enough for any tree of 32 bit codes and 32 bit indices
+#define LBVH_STACK 128
 
-Collision circle_collide(Circle c1, Circle c2)
-{ 
-  // get distance between the circle's centers
-  // use the Pythagorean Theorem to compute the distance
-  double distX = c1.center.x - c2.center.x;
-  double distY = c1.center.y - c2.center.y;
-  double distance = sqrt( (distX*distX) + (distY*distY) );
+// lbvh_update builds the tree of the n boxes and finds the pairs that
+// overlap, by index, in bvh->pairs. Empty boxes overlap nothing. Returns
+// the number of pairs.
+int lbvh_update(LBVH *bvh, const AABB *boxes, int n)
+{
+    arrsetlen(bvh->pairs, 0);
+
+    // The boxes that are there, and the bounds of their centers
+    arrsetlen(bvh->items, 0);
+    Vec2 lo = vec2(P2_REAL_MAX, P2_REAL_MAX), hi = vec2(-P2_REAL_MAX, -P2_REAL_MAX);
+    for (int i=0; i<n; i++) {
+        if (aabb_empty(boxes[i])) continue;
+        arrput(bvh->items, i);
+        Vec2 c = vec2_mult(vec2_add(boxes[i].min, boxes[i].max), 0.5);
+        lo = vec2(min(lo.x, c.x), min(lo.y, c.y));
+        hi = vec2(max(hi.x, c.x), max(hi.y, c.y));
+    }
+    int m = bvh->n = arrlen(bvh->items);
+    if (m < 2) return 0;
+
+    Vec2 scale = vec2(hi.x > lo.x ? 65535 / (hi.x - lo.x) : 0, hi.y > lo.y ? 65535 / (hi.y - lo.y) : 0);
+    arrsetlen(bvh->codes, m);
+    arrsetlen(bvh->codes_tmp, m);
+    arrsetlen(bvh->items_tmp, m);
+    P2_PARALLEL_FOR
+    for (int i=0; i<m; i++) {
+        AABB box = boxes[bvh->items[i]];
+        bvh->codes[i] = morton_code(vec2_mult(vec2_add(box.min, box.max), 0.5), lo, scale);
+    }
+    lbvh_sort(bvh, m);
+
+    // Internal nodes on their own, then the boxes from the leaves up. The
+    // second child to get to a node does it, the first one stops.
+    int leaves = m - 1;
+    arrsetlen(bvh->nodes, 2 * m - 1);
+    arrsetlen(bvh->visits, m - 1);
+    bvh->nodes[0].parent = AABB_TREE_NULL;
+    P2_PARALLEL_FOR
+    for (int i=0; i<m; i++) {
+        LBVHNode *leaf = &bvh->nodes[leaves + i];
+        leaf->box = boxes[bvh->items[i]];
+        leaf->child1 = leaf->child2 = AABB_TREE_NULL;
+        leaf->last = i;
+        if (i < m - 1) {
+            bvh->visits[i] = 0;
+            lbvh_build_node(bvh, m, i);
+        }
+    }
 
-  // if the distance is less than the sum of the circle's
-  // radii, the circles are touching!
-  return (Collision) {
-    .hit = distance <= c1.radius+c2.radius,
-    .shapes = {
-        { .type = CIRCLE, .circle = c1, },
-        { .type = CIRCLE, .circle = c2, },
-    },
-    /* .dir = vec2_add(c1.center, c2.center), */
-  };
+    P2_PARALLEL_FOR
+    for (int i=0; i<m; i++) {
+        LBVHNode *nodes = bvh->nodes;
+        int p = nodes[leaves + i].parent;
+        while (p != AABB_TREE_NULL && lbvh_visit(&bvh->visits[p]) == 1) {
+            nodes[p].box = aabb_union(nodes[nodes[p].child1].box, nodes[nodes[p].child2].box);
+            p = nodes[p].parent;
+        }
+    }
+
+    // Each leaf looks for the leaves after it in the order
+    int threads = p2_threads();
+    while (arrlen(bvh->thread_pairs) < threads) arrput(bvh->thread_pairs, NULL);
+    for (int t=0; t<threads; t++) arrsetlen(bvh->thread_pairs[t], 0);
+
+    P2_PARALLEL_FOR_DYNAMIC
+    for (int i=0; i<m; i++) {
+        const LBVHNode *nodes = bvh->nodes;
+        BodyPair **out = &bvh->thread_pairs[p2_thread()];
+        AABB box = nodes[leaves + i].box;
+        int a = bvh->items[i];
+
+        int stack[LBVH_STACK];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            int id = stack[--top];
+            const LBVHNode *node = &nodes[id];
+            if (node->last <= i || !aabb_overlap(node->box, box)) continue;
+            if (id >= leaves) {
+                int b = bvh->items[id - leaves];
+                arrput(*out, (a < b ? (BodyPair){a, b} : (BodyPair){b, a}));
+            } else {
+                assert(top + 2 <= LBVH_STACK);
+                stack[top++] = node->child1;
+                stack[top++] = node->child2;
+            }
+        }
+    }
+
+    for (int t=0; t<threads; t++) {
+        int k = arrlen(bvh->thread_pairs[t]);
+        if (k == 0) continue;
+        int at = arrlen(bvh->pairs);
+        arrsetlen(bvh->pairs, at + k);
+        memcpy(bvh->pairs + at, bvh->thread_pairs[t], sizeof(BodyPair) * k);
+    }
+    return arrlen(bvh->pairs);
 }
 
-Collision circle_collide_line(Circle c, Line l) { return collision_miss; }
-Collision circle_collide_point(Circle c, Point p) { return collision_miss; }
-Collision circle_collide_triangle(Circle p, Triangle t) { return collision_miss; }
-Collision circle_collide_rect(Circle p, Rect r) { return collision_miss; }
-Collision circle_collide_poly(Circle p, Poly poly) { return collision_miss; }
-
-Collision rect_collide(Rect r1, Rect r2) { return collision_miss; }
-Collision rect_collide_point(Rect r, Point p) { return collision_miss; }
-Collision rect_collide_line(Rect r, Line l) { return collision_miss; }
-Collision rect_collide_circle(Rect r, Circle c) { return collision_miss; }
-Collision rect_collide_triangle(Rect r, Triangle t) { return collision_miss; }
-Collision rect_collide_poly(Rect r, Poly poly) { return collision_miss; }
-
-Collision triangle_collide(Triangle t1, Triangle t2) { return collision_miss; }
-Collision triangle_collide_point(Triangle t, Point p) { return collision_miss; }
-Collision triangle_collide_line(Triangle t, Line l) { return collision_miss; }
-Collision triangle_collide_circle(Triangle t, Circle c) { return collision_miss; }
-Collision triangle_collide_rect(Triangle t, Rect r) { return collision_miss; }
-Collision triangle_collide_poly(Triangle t, Poly poly) { return collision_miss; }
-
-Collision poly_collide(Poly p1, Poly p2) { return collision_miss; }
-Collision poly_collide_point(Poly poly, Point point) { return collision_miss; }
-Collision poly_collide_line(Poly p, Line l) { return collision_miss; }
-Collision poly_collide_circle(Poly p, Circle c) { return collision_miss; }
-Collision poly_collide_rect(Poly p, Rect r) { return collision_miss; }
-Collision poly_collide_triangle(Poly p, Triangle poly) { return collision_miss; }
-
-Collision shape_collide(Shape s1, Shape s2)
-{
-    if (s1.type == POINT && s2.type == POINT) return point_collide(s1.point, s2.point);
-    if (s1.type == POINT && s2.type == LINE) return point_collide_line(s1.point, s2.line);
-    if (s1.type == POINT && s2.type == CIRCLE) return point_collide_circle(s1.point, s2.circle);
-    if (s1.type == POINT && s2.type == TRIANGLE) return point_collide_triangle(s1.point, s2.triangle);
-    if (s1.type == POINT && s2.type == RECT) return point_collide_rect(s1.point, s2.rect);
-    if (s1.type == POINT && s2.type == POLY) return point_collide_poly(s1.point, s2.poly);
-
-    if (s1.type == LINE && s2.type == LINE) return line_collide(s1.line, s2.line);
-    if (s1.type == LINE && s2.type == POINT) return line_collide_point(s1.line, s2.point);
-    if (s1.type == LINE && s2.type == CIRCLE) return line_collide_circle(s1.line, s2.circle);
-    if (s1.type == LINE && s2.type == TRIANGLE) return line_collide_triangle(s1.line, s2.triangle);
-    if (s1.type == LINE && s2.type == RECT) return line_collide_rect(s1.line, s2.rect);
-    if (s1.type == LINE && s2.type == POLY) return line_collide_poly(s1.line, s2.poly);
-
-    if (s1.type == CIRCLE && s2.type == LINE) return circle_collide_line(s1.circle, s2.line);
-    if (s1.type == CIRCLE && s2.type == POINT) return circle_collide_point(s1.circle, s2.point);
-    if (s1.type == CIRCLE && s2.type == CIRCLE) return circle_collide(s1.circle, s2.circle);
-    if (s1.type == CIRCLE && s2.type == TRIANGLE) return circle_collide_triangle(s1.circle, s2.triangle);
-    if (s1.type == CIRCLE && s2.type == RECT) return circle_collide_rect(s1.circle, s2.rect);
-    if (s1.type == CIRCLE && s2.type == POLY) return circle_collide_poly(s1.circle, s2.poly);
-
-    if (s1.type == RECT && s2.type == LINE) return rect_collide_line(s1.rect, s2.line);
-    if (s1.type == RECT && s2.type == POINT) return rect_collide_point(s1.rect, s2.point);
-    if (s1.type == RECT && s2.type == CIRCLE) return rect_collide(s1.rect, s2.rect);
-    if (s1.type == RECT && s2.type == TRIANGLE) return rect_collide_triangle(s1.rect, s2.triangle);
-    if (s1.type == RECT && s2.type == RECT) return rect_collide(s1.rect, s2.rect);
-    if (s1.type == RECT && s2.type == POLY) return rect_collide_poly(s1.rect, s2.poly);
-
-    if (s1.type == TRIANGLE && s2.type == LINE) return triangle_collide_line(s1.triangle, s2.line);
-    if (s1.type == TRIANGLE && s2.type == POINT) return triangle_collide_point(s1.triangle, s2.point);
-    if (s1.type == TRIANGLE && s2.type == CIRCLE) return triangle_collide(s1.triangle, s2.triangle);
-    if (s1.type == TRIANGLE && s2.type == TRIANGLE) return triangle_collide(s1.triangle, s2.triangle);
-    if (s1.type == TRIANGLE && s2.type == RECT) return triangle_collide(s1.triangle, s2.triangle);
-    if (s1.type == TRIANGLE && s2.type == POLY) return triangle_collide_poly(s1.triangle, s2.poly);
-
-    return collision_miss;
+/**********************************************
+ *
+ * Static Tree
+ *
+ **********************************************/
+
+void static_tree_free(StaticTree *tree)
+{
+    arrfree(tree->nodes);
+    arrfree(tree->items);
+    arrfree(tree->boxes);
 }
 
-Shape shape_offset(Vec2 start, Shape shape)
+typedef struct StaticBin {
+    AABB box;
+    int count;
+} StaticBin;
+
+static inline Vec2 aabb_center(AABB box)
 {
-    Vec2 v1, v2, v3;
-    switch (shape.type) {
-        case POINT:
-            shape.point = vec2_add(start, shape.point);
-            break;
-        case LINE:
-            shape.line.v1 = vec2_add(start, shape.line.v1);
-            shape.line.v2 = vec2_add(start, shape.line.v2);
-            break;
-        case CIRCLE:
-            shape.circle.center = vec2_add(start, shape.circle.center);
-            break;
-        case RECT:
-            shape.rect.pos = vec2_add(start, shape.rect.pos);
-            break;
-        case TRIANGLE:
-            shape.triangle.v1 = vec2_add(start, shape.triangle.v1);
-            shape.triangle.v2 = vec2_add(start, shape.triangle.v2);
-            shape.triangle.v3 = vec2_add(start, shape.triangle.v3);
-            break;
-        case QUAD:
-            shape.quad.v1 = vec2_add(start, shape.quad.v1);
-            break;
-        case POLY: 
-            assert("not implemented");
-            break;
-    }
-    return shape;
+    return vec2_mult(vec2_add(box.min, box.max), 0.5);
 }
 
-Vec2 shape_center(Shape s1, Shape s2);
+static inline int static_tree_bin(Vec2 c, int axis, p2_real lo, p2_real scale)
+{
+    int b = (int)(((axis == 0 ? c.x : c.y) - lo) * scale);
+    return b < 0 ? 0 : b >= STATIC_TREE_BINS ? STATIC_TREE_BINS - 1 : b;
+}
 
-// TODO: delete me, just for testing purposes
-static inline double kinamatic(double acc, double vel, double pos, double t)
+// Builds the node of items[first] up to first + count and returns it
+static int static_tree_build_node(StaticTree *tree, int first, int count)
 {
-    return 0.5f * acc * t * t * vel * t + pos;
+    const AABB *boxes = tree->boxes;
+    int *items = tree->items;
+
+    AABB box = boxes[items[first]];
+    Vec2 c = aabb_center(box);
+    AABB centers = {c, c};
+    for (int i=first + 1; i < first + count; i++) {
+        box = aabb_union(box, boxes[items[i]]);
+        c = aabb_center(boxes[items[i]]);
+        centers = aabb_union(centers, (AABB){c, c});
+    }
+
+    int id = arrlen(tree->nodes);
+    arrput(tree->nodes, ((StaticTreeNode){
+        .box = box,
+        .child1 = AABB_TREE_NULL,
+        .child2 = AABB_TREE_NULL,
+        .first = first,
+        .count = count,
+    }));
+    if (count <= 1) return id;
+
+    // Cost of a split is the boxes of each side, weighted by how likely a
+    // query that hits this node hits the side, against testing every box
+    p2_real leaf_cost = count;
+    p2_real best_cost = P2_REAL_MAX;
+    int best_axis = -1, best_split = 0;
+    p2_real best_lo = 0, best_scale = 0;
+    p2_real area = aabb_perimeter(box);
+    for (int axis=0; axis<2; axis++) {
+        p2_real lo = axis == 0 ? centers.min.x : centers.min.y;
+        p2_real hi = axis == 0 ? centers.max.x : centers.max.y;
+        if (hi <= lo) continue;
+        p2_real scale = STATIC_TREE_BINS / (hi - lo);
+
+        StaticBin bins[STATIC_TREE_BINS] = {0};
+        for (int i=first; i < first + count; i++) {
+            AABB b = boxes[items[i]];
+            StaticBin *bin = &bins[static_tree_bin(aabb_center(b), axis, lo, scale)];
+            bin->box = bin->count == 0 ? b : aabb_union(bin->box, b);
+            bin->count++;
+        }
+
+        // Left sides from the bottom, then right sides from the top
+        p2_real left_cost[STATIC_TREE_BINS];
+        AABB side = {0};
+        int n = 0;
+        for (int k=0; k < STATIC_TREE_BINS - 1; k++) {
+            if (bins[k].count > 0) side = n == 0 ? bins[k].box : aabb_union(side, bins[k].box);
+            n += bins[k].count;
+            left_cost[k] = n == 0 ? 0 : aabb_perimeter(side) * n;
+        }
+        n = 0;
+        for (int k=STATIC_TREE_BINS - 1; k > 0; k--) {
+            if (bins[k].count > 0) side = n == 0 ? bins[k].box : aabb_union(side, bins[k].box);
+            n += bins[k].count;
+            if (n == count || n == 0) continue;
+            p2_real cost = 1 + (left_cost[k - 1] + aabb_perimeter(side) * n) / area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = k;
+                best_lo = lo;
+                best_scale = scale;
+            }
+        }
+    }
+
+    if (best_axis < 0) return id;
+    if (best_cost >= leaf_cost && count <= STATIC_TREE_LEAF) return id;
+
+    // Items of the bins below the split first
+    int mid = first;
+    for (int i=first; i < first + count; i++) {
+        if (static_tree_bin(aabb_center(boxes[items[i]]), best_axis, best_lo, best_scale) < best_split) {
+            int t = items[i];
+            items[i] = items[mid];
+            items[mid++] = t;
+        }
+    }
+
+    int child1 = static_tree_build_node(tree, first, mid - first);
+    int child2 = static_tree_build_node(tree, mid, first + count - mid);
+    tree->nodes[id].child1 = child1;
+    tree->nodes[id].child2 = child2;
+    tree->nodes[id].count = 0;
+    return id;
 }
 
-Collider collider(Shape shapes[], int num_shapes)
+// static_tree_build makes the tree of the n boxes, the items are their
+// indices. Empty boxes are left out.
+void static_tree_build(StaticTree *tree, const AABB *boxes, int n)
 {
-    Collider collider = NULL;
-    for (int i = 0; i < num_shapes; i++) {
-        arrput(collider, shapes[i]);
+    arrsetlen(tree->nodes, 0);
+    arrsetlen(tree->items, 0);
+    arrsetlen(tree->boxes, n);
+    for (int i=0; i<n; i++) {
+        tree->boxes[i] = boxes[i];
+        if (!aabb_empty(boxes[i])) arrput(tree->items, i);
     }
-    return collider;
+    if (arrlen(tree->items) > 0) static_tree_build_node(tree, 0, arrlen(tree->items));
 }
 
-Collision collider_detect_collisions(Vec2 pos1, Collider shapes1, Vec2 pos2, Collider shapes2)
+// static_tree_query finds the items whose boxes overlap box, up to
+// max_items of them. Returns how many it found.
+int static_tree_query(const StaticTree *tree, AABB box, int *items, int max_items)
 {
-    for (int i=0; i<arrlen(shapes1); i++) {
-        for (int j=0; j<arrlen(shapes2); j++) {
-            Shape s1 = shape_offset(pos1, shapes1[i]);
-            Shape s2 = shape_offset(pos2, shapes2[j]);
-            Collision collision = shape_collide(s1, s2);
-            if (collision.hit) {
-                collision.dir = vec2_normalize(vec2_sub(pos1, pos2));
-                return collision;
+    if (arrlen(tree->nodes) == 0) return 0;
+
+    int stack[AABB_TREE_STACK];
+    int top = 0, count = 0;
+    stack[top++] = 0;
+    while (top > 0 && count < max_items) {
+        const StaticTreeNode *node = &tree->nodes[stack[--top]];
+        if (!aabb_overlap(node->box, box)) continue;
+        if (node->child1 == AABB_TREE_NULL) {
+            for (int i=node->first; i < node->first + node->count && count < max_items; i++) {
+                if (aabb_overlap(tree->boxes[tree->items[i]], box)) items[count++] = tree->items[i];
             }
+        } else {
+            assert(top + 2 <= AABB_TREE_STACK);
+            stack[top++] = node->child1;
+            stack[top++] = node->child2;
         }
     }
-    return (Collision) { .hit = false };
+    return count;
+}
+
+/**********************************************
+ *
+ * Broadphase
+ *
+ **********************************************/
+
+void broadphase_free(Broadphase *bp)
+{
+    grid_free(&bp->grid);
+    aabb_tree_free(&bp->tree);
+    sweep_prune_free(&bp->sap);
+    lbvh_free(&bp->lbvh);
+}
+
+// broadphase_update finds the pairs of the n boxes that may touch, by index,
+// with a < b and each pair once. Returns the number of pairs.
+int broadphase_update(Broadphase *bp, const AABB *boxes, int n)
+{
+    switch (bp->type) {
+        case BROADPHASE_GRID: return grid_update(&bp->grid, boxes, n);
+        case BROADPHASE_TREE: return aabb_tree_update(&bp->tree, boxes, n);
+        case BROADPHASE_SAP: return sweep_prune_update(&bp->sap, boxes, n);
+        case BROADPHASE_LBVH: return lbvh_update(&bp->lbvh, boxes, n);
+    }
+    return 0;
+}
+
+const BodyPair *broadphase_pairs(const Broadphase *bp, int *n)
+{
+    switch (bp->type) {
+        case BROADPHASE_GRID:
+            *n = arrlen(bp->grid.pairs);
+            return bp->grid.pairs;
+        case BROADPHASE_TREE:
+            *n = arrlen(bp->tree.pairs);
+            return bp->tree.pairs;
+        case BROADPHASE_SAP:
+            *n = arrlen(bp->sap.pairs);
+            return bp->sap.pairs;
+        case BROADPHASE_LBVH:
+            *n = arrlen(bp->lbvh.pairs);
+            return bp->lbvh.pairs;
+    }
+    *n = 0;
+    return NULL;
 }
 
 #endif // End PHYSICS2D_IMPLEMENTATION
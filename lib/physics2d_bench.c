@@ -0,0 +1,1199 @@
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <assert.h>
+
+#include "physics2d.h"
+
+double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench_start(char *bench_name)
+{
+    printf("\n - %s benchmark\n\n", bench_name);
+}
+
+void all_bench_start()
+{
+    printf("\n*********** Running benchmarks ********\n");
+}
+
+void all_bench_done()
+{
+    printf("\n*********** All benchmarks done *******\n\n");
+}
+
+
+/**
+ * Integrators
+ *
+ * Runs every integrator at 30 Hz and 120 Hz on the same scene and reports
+ * the cost per body step and the relative energy drift at the end.
+ */
+
+// Unit spring to the origin, a = -x
+void bench_spring_accel(const BodyStore *store, void *ctx,
+        const p2_real *pos_x, const p2_real *pos_y,
+        const p2_real *vel_x, const p2_real *vel_y,
+        p2_real *acc_x, p2_real *acc_y)
+{
+    int n = body_store_count(store);
+    for (int i=0; i<n; i++) {
+        acc_x[i] = -pos_x[i];
+        acc_y[i] = -pos_y[i];
+    }
+}
+
+double bench_spring_energy(const BodyStore *store, int i)
+{
+    Vec2 pos = body_store_pos(store, i);
+    Vec2 vel = body_store_vel(store, i);
+    return 0.5 * vec2_mag_sq(vel) + 0.5 * vec2_mag_sq(pos);
+}
+
+void bench_spring_init(BodyStore *store, int i)
+{
+    double angle = 2 * M_PI * i / body_store_count(store);
+    body_store_set_pos(store, i, vec2(cos(angle), sin(angle)));
+    body_store_set_vel(store, i, vec2(-sin(angle), 0.5 * cos(angle)));
+}
+
+// Unit mass orbiting a fixed unit mass at the origin, a = -x / |x|^3
+void bench_orbit_accel(const BodyStore *store, void *ctx,
+        const p2_real *pos_x, const p2_real *pos_y,
+        const p2_real *vel_x, const p2_real *vel_y,
+        p2_real *acc_x, p2_real *acc_y)
+{
+    int n = body_store_count(store);
+    for (int i=0; i<n; i++) {
+        p2_real r2 = pos_x[i] * pos_x[i] + pos_y[i] * pos_y[i];
+        p2_real inv_r3 = 1 / (r2 * p2_sqrt(r2));
+        acc_x[i] = -pos_x[i] * inv_r3;
+        acc_y[i] = -pos_y[i] * inv_r3;
+    }
+}
+
+double bench_orbit_energy(const BodyStore *store, int i)
+{
+    Vec2 pos = body_store_pos(store, i);
+    Vec2 vel = body_store_vel(store, i);
+    return 0.5 * vec2_mag_sq(vel) - 1 / vec2_mag(pos);
+}
+
+void bench_orbit_init(BodyStore *store, int i)
+{
+    // Slightly eccentric orbits
+    double r = 1 + 0.2 * i / body_store_count(store);
+    body_store_set_pos(store, i, vec2(r, 0));
+    body_store_set_vel(store, i, vec2(0, 1.1 / sqrt(r)));
+}
+
+void bench_integrators_scene(char *scene, AccelFunc accel,
+        void (*init)(BodyStore *store, int i),
+        double (*energy)(const BodyStore *store, int i))
+{
+    const int n = 10000;
+    const double duration = 6 * M_PI;
+
+    Integrator integrators[] = {INTEGRATOR_EULER, INTEGRATOR_VERLET, INTEGRATOR_RK4};
+    int rates[] = {30, 120};
+
+    printf("   %-8s %-8s %6s %10s %12s %14s\n",
+            "scene", "method", "hz", "ms", "ns/body", "energy drift");
+
+    for (int r=0; r < sizeof(rates)/sizeof(int); r++) {
+        for (int k=0; k < sizeof(integrators)/sizeof(Integrator); k++) {
+            BodyStore store = body_store_new();
+            store.integrator = integrators[k];
+            store.accel = accel;
+            body_store_reserve(&store, n);
+            for (int i=0; i<n; i++) body_store_add(&store, vec2zero, 1);
+            for (int i=0; i<n; i++) init(&store, i);
+
+            double e0 = 0;
+            for (int i=0; i<n; i++) e0 += energy(&store, i);
+
+            double dt = 1.0 / rates[r];
+            int steps = duration / dt;
+
+            double start = bench_now();
+            for (int step=0; step < steps; step++) {
+                body_store_update_all(&store, dt);
+            }
+            double elapsed = bench_now() - start;
+
+            double e1 = 0;
+            for (int i=0; i<n; i++) e1 += energy(&store, i);
+
+            printf("   %-8s %-8s %6d %10.2f %12.2f %14.2e\n",
+                    scene, integrator_name(integrators[k]), rates[r],
+                    elapsed * 1e3, elapsed * 1e9 / ((double) steps * n),
+                    fabs((e1 - e0) / e0));
+
+            body_store_free(&store);
+        }
+    }
+}
+
+void bench_integrators()
+{
+    bench_start("integrators");
+    bench_integrators_scene("spring", bench_spring_accel, bench_spring_init, bench_spring_energy);
+    printf("\n");
+    bench_integrators_scene("orbit", bench_orbit_accel, bench_orbit_init, bench_orbit_energy);
+}
+
+
+/**
+ * Body churn
+ *
+ * Keeps a fixed number of live bodies and every frame despawns a share of
+ * them and spawns replacements, like projectiles and debris. Compares
+ * body_new/free with BodyPool, including one update pass over the live
+ * bodies per frame.
+ */
+
+// Small xorshift so both paths despawn the same bodies
+static uint32_t bench_rand_state = 1;
+uint32_t bench_rand()
+{
+    uint32_t x = bench_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return bench_rand_state = x;
+}
+
+double bench_churn_malloc(int live, int churn, int frames)
+{
+    Body **bodies = malloc(sizeof(Body *) * live);
+    for (int i=0; i<live; i++) bodies[i] = body_new(vec2(i, 0), 1);
+
+    bench_rand_state = 1;
+    double start = bench_now();
+    for (int frame=0; frame < frames; frame++) {
+        for (int k=0; k < churn; k++) {
+            int i = bench_rand() % live;
+            free(bodies[i]);
+            bodies[i] = body_new(vec2(k, frame), 1);
+        }
+        for (int i=0; i<live; i++) body_update(bodies[i], 1.0 / 60);
+    }
+    double elapsed = bench_now() - start;
+
+    for (int i=0; i<live; i++) free(bodies[i]);
+    free(bodies);
+    return elapsed;
+}
+
+double bench_churn_pool(int live, int churn, int frames)
+{
+    BodyPool pool = body_pool_new();
+    body_pool_reserve(&pool, live);
+    BodyHandle *handles = malloc(sizeof(BodyHandle) * live);
+    for (int i=0; i<live; i++) handles[i] = body_pool_create(&pool, vec2(i, 0), 1);
+
+    bench_rand_state = 1;
+    double start = bench_now();
+    for (int frame=0; frame < frames; frame++) {
+        for (int k=0; k < churn; k++) {
+            int i = bench_rand() % live;
+            body_pool_destroy(&pool, handles[i]);
+            handles[i] = body_pool_create(&pool, vec2(k, frame), 1);
+        }
+        body_pool_update_all(&pool, 1.0 / 60);
+    }
+    double elapsed = bench_now() - start;
+
+    free(handles);
+    body_pool_free(&pool);
+    return elapsed;
+}
+
+void bench_body_churn()
+{
+    bench_start("body churn");
+
+    const int frames = 200;
+    int lives[] = {1000, 10000, 100000};
+
+    printf("   %-8s %8s %8s %12s %12s %8s\n",
+            "live", "churn", "frames", "malloc ms", "pool ms", "speedup");
+
+    for (int l=0; l < sizeof(lives)/sizeof(int); l++) {
+        int live = lives[l];
+        int churn = live / 10;
+        double t_malloc = bench_churn_malloc(live, churn, frames);
+        double t_pool = bench_churn_pool(live, churn, frames);
+        printf("   %-8d %8d %8d %12.2f %12.2f %7.2fx\n",
+                live, churn, frames, t_malloc * 1e3, t_pool * 1e3, t_malloc / t_pool);
+    }
+}
+
+
+/**
+ * Forces
+ *
+ * Gravity, quadratic drag and an attractor on every body, applied by the
+ * registry in one pass per force against the same forces applied with
+ * body_apply_force per body before body_update.
+ */
+
+double bench_forces_per_body(int n, int steps)
+{
+    Vec2 gravity = vec2(0, 9.8);
+    Vec2 point = vec2(0, 0);
+
+    Body *bodies = malloc(sizeof(Body) * n);
+    for (int i=0; i<n; i++) {
+        body_init(&bodies[i], vec2(i % 100 + 1, i / 100 + 1), 1);
+    }
+
+    double start = bench_now();
+    for (int step=0; step < steps; step++) {
+        for (int i=0; i<n; i++) {
+            Body *body = &bodies[i];
+            body_apply_gravity(body, gravity);
+            body_apply_force(body, drag(body->vel, 0.01, 2));
+
+            Vec2 d = vec2_sub(point, body->pos);
+            p2_real r = max(vec2_mag(d), 1);
+            body_apply_force(body, vec2_set_mag(d, 100 * body->mass / (r * r)));
+
+            body_update(body, 1.0 / 60);
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    free(bodies);
+    return elapsed;
+}
+
+double bench_forces_registry(int n, int steps)
+{
+    BodyStore store = body_store_new();
+    body_store_reserve(&store, n);
+    for (int i=0; i<n; i++) {
+        body_store_add(&store, vec2(i % 100 + 1, i / 100 + 1), 1);
+    }
+    body_store_add_force(&store, force_gravity(vec2(0, 9.8)));
+    body_store_add_force(&store, force_quadratic_drag(0.01));
+    body_store_add_force(&store, force_attractor(vec2(0, 0), 100, 1));
+
+    double start = bench_now();
+    for (int step=0; step < steps; step++) {
+        body_store_update_all(&store, 1.0 / 60);
+    }
+    double elapsed = bench_now() - start;
+
+    body_store_free(&store);
+    return elapsed;
+}
+
+void bench_forces()
+{
+    bench_start("forces");
+
+    const int steps = 100;
+    int counts[] = {1000, 10000, 100000};
+
+    printf("   %-8s %14s %14s %8s\n", "bodies", "per body ns", "registry ns", "speedup");
+
+    for (int c=0; c < sizeof(counts)/sizeof(int); c++) {
+        int n = counts[c];
+        double t_body = bench_forces_per_body(n, steps);
+        double t_registry = bench_forces_registry(n, steps);
+        printf("   %-8d %14.2f %14.2f %7.2fx\n", n,
+                t_body * 1e9 / ((double) n * steps),
+                t_registry * 1e9 / ((double) n * steps),
+                t_body / t_registry);
+    }
+}
+
+
+/**
+ * Random numbers
+ *
+ * Random velocities for 100k particles, libc rand() against rng_fill_vec2.
+ */
+
+void bench_rng()
+{
+    bench_start("random");
+
+    const int n = 100000;
+    const int rounds = 20;
+    Vec2 *vel = malloc(sizeof(Vec2) * n);
+
+    srand(1);
+    double start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i<n; i++) {
+            p2_real div = RAND_MAX / 2.0;
+            vel[i] = vec2(-1 + rand() / div, -1 + rand() / div);
+        }
+    }
+    double t_rand = bench_now() - start;
+
+    Rng rng = rng_new(1, 0);
+    start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        rng_fill_vec2(&rng, vel, n, -1, 1);
+    }
+    double t_rng = bench_now() - start;
+
+    printf("   %-16s %12s\n", "method", "ns/vec2");
+    printf("   %-16s %12.2f\n", "rand()", t_rand * 1e9 / ((double) n * rounds));
+    printf("   %-16s %12.2f\n", "rng_fill_vec2", t_rng * 1e9 / ((double) n * rounds));
+
+    free(vel);
+}
+
+
+/**
+ * Shape collide dispatch
+ *
+ * Cost per pair of the old if chain on (s1.type, s2.type) against the
+ * shape_collide table, over a random mix of all shape type pairs. The
+ * shapes are far apart so the collide functions return early.
+ */
+
+Manifold bench_flip(Manifold c)
+{
+    c.normal = vec2_mult(c.normal, -1);
+    for (int i=0; i < c.count; i++) {
+        c.ids[i] = CONTACT_ID(c.ids[i] & 0xff, c.ids[i] >> 8);
+    }
+    return c;
+}
+
+// The if chain shape_collide used to be, with every pair routed to the
+// right function.
+Manifold bench_shape_collide_chain(Shape s1, Shape s2)
+{
+    if (s1.type == POINT && s2.type == POINT) return point_collide(s1.point, s2.point);
+    if (s1.type == POINT && s2.type == LINE) return gjk_collide_shapes(&s1, &s2);
+    if (s1.type == POINT && s2.type == CIRCLE) return point_collide_circle(s1.point, s2.circle);
+    if (s1.type == POINT && s2.type == RECT) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == POINT && s2.type == TRIANGLE) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == POINT && s2.type == QUAD) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == POINT && s2.type == POLY) return sat_collide_shapes(&s1, &s2);
+
+    if (s1.type == LINE && s2.type == POINT) return bench_flip(gjk_collide_shapes(&s2, &s1));
+    if (s1.type == LINE && s2.type == LINE) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == LINE && s2.type == CIRCLE) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == LINE && s2.type == RECT) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == LINE && s2.type == TRIANGLE) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == LINE && s2.type == QUAD) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == LINE && s2.type == POLY) return sat_collide_shapes(&s1, &s2);
+
+    if (s1.type == CIRCLE && s2.type == POINT) return bench_flip(point_collide_circle(s2.point, s1.circle));
+    if (s1.type == CIRCLE && s2.type == LINE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == CIRCLE && s2.type == CIRCLE) return circle_collide(s1.circle, s2.circle);
+    if (s1.type == CIRCLE && s2.type == RECT) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == CIRCLE && s2.type == TRIANGLE) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == CIRCLE && s2.type == QUAD) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == CIRCLE && s2.type == POLY) return sat_collide_shapes(&s1, &s2);
+
+    if (s1.type == RECT && s2.type == POINT) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == RECT && s2.type == LINE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == RECT && s2.type == CIRCLE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == RECT && s2.type == RECT) return rect_collide(s1.rect, s2.rect);
+    if (s1.type == RECT && s2.type == TRIANGLE) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == RECT && s2.type == QUAD) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == RECT && s2.type == POLY) return sat_collide_shapes(&s1, &s2);
+
+    if (s1.type == TRIANGLE && s2.type == POINT) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == TRIANGLE && s2.type == LINE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == TRIANGLE && s2.type == CIRCLE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == TRIANGLE && s2.type == RECT) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == TRIANGLE && s2.type == TRIANGLE) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == TRIANGLE && s2.type == QUAD) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == TRIANGLE && s2.type == POLY) return sat_collide_shapes(&s1, &s2);
+
+    if (s1.type == QUAD && s2.type == POINT) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == QUAD && s2.type == LINE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == QUAD && s2.type == CIRCLE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == QUAD && s2.type == RECT) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == QUAD && s2.type == TRIANGLE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == QUAD && s2.type == QUAD) return sat_collide_shapes(&s1, &s2);
+    if (s1.type == QUAD && s2.type == POLY) return sat_collide_shapes(&s1, &s2);
+
+    if (s1.type == POLY && s2.type == POINT) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == POLY && s2.type == LINE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == POLY && s2.type == CIRCLE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == POLY && s2.type == RECT) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == POLY && s2.type == TRIANGLE) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == POLY && s2.type == QUAD) return bench_flip(sat_collide_shapes(&s2, &s1));
+    if (s1.type == POLY && s2.type == POLY) return sat_collide_shapes(&s1, &s2);
+    return manifold_miss;
+}
+
+void bench_shape_dispatch()
+{
+    bench_start("shape collide dispatch");
+
+    enum { N = 1024 };
+    const int rounds = 2000;
+    Shape shapes[N];
+    Rng rng = rng_new(3, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2_mult(rng_vec2(&rng), 1000);
+        switch (rng_next_u32(&rng) % SHAPE_TYPE_COUNT) {
+            case POINT: shapes[i] = point(at.x, at.y); break;
+            case LINE: shapes[i] = line(at.x, at.y, at.x + 1, at.y); break;
+            case CIRCLE: shapes[i] = circlev(at, 1); break;
+            case RECT: shapes[i] = rectv(at, 1, 1); break;
+            case TRIANGLE: shapes[i] = trianglev(at, vec2(at.x + 1, at.y), vec2(at.x, at.y + 1)); break;
+            case QUAD: shapes[i] = quadv(at, vec2(at.x + 1, at.y), vec2(at.x + 1, at.y + 1), vec2(at.x, at.y + 1)); break;
+            case POLY: shapes[i] = (Shape){.type = POLY}; break;
+        }
+    }
+
+    int hits = 0;
+    double start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i<N; i++) {
+            hits += bench_shape_collide_chain(shapes[i], shapes[(i + r + 1) % N]).count > 0;
+        }
+    }
+    double t_chain = bench_now() - start;
+
+    start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i<N; i++) {
+            hits -= shape_collide(shapes[i], shapes[(i + r + 1) % N]).count > 0;
+        }
+    }
+    double t_table = bench_now() - start;
+    assert(hits == 0);
+
+    printf("   %-10s %12s\n", "dispatch", "ns/pair");
+    printf("   %-10s %12.2f\n", "if chain", t_chain * 1e9 / ((double) N * rounds));
+    printf("   %-10s %12.2f\n", "table", t_table * 1e9 / ((double) N * rounds));
+}
+
+
+/**
+ * Separating axis cache
+ *
+ * Pairs of polygons drifting past each other, mostly apart, tested every
+ * frame with shape_collide against shape_collide_cached.
+ */
+
+void bench_sat_cache()
+{
+    bench_start("separating axis cache");
+
+    enum { N = 1000 };
+    const int frames = 200;
+    Shape shapes[N][2];
+    Vec2 vel[N];
+    SatCache cache[N] = {0};
+
+    Rng rng = rng_new(4, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2_mult(rng_vec2(&rng), 20);
+        shapes[i][0] = triangle(0, 0, 3, 0, 0, 3);
+        shapes[i][1] = quadv(at, vec2(at.x + 2, at.y), vec2(at.x + 3, at.y + 2), vec2(at.x, at.y + 2));
+        vel[i] = vec2_mult(rng_vec2(&rng), 0.1);
+    }
+
+    int hits_full = 0, hits_cached = 0;
+    double t_full = 0, t_cached = 0;
+    for (int frame=0; frame < frames; frame++) {
+        for (int i=0; i<N; i++) {
+            shapes[i][1] = shape_offset(vel[i], shapes[i][1]);
+        }
+
+        double start = bench_now();
+        for (int i=0; i<N; i++) {
+            hits_full += shape_collide(shapes[i][0], shapes[i][1]).count > 0;
+        }
+        t_full += bench_now() - start;
+
+        start = bench_now();
+        for (int i=0; i<N; i++) {
+            hits_cached += shape_collide_cached(shapes[i][0], shapes[i][1], &cache[i]).count > 0;
+        }
+        t_cached += bench_now() - start;
+    }
+    assert(hits_full == hits_cached);
+
+    printf("   %-10s %12s %10s\n", "test", "ns/pair", "hit rate");
+    printf("   %-10s %12.2f %9.1f%%\n", "full", t_full * 1e9 / ((double) N * frames),
+            100.0 * hits_full / ((double) N * frames));
+    printf("   %-10s %12.2f %9.1f%%\n", "cached", t_cached * 1e9 / ((double) N * frames),
+            100.0 * hits_cached / ((double) N * frames));
+}
+
+
+/**
+ * GJK warm start
+ *
+ * Same drifting pairs as the separating axis cache benchmark, with GJK
+ * from scratch every frame and warm started from the last simplex.
+ */
+
+void bench_gjk()
+{
+    bench_start("gjk warm start");
+
+    enum { N = 1000 };
+    const int frames = 200;
+    Shape shapes[N][2];
+    Vec2 vel[N];
+    GjkCache cache[N] = {0};
+
+    Rng rng = rng_new(4, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2_mult(rng_vec2(&rng), 20);
+        shapes[i][0] = triangle(0, 0, 3, 0, 0, 3);
+        shapes[i][1] = quadv(at, vec2(at.x + 2, at.y), vec2(at.x + 3, at.y + 2), vec2(at.x, at.y + 2));
+        vel[i] = vec2_mult(rng_vec2(&rng), 0.1);
+    }
+
+    long iters_cold = 0, iters_warm = 0;
+    double t_cold = 0, t_warm = 0;
+    for (int frame=0; frame < frames; frame++) {
+        for (int i=0; i<N; i++) {
+            shapes[i][1] = shape_offset(vel[i], shapes[i][1]);
+        }
+
+        double start = bench_now();
+        for (int i=0; i<N; i++) {
+            iters_cold += gjk(&shapes[i][0], &shapes[i][1], NULL).iterations;
+        }
+        t_cold += bench_now() - start;
+
+        start = bench_now();
+        for (int i=0; i<N; i++) {
+            iters_warm += gjk(&shapes[i][0], &shapes[i][1], &cache[i]).iterations;
+        }
+        t_warm += bench_now() - start;
+    }
+
+    double pairs = (double) N * frames;
+    printf("   %-10s %12s %12s\n", "gjk", "ns/pair", "iterations");
+    printf("   %-10s %12.2f %12.2f\n", "cold", t_cold * 1e9 / pairs, iters_cold / pairs);
+    printf("   %-10s %12.2f %12.2f\n", "warm", t_warm * 1e9 / pairs, iters_warm / pairs);
+}
+
+/**
+ * Contact cache
+ *
+ * Boxes jittering on a floor, each frame collided and stored in the
+ * contact cache. Shows what carrying impulses over costs per pair, on top
+ * of the collide itself.
+ */
+
+void bench_contact_cache()
+{
+    bench_start("contact cache");
+
+    enum { N = 10000 };
+    const int frames = 100;
+    Shape floor = rect(-1, 0, 4, 2);
+    Vec2 at[N];
+    ContactCache cache = contact_cache_new();
+
+    Rng rng = rng_new(5, 0);
+    for (int i=0; i<N; i++) {
+        at[i] = vec2(rng_range(&rng, 0, 1), 1.5);
+    }
+
+    long points = 0;
+    double t_collide = 0, t_cached = 0;
+    for (int frame=0; frame < frames; frame++) {
+        for (int i=0; i<N; i++) {
+            at[i].x += rng_range(&rng, -0.01, 0.01);
+        }
+
+        double start = bench_now();
+        for (int i=0; i<N; i++) {
+            points += shape_collide(rectv(at[i], 2, 2), floor).count;
+        }
+        t_collide += bench_now() - start;
+
+        start = bench_now();
+        contact_cache_begin(&cache);
+        for (int i=0; i<N; i++) {
+            Manifold m = shape_collide(rectv(at[i], 2, 2), floor);
+            CachedContact *c = contact_cache_update(&cache, contact_key(i + 1, 0, 0, 0), m);
+            c->normal_impulse[0] += 1;
+        }
+        contact_cache_end(&cache);
+        t_cached += bench_now() - start;
+    }
+    assert(contact_cache_count(&cache) == N);
+    contact_cache_free(&cache);
+
+    double pairs = (double) N * frames;
+    printf("   %-10s %12s %12s\n", "contacts", "ns/pair", "points");
+    printf("   %-10s %12.2f %12.2f\n", "collide", t_collide * 1e9 / pairs, points / pairs);
+    printf("   %-10s %12.2f\n", "cached", t_cached * 1e9 / pairs);
+}
+
+/**
+ * Circle batches
+ *
+ * circle_collide one pair at a time against circle_collide_n at every SIMD
+ * level, on pairs from a broadphase where about one in ten hits.
+ */
+
+void bench_circle_batch()
+{
+    bench_start("circle batch");
+
+    enum { N = 4096 };
+    const int rounds = 500;
+    static p2_real x1[N], y1[N], r1[N], x2[N], y2[N], r2[N];
+    static p2_real nx[N], ny[N], depth[N];
+    static uint64_t mask[N / 64];
+
+    Rng rng = rng_new(6, 0);
+    for (int i=0; i<N; i++) {
+        x1[i] = rng_range(&rng, 0, 10);
+        y1[i] = rng_range(&rng, 0, 10);
+        r1[i] = r2[i] = 1;
+        Vec2 d = vec2_mult(rng_vec2(&rng), rng_range(&rng, 0, 30));
+        x2[i] = x1[i] + d.x;
+        y2[i] = y1[i] + d.y;
+    }
+
+    long hits = 0;
+    double start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i<N; i++) {
+            Manifold m = circle_collide((Circle){{x1[i], y1[i]}, r1[i]}, (Circle){{x2[i], y2[i]}, r2[i]});
+            depth[i] = m.depth;
+            hits += m.count;
+        }
+    }
+    double t_single = bench_now() - start;
+    double pairs = (double) N * rounds;
+
+    printf("   %-10s %12s %12s\n", "circles", "ns/pair", "hit rate");
+    printf("   %-10s %12.2f %11.1f%%\n", "one", t_single * 1e9 / pairs, 100.0 * hits / pairs);
+
+    CirclePairs batch = {x1, y1, r1, x2, y2, r2, N};
+    CircleHits out = {mask, nx, ny, depth};
+    SimdLevel levels[] = {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NEON};
+    SimdLevel best = simd_level();
+    for (int l=0; l < sizeof(levels)/sizeof(SimdLevel); l++) {
+        if (simd_set_level(levels[l]) != levels[l]) continue;
+
+        long batch_hits = 0;
+        start = bench_now();
+        for (int r=0; r < rounds; r++) {
+            batch_hits += circle_collide_n(&batch, &out);
+        }
+        double t = bench_now() - start;
+        assert(batch_hits == hits);
+        printf("   %-10s %12.2f\n", simd_level_name(levels[l]), t * 1e9 / pairs);
+    }
+    simd_set_level(best);
+}
+
+/**
+ * Collider contacts
+ *
+ * Compound colliders of 20 shapes, overlapping at one end. All contacts
+ * the old way, moving both shapes inside the double loop and testing every
+ * pair, against collider_collide.
+ */
+
+void bench_collider_collide()
+{
+    bench_start("collider collide");
+
+    enum { SHAPES = 20, MAX_CONTACTS = SHAPES * SHAPES };
+    const int rounds = 20000;
+
+    Collider c = {0};
+    Rng rng = rng_new(7, 0);
+    for (int i=0; i<SHAPES; i++) {
+        Vec2 at = vec2(i * 1.5, rng_range(&rng, -1, 1));
+        switch (i % 3) {
+            case 0: collider_add_shape(c, circlev(at, 1)); break;
+            case 1: collider_add_shape(c, rectv(at, 1.5, 1)); break;
+            case 2: collider_add_shape(c, trianglev(at, vec2(at.x + 1, at.y), vec2(at.x, at.y + 1))); break;
+        }
+    }
+    Vec2 pos2 = vec2(SHAPES * 1.5 - 4, 0.5);
+
+    static ColliderContact contacts[MAX_CONTACTS];
+    long found_old = 0;
+    double start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        int count = 0;
+        for (int i=0; i<collider_count(&c); i++) {
+            for (int j=0; j<collider_count(&c); j++) {
+                Shape s1 = shape_offset(vec2zero, c.shapes[i]);
+                Shape s2 = shape_offset(pos2, c.shapes[j]);
+                Manifold m = shape_collide(s1, s2);
+                if (m.count > 0) contacts[count++] = (ColliderContact){m, i, j};
+            }
+        }
+        found_old += count;
+    }
+    double t_old = bench_now() - start;
+
+    long found_new = 0;
+    start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        found_new += collider_collide(vec2zero, &c, pos2, &c, contacts, MAX_CONTACTS);
+    }
+    double t_new = bench_now() - start;
+    assert(found_old == found_new);
+
+    printf("   %-10s %12s %12s\n", "collider", "us/query", "contacts");
+    printf("   %-10s %12.3f %12.1f\n", "all pairs", t_old * 1e6 / rounds, (double) found_old / rounds);
+    printf("   %-10s %12.3f\n", "culled", t_new * 1e6 / rounds);
+
+    collider_free(c);
+}
+
+/**
+ * Shape cache
+ *
+ * A step of 200 objects with 4 shapes each, where one in ten moves, and
+ * every pair is tested. collider_collide moves the shapes per pair, the
+ * shape cache once per moved object.
+ */
+
+void bench_shape_cache()
+{
+    bench_start("shape cache");
+
+    enum { N = 200 };
+    const int steps = 50;
+    static Collider colliders[N];
+    static const Collider *ptrs[N];
+    static Vec2 pos[N];
+    static ColliderContact contacts[64];
+
+    Rng rng = rng_new(8, 0);
+    for (int i=0; i<N; i++) {
+        colliders[i] = (Collider){0};
+        collider_add_shape(colliders[i], circle(0, 0, 1));
+        collider_add_shape(colliders[i], rect(-1, -2, 2, 1));
+        collider_add_shape(colliders[i], triangle(1, 0, 2, 0, 1, 1));
+        collider_add_shape(colliders[i], quad(-2, 0, -1, 0, -1, 1, -2, 1));
+        ptrs[i] = &colliders[i];
+        pos[i] = vec2(rng_range(&rng, 0, 20), rng_range(&rng, 0, 20));
+    }
+
+    ShapeCache cache = {0};
+    long found_pair = 0, found_cache = 0, placed = 0;
+    double t_pair = 0, t_cache = 0;
+    for (int step=0; step < steps; step++) {
+        for (int i=0; i < N / 10; i++) {
+            int k = rng_next_u32(&rng) % N;
+            pos[k] = vec2_add(pos[k], vec2(rng_range(&rng, -1, 1), rng_range(&rng, -1, 1)));
+        }
+
+        double start = bench_now();
+        for (int a=0; a<N; a++) {
+            for (int b=a+1; b<N; b++) {
+                found_pair += collider_collide(pos[a], &colliders[a], pos[b], &colliders[b], contacts, 64);
+            }
+        }
+        t_pair += bench_now() - start;
+
+        start = bench_now();
+        placed += shape_cache_update(&cache, ptrs, pos, N);
+        for (int a=0; a<N; a++) {
+            for (int b=a+1; b<N; b++) {
+                found_cache += shape_cache_collide(&cache, a, b, contacts, 64);
+            }
+        }
+        t_cache += bench_now() - start;
+    }
+    assert(found_pair == found_cache);
+
+    printf("   %-10s %12s %12s\n", "shapes", "us/step", "placed");
+    printf("   %-10s %12.2f\n", "per pair", t_pair * 1e6 / steps);
+    printf("   %-10s %12.2f %12.1f\n", "cache", t_cache * 1e6 / steps, (double) placed / steps);
+
+    for (int i=0; i<N; i++) collider_free(colliders[i]);
+    shape_cache_free(&cache);
+}
+
+
+/**
+ * Polygons
+ *
+ * Making hexagons the old way, a malloc'd vertex array freed after, against
+ * polyv with the vertices inline, which also works out the normals and the
+ * centroid. Then moving polys and colliding them with a pentagon, an inline
+ * hexagon and an arena 24-gon, which is moved by offset.
+ */
+
+void bench_poly()
+{
+    bench_start("poly");
+
+    enum { N = 1024 };
+    const int rounds = 2000;
+    static Vec2 at[N];
+
+    Rng rng = rng_new(9, 0);
+    for (int i=0; i<N; i++) at[i] = vec2(rng_range(&rng, -4, 4), rng_range(&rng, -4, 4));
+
+    Vec2 hexagon[6], round[24];
+    for (int i=0; i<6; i++) hexagon[i] = vec2(cos(i * M_PI / 3), sin(i * M_PI / 3));
+    for (int i=0; i<24; i++) round[i] = vec2(cos(i * M_PI / 12), sin(i * M_PI / 12));
+
+    double sum = 0;
+    double start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i<N; i++) {
+            Vec2 *v = (Vec2*) malloc(sizeof(Vec2) * 6);
+            for (int j=0; j<6; j++) v[j] = vec2_add(hexagon[j], at[i]);
+            sum += v[i % 6].x;
+            free(v);
+        }
+    }
+    double t_malloc = bench_now() - start;
+
+    start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        for (int i=0; i<N; i++) {
+            Shape s = polyv(hexagon, 6);
+            sum += s.poly.centroid.x + s.poly.normals[i % 6].x;
+        }
+    }
+    double t_inline = bench_now() - start;
+
+    PolyArena arena = {0};
+    Shape pentagon = poly(5, vec2(0, -2), vec2(2, -0.5), vec2(1.2, 2), vec2(-1.2, 2), vec2(-2, -0.5));
+    Shape shapes[] = {polyv(hexagon, 6), poly_in_arena(&arena, round, 24)};
+    double t_collide[2];
+    long hits[2] = {0};
+    for (int k=0; k<2; k++) {
+        start = bench_now();
+        for (int r=0; r < rounds; r++) {
+            for (int i=0; i<N; i++) {
+                Shape moved = shape_offset(at[i], shapes[k]);
+                hits[k] += shape_collide(moved, pentagon).count > 0;
+            }
+        }
+        t_collide[k] = bench_now() - start;
+    }
+    assert(sum != 0);
+
+    double pairs = (double) rounds * N;
+    printf("   %-10s %12s %12s\n", "poly", "ns/poly", "hit rate");
+    printf("   %-10s %12.2f\n", "malloc", t_malloc * 1e9 / pairs);
+    printf("   %-10s %12.2f\n", "inline", t_inline * 1e9 / pairs);
+    printf("   %-10s %12.2f %12.2f\n", "collide 6", t_collide[0] * 1e9 / pairs, hits[0] / pairs);
+    printf("   %-10s %12.2f %12.2f\n", "collide 24", t_collide[1] * 1e9 / pairs, hits[1] / pairs);
+
+    poly_arena_free(&arena);
+}
+
+
+/**
+ * Grid broadphase
+ *
+ * 20000 circles of radius 0.5 to 2 in a square where they cover about a
+ * third of it. Finding the overlapping boxes by testing every pair, once,
+ * against the grid with the cell size picked from the boxes.
+ */
+
+void bench_grid()
+{
+    bench_start("grid");
+
+    enum { N = 20000 };
+    const int rounds = 20;
+    static AABB boxes[N];
+
+    Rng rng = rng_new(12, 0);
+    for (int i=0; i<N; i++) {
+        Shape c = circlev(vec2(rng_range(&rng, 0, 400), rng_range(&rng, 0, 400)), rng_range(&rng, 0.5, 2));
+        boxes[i] = shape_aabb(c);
+    }
+
+    long found_all = 0;
+    double start = bench_now();
+    for (int i=0; i<N; i++) {
+        for (int j=i+1; j<N; j++) {
+            found_all += aabb_overlap(boxes[i], boxes[j]);
+        }
+    }
+    double t_all = bench_now() - start;
+
+    Grid grid = {0};
+    long found_grid = 0;
+    start = bench_now();
+    for (int r=0; r < rounds; r++) {
+        found_grid += grid_update(&grid, boxes, N);
+    }
+    double t_grid = (bench_now() - start) / rounds;
+    assert(found_grid == found_all * rounds);
+
+    printf("   %-10s %12s %12s\n", "pairs", "ms/update", "found");
+    printf("   %-10s %12.2f %12ld\n", "all pairs", t_all * 1e3, found_all);
+    printf("   %-10s %12.2f %12d\n", "grid", t_grid * 1e3, (int) arrlen(grid.pairs));
+    printf("   %-10s %12.2f\n", "cell", grid.cell);
+
+    grid_free(&grid);
+}
+
+
+/**
+ * AABB tree broadphase
+ *
+ * 20000 boxes, most about 1 across and one in twenty up to 60, where no
+ * one cell size fits. Steps where one in ten boxes moves a little, then
+ * steps where nothing moves, through the grid and the tree.
+ */
+
+void bench_aabb_tree()
+{
+    bench_start("aabb tree");
+
+    enum { N = 20000 };
+    const int steps = 20;
+    static AABB start_boxes[N], boxes[N];
+
+    Rng rng = rng_new(14, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, 0, 600), rng_range(&rng, 0, 600));
+        p2_real size = i % 20 == 0 ? rng_range(&rng, 10, 60) : rng_range(&rng, 0.5, 2);
+        start_boxes[i] = (AABB){at, vec2_add(at, vec2(size, size))};
+    }
+
+    const char *names[] = {"grid", "tree"};
+    printf("   %-10s %12s %12s %12s\n", "broadphase", "ms moving", "ms resting", "pairs");
+    for (int type=BROADPHASE_GRID; type<=BROADPHASE_TREE; type++) {
+        Broadphase bp = {.type = type};
+        memcpy(boxes, start_boxes, sizeof(boxes));
+        Rng moves = rng_new(15, 0);
+        broadphase_update(&bp, boxes, N);
+
+        double start = bench_now();
+        for (int step=0; step < steps; step++) {
+            for (int i=0; i < N / 10; i++) {
+                int k = rng_next_u32(&moves) % N;
+                boxes[k] = aabb_offset(boxes[k], vec2(rng_range(&moves, -0.5, 0.5), rng_range(&moves, -0.5, 0.5)));
+            }
+            broadphase_update(&bp, boxes, N);
+        }
+        double t_moving = bench_now() - start;
+
+        start = bench_now();
+        int pairs = 0;
+        for (int step=0; step < steps; step++) {
+            pairs = broadphase_update(&bp, boxes, N);
+        }
+        double t_resting = bench_now() - start;
+
+        printf("   %-10s %12.2f %12.2f %12d\n", names[type],
+                t_moving * 1e3 / steps, t_resting * 1e3 / steps, pairs);
+        broadphase_free(&bp);
+    }
+}
+
+
+/**
+ * Sweep and prune broadphase
+ *
+ * A side scroller, 20000 bodies about 1 across spread along a level 20000
+ * long and 20 high. Every body moves a little each step, through each of
+ * the broadphases, with how many pairs the sweep adds and removes.
+ */
+
+void bench_sweep_prune()
+{
+    bench_start("sweep and prune");
+
+    enum { N = 20000 };
+    const int steps = 50;
+    static AABB start_boxes[N], boxes[N];
+
+    Rng rng = rng_new(17, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, 0, 20000), rng_range(&rng, 0, 20));
+        p2_real size = rng_range(&rng, 0.5, 2);
+        start_boxes[i] = (AABB){at, vec2_add(at, vec2(size, size))};
+    }
+
+    const char *names[] = {"grid", "tree", "sap"};
+    printf("   %-10s %12s %12s %12s\n", "broadphase", "ms/step", "pairs", "deltas");
+    for (int type=BROADPHASE_GRID; type<=BROADPHASE_SAP; type++) {
+        Broadphase bp = {.type = type};
+        memcpy(boxes, start_boxes, sizeof(boxes));
+        Rng moves = rng_new(18, 0);
+        broadphase_update(&bp, boxes, N);
+
+        double t = 0;
+        long pairs = 0, deltas = 0;
+        for (int step=0; step < steps; step++) {
+            for (int i=0; i<N; i++) {
+                boxes[i] = aabb_offset(boxes[i], vec2(rng_range(&moves, -0.1, 0.1), rng_range(&moves, -0.1, 0.1)));
+            }
+            double start = bench_now();
+            pairs += broadphase_update(&bp, boxes, N);
+            t += bench_now() - start;
+            deltas += arrlen(bp.sap.added) + arrlen(bp.sap.removed);
+        }
+
+        printf("   %-10s %12.2f %12.1f", names[type], t * 1e3 / steps, (double) pairs / steps);
+        if (type == BROADPHASE_SAP) printf(" %12.1f", (double) deltas / steps);
+        printf("\n");
+        broadphase_free(&bp);
+    }
+}
+
+
+/**
+ * LBVH broadphase
+ *
+ * 100000 particles about 1 across in a square, all moving every step, the
+ * case incremental structures are worst at. The grid, the tree and the
+ * LBVH built again each step. Run with make bench-openmp for the parallel
+ * LBVH.
+ */
+
+void bench_lbvh()
+{
+    bench_start("lbvh");
+
+    enum { N = 100000 };
+    const int steps = 10;
+    static AABB start_boxes[N], boxes[N];
+
+    Rng rng = rng_new(20, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, 0, 1000), rng_range(&rng, 0, 1000));
+        p2_real size = rng_range(&rng, 0.5, 2);
+        start_boxes[i] = (AABB){at, vec2_add(at, vec2(size, size))};
+    }
+
+    const char *names[] = {"grid", "tree", "sap", "lbvh"};
+    BroadphaseType types[] = {BROADPHASE_GRID, BROADPHASE_TREE, BROADPHASE_LBVH};
+    printf("   %-10s %12s %12s   threads %d\n", "broadphase", "ms/step", "pairs", p2_threads());
+    for (int k=0; k < sizeof(types)/sizeof(types[0]); k++) {
+        Broadphase bp = {.type = types[k]};
+        memcpy(boxes, start_boxes, sizeof(boxes));
+        Rng moves = rng_new(21, 0);
+        broadphase_update(&bp, boxes, N);
+
+        double t = 0;
+        long pairs = 0;
+        for (int step=0; step < steps; step++) {
+            for (int i=0; i<N; i++) {
+                boxes[i] = aabb_offset(boxes[i], vec2(rng_range(&moves, -1, 1), rng_range(&moves, -1, 1)));
+            }
+            double start = bench_now();
+            pairs += broadphase_update(&bp, boxes, N);
+            t += bench_now() - start;
+        }
+
+        printf("   %-10s %12.2f %12.1f\n", names[types[k]], t * 1e3 / steps, (double) pairs / steps);
+        broadphase_free(&bp);
+    }
+}
+
+/**
+ * Static tree
+ *
+ * A level of 20000 tiles that touch their neighbours and 2000 bodies moving
+ * over it. Tiles in the same broadphase as the bodies, where every step
+ * finds the tile pairs too, against the bodies alone in a grid and each
+ * body querying a static tree built once.
+ */
+
+void bench_static_tree()
+{
+    bench_start("static tree");
+
+    enum { W = 200, H = 100, TILES = W * H, BODIES = 2000, N = TILES + BODIES };
+    const int steps = 20;
+    static AABB boxes[N], start_bodies[BODIES];
+    static int hits[TILES];
+
+    for (int i=0; i<TILES; i++) {
+        Vec2 at = vec2((i % W) * 5, (i / W) * 5);
+        boxes[i] = (AABB){at, vec2_add(at, vec2(5, 5))};
+    }
+    Rng rng = rng_new(24, 0);
+    AABB *bodies = boxes + TILES;
+    for (int i=0; i<BODIES; i++) {
+        Vec2 at = vec2(rng_range(&rng, 0, W * 5), rng_range(&rng, 0, H * 5));
+        start_bodies[i] = (AABB){at, vec2_add(at, vec2(3, 3))};
+    }
+
+    StaticTree tree = {0};
+    double start = bench_now();
+    static_tree_build(&tree, boxes, TILES);
+    double build = bench_now() - start;
+
+    printf("   %-10s %12s %12s %12s\n", "statics", "ms/step", "pairs", "build ms");
+    for (int split=0; split<2; split++) {
+        Broadphase bp = {0};
+        memcpy(bodies, start_bodies, sizeof(start_bodies));
+        Rng moves = rng_new(25, 0);
+        double t = 0;
+        long pairs = 0;
+        for (int step=0; step < steps; step++) {
+            for (int i=0; i<BODIES; i++) {
+                bodies[i] = aabb_offset(bodies[i], vec2(rng_range(&moves, -1, 1), rng_range(&moves, -1, 1)));
+            }
+            start = bench_now();
+            if (!split) {
+                // Skip the tile pairs like the world skips zero mass pairs
+                int n;
+                broadphase_update(&bp, boxes, N);
+                const BodyPair *found = broadphase_pairs(&bp, &n);
+                for (int k=0; k<n; k++) pairs += found[k].b >= TILES;
+            } else {
+                pairs += broadphase_update(&bp, bodies, BODIES);
+                for (int i=0; i<BODIES; i++) {
+                    pairs += static_tree_query(&tree, bodies[i], hits, TILES);
+                }
+            }
+            t += bench_now() - start;
+        }
+
+        printf("   %-10s %12.2f %12.1f %12.2f\n", split ? "tree" : "broadphase",
+                t * 1e3 / steps, (double) pairs / steps, split ? build * 1e3 : 0);
+        broadphase_free(&bp);
+    }
+    static_tree_free(&tree);
+}
+
+
+int main()
+{
+    all_bench_start();
+
+    bench_integrators();
+    bench_body_churn();
+    bench_forces();
+    bench_rng();
+    bench_shape_dispatch();
+    bench_sat_cache();
+    bench_gjk();
+    bench_contact_cache();
+    bench_circle_batch();
+    bench_collider_collide();
+    bench_shape_cache();
+    bench_poly();
+    bench_grid();
+    bench_aabb_tree();
+    bench_sweep_prune();
+    bench_lbvh();
+    bench_static_tree();
+
+    all_bench_done();
+
+    return 0;
+}
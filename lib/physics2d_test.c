@@ -186,6 +186,42 @@ void test_vec2_sub()
     test_passed();
 }
 
+void test_vec2_lerp()
+{
+    test_start("vec2_lerp");
+
+    typedef struct {
+        Vec2 a;
+        Vec2 b;
+        double amount;
+        Vec2 want;
+    } test;
+
+    test tests[] =  {
+        {.a=vec2(0.0, 0.0), .b=vec2(4.0, 8.0), .amount=0.5, .want=vec2(2.0, 4.0)},
+        {.a=vec2(1.0, -1.0), .b=vec2(3.0, 9.0), .amount=0.0, .want=vec2(1.0, -1.0)},
+        {.a=vec2(1.0, -1.0), .b=vec2(3.0, 9.0), .amount=1.0, .want=vec2(3.0, 9.0)},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        Vec2 got = vec2_lerp(t.a, t.b, t.amount);
+        assert(vec2_equalp(got, t.want, 2));
+    }
+
+    // Drawing a body between updates
+    Body body;
+    body_init(&body, vec2(10.0, 0.0), 1.0);
+    body.vel = vec2(4.0, 0.0);
+    body_update(&body, 1.0);
+    assert(vec2_equalp(body_lerp_pos(&body, 0.25), vec2(11.0, 0.0), 2));
+
+    body_set_pos(&body, vec2(-5.0, 5.0));
+    assert(vec2_equalp(body_lerp_pos(&body, 0.25), vec2(-5.0, 5.0), 2));
+
+    test_passed();
+}
+
 void test_rect_to_quad()
 {
     test_start("rect_to_quad");
@@ -210,7 +246,1796 @@ void test_rect_to_quad()
     test_passed();
 }
 
+void test_vec2_array()
+{
+    test_start("vec2_array");
+
+    enum { N = 37 };
+    Vec2 a[N], b[N], got[N];
+    for (int i=0; i < N; i++) {
+        a[i] = vec2((i * 7 % 23) - 11.5, (i * 13 % 17) - 8.25);
+        b[i] = vec2((i * 5 % 19) - 9.0, (i * 3 % 11) * 0.5);
+    }
+    a[0] = vec2zero;
+    a[1] = vec2(3.0, 4.0);
+
+    SimdLevel levels[] = {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NEON};
+    SimdLevel best = simd_level();
+
+    for (int l=0; l < sizeof(levels)/sizeof(SimdLevel); l++) {
+        if (simd_set_level(levels[l]) != levels[l]) continue;
+
+        vec2_add_n(got, a, b, N);
+        for (int i=0; i < N; i++) assert(vec2_equalp(got[i], vec2_add(a[i], b[i]), 4));
+
+        vec2_sub_n(got, a, b, N);
+        for (int i=0; i < N; i++) assert(vec2_equalp(got[i], vec2_sub(a[i], b[i]), 4));
+
+        vec2_mult_n(got, a, -2.5, N);
+        for (int i=0; i < N; i++) assert(vec2_equalp(got[i], vec2_mult(a[i], -2.5), 4));
+
+        vec2_add_scaled_n(got, a, b, 0.25, N);
+        for (int i=0; i < N; i++) {
+            assert(vec2_equalp(got[i], vec2_add(a[i], vec2_mult(b[i], 0.25)), 4));
+        }
+
+        vec2_normalize_n(got, a, N);
+        for (int i=0; i < N; i++) assert(vec2_equalp(got[i], vec2_normalize(a[i]), 4));
+
+        vec2_set_mag_n(got, a, 3.0, N);
+        for (int i=0; i < N; i++) assert(vec2_equalp(got[i], vec2_set_mag(a[i], 3.0), 4));
+
+        vec2_limit_n(got, a, 5.0, N);
+        for (int i=0; i < N; i++) assert(vec2_equalp(got[i], vec2_limit(a[i], 5.0), 4));
+
+        // In place
+        for (int i=0; i < N; i++) got[i] = a[i];
+        vec2_limit_n(got, got, 2.0, N);
+        for (int i=0; i < N; i++) assert(vec2_equalp(got[i], vec2_limit(a[i], 2.0), 4));
+    }
+
+    simd_set_level(best);
+    test_passed();
+}
+
+void test_body_store()
+{
+    test_start("body_store");
+
+    typedef struct {
+        Vec2 pos;
+        Vec2 vel;
+        Vec2 force;
+        double mass;
+        double max_speed;
+    } test;
+
+    test tests[] =  {
+        {.pos=vec2(0.0, 0.0), .vel=vec2(1.0, 2.0), .force=vec2(10.0, 0.0), .mass=2.0, .max_speed=-1},
+        {.pos=vec2(5.0, -3.0), .vel=vec2(0.0, 0.0), .force=vec2(0.0, -4.0), .mass=1.0, .max_speed=-1},
+        {.pos=vec2(1.0, 1.0), .vel=vec2(30.0, 40.0), .force=vec2(100.0, 100.0), .mass=4.0, .max_speed=10},
+        {.pos=vec2(2.0, 7.0), .vel=vec2(-3.0, 0.5), .force=vec2(7.0, 7.0), .mass=0.0, .max_speed=-1},
+    };
+    int n = sizeof(tests)/sizeof(test);
+
+    BodyStore store = body_store_new();
+    Body bodies[sizeof(tests)/sizeof(test)];
+
+    for (int i=0; i < n; i++) {
+        test t = tests[i];
+        body_init(&bodies[i], t.pos, t.mass);
+        bodies[i].vel = t.vel;
+        bodies[i].max_speed = t.max_speed;
+        BodyId id = body_store_push(&store, bodies[i]);
+        assert(id == i);
+    }
+    assert(body_store_count(&store) == n);
+
+    for (int step=0; step < 10; step++) {
+        for (int i=0; i < n; i++) {
+            body_apply_force(&bodies[i], tests[i].force);
+            body_store_apply_force(&store, i, tests[i].force);
+            body_update(&bodies[i], 0.1);
+        }
+        body_store_update_all(&store, 0.1);
+    }
+
+    for (int i=0; i < n; i++) {
+        Body got = body_store_get(&store, i);
+        assert(vec2_equalp(got.pos, bodies[i].pos, 2));
+        assert(vec2_equalp(got.vel, bodies[i].vel, 2));
+        assert(vec2_equal(got.acc, vec2zero));
+    }
+
+    body_store_set_pos(&store, 1, vec2(9.0, 9.0));
+    assert(vec2_equal(body_store_pos(&store, 1), vec2(9.0, 9.0)));
+
+    body_store_remove(&store, 0);
+    assert(body_store_count(&store) == n-1);
+    assert(vec2_equalp(body_store_pos(&store, 0), bodies[n-1].pos, 2));
+
+    body_store_free(&store);
+    test_passed();
+}
+// Spring pulling every body to the origin, a = -x
+void spring_accel(const BodyStore *store, void *ctx,
+        const p2_real *pos_x, const p2_real *pos_y,
+        const p2_real *vel_x, const p2_real *vel_y,
+        p2_real *acc_x, p2_real *acc_y)
+{
+    for (int i=0; i < body_store_count(store); i++) {
+        acc_x[i] = -pos_x[i];
+        acc_y[i] = -pos_y[i];
+    }
+}
+
+void test_integrators()
+{
+    test_start("integrators");
+
+    typedef struct {
+        Integrator integrator;
+        // Constant acceleration is exact for second order and above
+        bool exact;
+        // Allowed error after one spring period
+        double spring_error;
+    } test;
+
+    test tests[] =  {
+        {.integrator=INTEGRATOR_EULER, .exact=false, .spring_error=0.2},
+        {.integrator=INTEGRATOR_VERLET, .exact=true, .spring_error=0.02},
+        {.integrator=INTEGRATOR_RK4, .exact=true, .spring_error=0.0001},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        double dt = 1.0 / 30;
+
+        // Constant force
+        BodyStore store = body_store_new();
+        store.integrator = t.integrator;
+        body_store_add(&store, vec2(1.0, 2.0), 2.0);
+        body_store_set_vel(&store, 0, vec2(3.0, 0.0));
+        for (int step=0; step < 30; step++) {
+            body_store_apply_force(&store, 0, vec2(0.0, 20.0));
+            body_store_update_all(&store, dt);
+        }
+        // x = x0 + v t + a t^2 / 2, at t = 1
+        Vec2 want = vec2(1.0 + 3.0, 2.0 + 5.0);
+        assert(vec2_equalp(body_store_pos(&store, 0), want, 4) == t.exact);
+        assert(vec2_equalp(body_store_vel(&store, 0), vec2(3.0, 10.0), 4));
+        body_store_free(&store);
+
+        // Spring, one period is 2 pi
+        store = body_store_new();
+        store.integrator = t.integrator;
+        store.accel = spring_accel;
+        body_store_add(&store, vec2(1.0, 0.0), 1.0);
+        int steps = 2 * M_PI / dt;
+        for (int step=0; step < steps; step++) {
+            body_store_update_all(&store, dt);
+        }
+        // Finish the period with the remaining fraction of a step
+        body_store_update_all(&store, 2 * M_PI - steps * dt);
+        Vec2 pos = body_store_pos(&store, 0);
+        assert(vec2_mag(vec2_sub(pos, vec2(1.0, 0.0))) < t.spring_error);
+        body_store_free(&store);
+    }
+    test_passed();
+}
+
+void test_sleep()
+{
+    test_start("sleep");
+
+    double dt = 1.0 / 60;
+    double time_to_sleep = 0.5;
+
+    Body ground, a, b, c;
+    body_init(&ground, vec2(0.0, 10.0), 0);
+    body_init(&a, vec2(0.0, 0.0), 1);
+    body_init(&b, vec2(1.0, 0.0), 1);
+    body_init(&c, vec2(5.0, 0.0), 1);
+    Body *bodies[] = {&ground, &a, &b, &c};
+    BodyPair contacts[] = {{0, 1}, {0, 2}, {1, 2}};
+    int *scratch = NULL;
+
+    // Only c is moving, so the a-b island falls asleep and c stays awake
+    c.vel = vec2(10.0, 0.0);
+    for (int step=0; step < 40; step++) {
+        bodies_update_sleep(bodies, 4, contacts, 3, time_to_sleep, dt, &scratch);
+    }
+    assert(a.sleeping && b.sleeping);
+    assert(a.island == b.island);
+    assert(!c.sleeping);
+    assert(!ground.sleeping);
+
+    // Sleeping bodies do not move
+    body_apply_gravity(&a, vec2(0.0, 10.0));
+    body_update(&a, dt);
+    assert(vec2_equal(a.pos, vec2(0.0, 0.0)));
+    assert(a.sleeping);
+
+    // c moves into b and wakes the whole island
+    BodyPair hit[] = {{2, 3}};
+    bodies_update_sleep(bodies, 4, hit, 1, time_to_sleep, dt, &scratch);
+    assert(!a.sleeping && !b.sleeping && !c.sleeping);
+
+    // A force wakes a single body
+    for (int step=0; step < 40; step++) {
+        bodies_update_sleep(bodies, 4, contacts, 3, time_to_sleep, dt, &scratch);
+    }
+    assert(a.sleeping);
+    body_apply_force(&a, vec2(1.0, 0.0));
+    assert(!a.sleeping);
+
+    // Negative sleep speed never sleeps
+    Body d;
+    body_init(&d, vec2(0.0, 0.0), 1);
+    d.sleep_speed = -1;
+    Body *one[] = {&d};
+    for (int step=0; step < 40; step++) {
+        bodies_update_sleep(one, 1, NULL, 0, time_to_sleep, dt, &scratch);
+    }
+    assert(!d.sleeping);
+    arrfree(scratch);
+
+    test_passed();
+}
+
+void test_body_pool()
+{
+    test_start("body_pool");
+
+    BodyPool pool = body_pool_new();
+
+    BodyHandle handles[8];
+    for (int i=0; i < 8; i++) {
+        handles[i] = body_pool_create(&pool, vec2(i, 0.0), 1);
+        assert(handles[i] != BODY_HANDLE_NONE);
+    }
+    assert(body_pool_count(&pool) == 8);
+
+    // Destroying moves the last body, handles still find the right body
+    assert(body_pool_destroy(&pool, handles[2]));
+    assert(body_pool_destroy(&pool, handles[5]));
+    assert(body_pool_count(&pool) == 6);
+    for (int i=0; i < 8; i++) {
+        Body *body = body_pool_get(&pool, handles[i]);
+        if (i == 2 || i == 5) {
+            assert(body == NULL);
+            assert(!body_pool_valid(&pool, handles[i]));
+        } else {
+            assert(body != NULL);
+            assert(body->pos.x == i);
+        }
+    }
+
+    // Destroying twice fails
+    assert(!body_pool_destroy(&pool, handles[2]));
+
+    // Reused slots get a new generation, the old handle stays stale
+    BodyHandle reused = body_pool_create(&pool, vec2(100.0, 0.0), 1);
+    assert(reused != handles[2] && reused != handles[5]);
+    assert((reused & BODY_HANDLE_INDEX_MASK) == (handles[5] & BODY_HANDLE_INDEX_MASK));
+    assert(body_pool_get(&pool, handles[5]) == NULL);
+    assert(body_pool_get(&pool, reused)->pos.x == 100.0);
+
+    // Dense iteration covers every live body once
+    double sum = 0;
+    for (int i=0; i < body_pool_count(&pool); i++) {
+        assert(body_pool_get(&pool, body_pool_handle(&pool, i)) == &pool.bodies[i]);
+        sum += pool.bodies[i].pos.x;
+    }
+    assert(sum == 0 + 1 + 3 + 4 + 6 + 7 + 100);
+
+    body_pool_get(&pool, handles[0])->vel = vec2(1.0, 0.0);
+    body_pool_update_all(&pool, 0.5);
+    assert(body_pool_get(&pool, handles[0])->pos.x == 0.5);
+
+    assert(body_pool_get(&pool, BODY_HANDLE_NONE) == NULL);
+
+    body_pool_free(&pool);
+    test_passed();
+}
+
+void test_forces()
+{
+    test_start("forces");
+
+    typedef struct {
+        ForceGen force;
+        Vec2 pos;
+        Vec2 vel;
+        double mass;
+        // Acceleration the force gives the body
+        Vec2 acc;
+    } test;
+
+    test tests[] =  {
+        {.force=force_gravity(vec2(0.0, 10.0)), .vel=vec2(1.0, 0.0), .mass=2.0, .acc=vec2(0.0, 10.0)},
+        {.force=force_gravity(vec2(0.0, 10.0)), .vel=vec2(1.0, 0.0), .mass=0.0, .acc=vec2(0.0, 0.0)},
+        {.force=force_linear_drag(0.5), .vel=vec2(4.0, -2.0), .mass=2.0, .acc=vec2(-1.0, 0.5)},
+        {.force=force_quadratic_drag(0.5), .vel=vec2(3.0, 4.0), .mass=1.0, .acc=vec2(-7.5, -10.0)},
+        {.force=force_friction(0.5, 8.0), .vel=vec2(0.0, -2.0), .mass=2.0, .acc=vec2(0.0, 2.0)},
+        {.force=force_friction(0.5, 8.0), .vel=vec2(0.0, 0.0), .mass=2.0, .acc=vec2(0.0, 0.0)},
+        {.force=force_attractor(vec2(0.0, 0.0), 8.0, 1.0), .pos=vec2(2.0, 0.0), .mass=3.0, .acc=vec2(-2.0, 0.0)},
+        {.force=force_attractor(vec2(0.0, 0.0), 8.0, 4.0), .pos=vec2(0.0, 2.0), .mass=3.0, .acc=vec2(0.0, -0.5)},
+        {.force=force_anchored_spring(0, vec2(0.0, 0.0), 2.0, 0.0, 1.0), .pos=vec2(3.0, 0.0), .mass=2.0, .acc=vec2(-2.0, 0.0)},
+        {.force=force_anchored_spring(0, vec2(0.0, 0.0), 2.0, 1.0, 1.0), .pos=vec2(3.0, 0.0), .vel=vec2(2.0, 5.0), .mass=2.0, .acc=vec2(-3.0, 0.0)},
+    };
+
+    double dt = 0.01;
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+
+        BodyStore store = body_store_new();
+        body_store_add(&store, t.pos, t.mass);
+        body_store_set_vel(&store, 0, t.vel);
+        body_store_add_force(&store, t.force);
+        body_store_update_all(&store, dt);
+
+        // One Euler step, v = v0 + a dt
+        Vec2 want = vec2_add(t.vel, vec2_mult(t.acc, dt));
+        assert(vec2_equalp(body_store_vel(&store, 0), want, 6));
+        body_store_free(&store);
+    }
+
+    // Only the listed bodies feel a force
+    BodyStore store = body_store_new();
+    body_store_add(&store, vec2zero, 1);
+    body_store_add(&store, vec2zero, 1);
+    ForceGen gravity = force_gravity(vec2(0.0, 10.0));
+    force_add_body(&gravity, 1);
+    body_store_add_force(&store, gravity);
+    body_store_update_all(&store, 1);
+    assert(vec2_equal(body_store_vel(&store, 0), vec2zero));
+    assert(vec2_equal(body_store_vel(&store, 1), vec2(0.0, 10.0)));
+    body_store_free(&store);
+
+    // A spring between two bodies pulls both, momentum is kept
+    store = body_store_new();
+    body_store_add(&store, vec2(-2.0, 0.0), 1);
+    body_store_add(&store, vec2(2.0, 0.0), 3);
+    body_store_add_force(&store, force_spring(0, 1, 4.0, 0.0, 2.0));
+    body_store_update_all(&store, 0.1);
+    assert(body_store_vel(&store, 0).x > 0 && body_store_vel(&store, 1).x < 0);
+    Vec2 momentum = vec2_add(body_store_vel(&store, 0), vec2_mult(body_store_vel(&store, 1), 3));
+    assert(vec2_equalp(momentum, vec2zero, 4));
+    body_store_free(&store);
+
+    // Bodies outside a store get the same forces in one pass, sleeping
+    // ones stay asleep
+    Body loose[3];
+    body_init(&loose[0], vec2(-2.0, 0.0), 1);
+    body_init(&loose[1], vec2(2.0, 0.0), 2);
+    body_init(&loose[2], vec2(0.0, 5.0), 1);
+    loose[2].sleeping = true;
+    Body *loose_ptrs[] = {&loose[0], &loose[1], &loose[2]};
+    ForceGen loose_forces[] = {force_gravity(vec2(0.0, 10.0)), force_spring(0, 1, 4.0, 0.0, 2.0)};
+    BodyStore scratch = {0};
+    bodies_apply_forces(loose_ptrs, 3, loose_forces, 2, &scratch);
+    assert(vec2_equalp(loose[0].acc, vec2(8.0, 10.0), 4));
+    assert(vec2_equalp(loose[1].acc, vec2(-4.0, 10.0), 4));
+    assert(vec2_equal(loose[2].acc, vec2zero) && loose[2].sleeping);
+    body_store_free(&scratch);
+
+    // Removing a body drops its spring, and the forces follow the last
+    // body to its new id
+    Integrator integrators[] = {INTEGRATOR_EULER, INTEGRATOR_VERLET, INTEGRATOR_RK4};
+    for (int k=0; k<3; k++) {
+        store = body_store_new();
+        store.integrator = integrators[k];
+        body_store_add(&store, vec2(0.0, 0.0), 1);
+        body_store_add(&store, vec2(5.0, 0.0), 1);
+        body_store_add(&store, vec2(9.0, 0.0), 1);
+        body_store_add(&store, vec2(0.0, 7.0), 1);
+        body_store_add_force(&store, force_spring(1, 2, 4.0, 0.0, 1.0));
+        ForceGen fall = force_gravity(vec2(0.0, 10.0));
+        force_add_body(&fall, 2);
+        force_add_body(&fall, 3);
+        body_store_add_force(&store, fall);
+
+        body_store_remove(&store, 2);
+        assert(arrlen(store.forces) == 1);
+        assert(arrlen(store.forces[0].bodies) == 1 && store.forces[0].bodies[0] == 2);
+        for (int step=0; step < 10; step++) body_store_update_all(&store, 0.1);
+        assert(vec2_equal(body_store_pos(&store, 1), vec2(5.0, 0.0)));
+        assert(body_store_pos(&store, 2).y > 7.0);
+        body_store_free(&store);
+    }
+
+    // drag and friction match the generators
+    assert(vec2_equalp(drag(vec2(3.0, 4.0), 0.5, 2), vec2(-7.5, -10.0), 4));
+    assert(vec2_equalp(drag(vec2(4.0, -2.0), 0.5, 1), vec2(-2.0, 1.0), 4));
+    assert(vec2_equal(drag(vec2zero, 0.5, 2), vec2zero));
+    assert(vec2_equalp(friction(vec2(0.0, -2.0), 0.5, 8.0), vec2(0.0, 4.0), 4));
+
+    test_passed();
+}
+
+void test_rng()
+{
+    test_start("rng");
+
+    // Reference output of pcg32 seeded with 42, stream 54
+    uint32_t want[] = {0xa15c02b7, 0x7b47f409, 0xba1d3330, 0x83d2f293, 0xbfa4784b, 0xcbed606e};
+    Rng rng = rng_new(42, 54);
+    for (int i=0; i < sizeof(want)/sizeof(uint32_t); i++) {
+        assert(rng_next_u32(&rng) == want[i]);
+    }
+
+    // Same seed, same numbers. Other streams differ.
+    Rng a = rng_new(7, 1);
+    Rng b = rng_new(7, 1);
+    Rng c = rng_new(7, 2);
+    int same = 0;
+    for (int i=0; i < 100; i++) {
+        p2_real x = rng_range(&a, -3, 5);
+        assert(x == rng_range(&b, -3, 5));
+        assert(x >= -3 && x < 5);
+        if (x == rng_range(&c, -3, 5)) same++;
+    }
+    assert(same < 5);
+
+    // Bulk fills match single draws
+    enum { N = 33 };
+    p2_real values[N];
+    Vec2 vecs[N];
+    a = rng_new(99, 3);
+    b = rng_new(99, 3);
+    rng_fill_uniform(&a, values, N, 10, 20);
+    for (int i=0; i < N; i++) {
+        assert(values[i] == rng_range(&b, 10, 20));
+    }
+    rng_fill_vec2(&a, vecs, N, -1, 1);
+    for (int i=0; i < N; i++) {
+        assert(vec2_equal(vecs[i], rng_vec2(&b)));
+    }
+    assert(rng_next_u32(&a) == rng_next_u32(&b));
+
+    // randfrom and vec2_random follow the default seed
+    rng_seed_default(5);
+    p2_real r1 = randfrom(0, 1);
+    Vec2 v1 = vec2_random();
+    rng_seed_default(5);
+    assert(r1 == randfrom(0, 1));
+    assert(vec2_equal(v1, vec2_random()));
+    // The first thread keeps stream 0, others get the next ones
+    assert(rng_default()->inc == 1);
+
+    test_passed();
+}
+
+// Fixed point scene: bodies thrown under gravity and drag, bouncing off
+// each other and the floor.
+uint64_t fixed_scene_checksum(int steps)
+{
+    enum { N = 16 };
+    FixBody bodies[N];
+    p2_fixed radius = fix_from_int(4);
+    FixRect floor = {.pos=fixvec2(fix_from_int(-100), fix_from_int(100)), .width=fix_from_int(400), .height=fix_from_int(20)};
+    p2_fixed dt = FIX_ONE / 60;
+
+    for (int i=0; i<N; i++) {
+        fix_body_init(&bodies[i], fixvec2(fix_from_int(i * 10), fix_from_int(i % 3)), fix_from_int(1 + i % 4));
+        bodies[i].vel = fixvec2(fix_from_int(7 - i), fix_from_int(-i));
+        bodies[i].max_speed = fix_from_int(50);
+    }
+
+    uint64_t hash = CHECKSUM_INIT;
+    for (int step=0; step < steps; step++) {
+        for (int i=0; i<N; i++) {
+            FixBody *body = &bodies[i];
+            fix_body_apply_gravity(body, fixvec2(0, fix_from_int(10)));
+            fix_body_apply_force(body, fixvec2_mult(body->vel, -FIX_ONE / 10));
+            fix_body_update(body, dt);
+
+            FixContact c = fix_circle_rect_collide((FixCircle){body->pos, radius}, floor);
+            if (c.hit) {
+                body->pos = fixvec2_sub(body->pos, fixvec2_mult(c.normal, c.depth));
+                body->vel.y = -body->vel.y / 2;
+            }
+        }
+        for (int i=0; i<N; i++) {
+            for (int j=i+1; j<N; j++) {
+                FixContact c = fix_circle_collide((FixCircle){bodies[i].pos, radius}, (FixCircle){bodies[j].pos, radius});
+                if (!c.hit) continue;
+                FixVec2 push = fixvec2_mult(c.normal, c.depth / 2);
+                bodies[i].pos = fixvec2_sub(bodies[i].pos, push);
+                bodies[j].pos = fixvec2_add(bodies[j].pos, push);
+            }
+        }
+        // Per-frame checksum, folded into one
+        uint64_t frame = fix_bodies_checksum(bodies, N);
+        hash = checksum_bytes(hash, &frame, sizeof(frame));
+    }
+    return hash;
+}
+
+void test_fixed()
+{
+    test_start("fixed");
+
+    typedef struct {
+        double a;
+        double b;
+    } test;
+
+    test tests[] =  {
+        {.a=1.5, .b=2.0},
+        {.a=-3.25, .b=0.5},
+        {.a=100.0, .b=-0.125},
+        {.a=0.25, .b=1000.0},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        p2_fixed a = fix_from_real(t.a);
+        p2_fixed b = fix_from_real(t.b);
+        assert(fabs(fix_to_real(fix_mul(a, b)) - t.a * t.b) < 1e-3);
+        assert(fabs(fix_to_real(fix_div(a, b)) - t.a / t.b) < 1e-3);
+        assert(fabs(fix_to_real(fix_sqrt(b)) - (t.b > 0 ? sqrt(t.b) : 0)) < 1e-3);
+    }
+
+    assert(isqrt64(0) == 0);
+    assert(isqrt64(15) == 3);
+    assert(isqrt64(16) == 4);
+    assert(isqrt64(UINT64_MAX) == 0xffffffffULL);
+    assert(fix_sqrt(fix_from_int(9)) == fix_from_int(3));
+    assert(fix_div(FIX_ONE, 0) == FIX_MAX);
+
+    FixVec2 v = fixvec2(fix_from_int(3), fix_from_int(4));
+    assert(fixvec2_mag(v) == fix_from_int(5));
+    assert(vec2_equalp(fixvec2_to_vec2(fixvec2_normalize(v)), vec2(0.6, 0.8), 4));
+    assert(fixvec2_equal(fixvec2_limit(v, fix_from_int(10)), v));
+    assert(vec2_equalp(fixvec2_to_vec2(fixvec2_limit(v, fix_from_int(1))), vec2(0.6, 0.8), 4));
+    assert(fixvec2_equal(fixvec2_normalize(fixvec2zero), fixvec2zero));
+    // Large vectors do not overflow
+    FixVec2 big = fixvec2(fix_from_int(20000), fix_from_int(-20000));
+    assert(fabs(fix_to_real(fixvec2_mag(big)) - 20000 * sqrt(2)) < 1e-3);
+
+    // Fixed point body follows the floating point one
+    Body body;
+    body_init(&body, vec2(1.0, 2.0), 2.0);
+    FixBody fbody;
+    fix_body_init(&fbody, fixvec2_from_vec2(body.pos), fix_from_int(2));
+    for (int step=0; step < 60; step++) {
+        body_apply_force(&body, vec2(3.0, -1.0));
+        fix_body_apply_force(&fbody, fixvec2(fix_from_int(3), fix_from_int(-1)));
+        body_update(&body, 1.0 / 60);
+        fix_body_update(&fbody, FIX_ONE / 60);
+    }
+    assert(vec2_equalp(fixvec2_to_vec2(fbody.pos), body.pos, 2));
+
+    // Moves before limiting the speed, like body_update
+    body.max_speed = 1;
+    fbody.max_speed = FIX_ONE;
+    Vec2 start = body.pos;
+    FixVec2 fstart = fbody.pos;
+    body_update(&body, 1.0);
+    fix_body_update(&fbody, FIX_ONE);
+    assert(vec2_equalp(fixvec2_to_vec2(fixvec2_sub(fbody.pos, fstart)), vec2_sub(body.pos, start), 2));
+    assert(vec2_equalp(fixvec2_to_vec2(fbody.vel), body.vel, 3));
+
+    // Adding past the range saturates
+    assert(fix_add(FIX_MAX, FIX_ONE) == FIX_MAX);
+    assert(fix_sub(FIX_MIN, FIX_ONE) == FIX_MIN);
+    assert(fixvec2_equal(fixvec2_add(fixvec2(FIX_MAX, FIX_MIN), fixvec2(1, -1)), fixvec2(FIX_MAX, FIX_MIN)));
+
+    // Collisions
+    FixCircle c1 = {fixvec2(0, 0), fix_from_int(2)};
+    FixCircle c2 = {fixvec2(fix_from_int(3), 0), fix_from_int(2)};
+    FixContact contact = fix_circle_collide(c1, c2);
+    assert(contact.hit);
+    assert(contact.depth == fix_from_int(1));
+    assert(fixvec2_equal(contact.normal, fixvec2(FIX_ONE, 0)));
+    c2.center.x = fix_from_int(4);
+    assert(!fix_circle_collide(c1, c2).hit);
+
+    // Radius sums past 46341 square past int64
+    FixCircle huge1 = {fixvec2(0, 0), fix_from_int(30000)};
+    FixCircle huge2 = {fixvec2(fix_from_int(30000), 0), fix_from_int(30000)};
+    contact = fix_circle_collide(huge1, huge2);
+    assert(contact.hit);
+    assert(contact.depth == fix_from_int(30000));
+    assert(fixvec2_equal(contact.normal, fixvec2(FIX_ONE, 0)));
+    huge2.radius = fix_from_int(1);
+    huge2.center.x = fix_from_int(30002);
+    assert(!fix_circle_collide(huge1, huge2).hit);
+
+    FixRect r1 = {fixvec2(0, 0), fix_from_int(4), fix_from_int(4)};
+    FixRect r2 = {fixvec2(fix_from_int(1), fix_from_int(3)), fix_from_int(4), fix_from_int(4)};
+    contact = fix_rect_collide(r1, r2);
+    assert(contact.hit);
+    assert(contact.depth == fix_from_int(1));
+    assert(fixvec2_equal(contact.normal, fixvec2(0, FIX_ONE)));
+
+    FixCircle c3 = {fixvec2(fix_from_int(-1), fix_from_int(2)), fix_from_int(2)};
+    contact = fix_circle_rect_collide(c3, r1);
+    assert(contact.hit);
+    assert(contact.depth == fix_from_int(1));
+    assert(fixvec2_equal(contact.normal, fixvec2(FIX_ONE, 0)));
+
+    // Same scene, same checksum, in every build
+    assert(fixed_scene_checksum(300) == 0x60a148b3645442beULL);
+    assert(fixed_scene_checksum(299) != 0x60a148b3645442beULL);
+
+    // Store checksum changes with the state
+    BodyStore store = body_store_new();
+    body_store_add(&store, vec2(1.0, 2.0), 1);
+    uint64_t before = body_store_checksum(&store);
+    assert(before == body_store_checksum(&store));
+    body_store_set_vel(&store, 0, vec2(0.0, 1.0));
+    assert(before != body_store_checksum(&store));
+    body_store_free(&store);
+
+    test_passed();
+}
+
+void test_shape_collide()
+{
+    test_start("shape_collide");
+
+    typedef struct {
+        Shape s1;
+        Shape s2;
+        bool hit;
+        Vec2 dir;
+    } test;
+
+    test tests[] =  {
+        {.s1=circle(0, 0, 2), .s2=circle(3, 0, 2), .hit=true, .dir=vec2(-1.0, 0.0)},
+        {.s1=circle(0, 0, 1), .s2=circle(3, 0, 1), .hit=false, .dir=vec2zero},
+        {.s1=point(1, 0), .s2=circle(0, 0, 2), .hit=true, .dir=vec2(1.0, 0.0)},
+        // Mirrored pair, dir flips
+        {.s1=circle(0, 0, 2), .s2=point(1, 0), .hit=true, .dir=vec2(-1.0, 0.0)},
+        {.s1=circle(0, 5, 2), .s2=rect(-2, 0, 4, 4), .hit=true, .dir=vec2(0.0, 1.0)},
+        {.s1=rect(-2, 0, 4, 4), .s2=circle(0, 5, 2), .hit=true, .dir=vec2(0.0, -1.0)},
+        {.s1=rect(-2, 0, 4, 4), .s2=circle(0, 7, 2), .hit=false, .dir=vec2zero},
+        {.s1=rect(0, 0, 4, 4), .s2=rect(3, 1, 4, 4), .hit=true, .dir=vec2(-1.0, 0.0)},
+        {.s1=point(1.5, 1), .s2=rect(0, 0, 2, 2), .hit=true, .dir=vec2(1.0, 0.0)},
+        {.s1=rect(0, 0, 2, 2), .s2=point(3, 1), .hit=false, .dir=vec2zero},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        Manifold c = shape_collide(t.s1, t.s2);
+        assert((c.count > 0) == t.hit);
+        assert(vec2_equalp(c.normal, t.dir, 6));
+    }
+
+    // Every pair of types dispatches, including QUAD
+    Shape shapes[] = {
+        point(0, 0), line(0, 0, 1, 1), circle(0, 0, 1), rect(0, 0, 1, 1),
+        triangle(0, 0, 1, 0, 0, 1), quad(0, 0, 1, 0, 1, 1, 0, 1),
+        {.type=POLY},
+    };
+    int n = sizeof(shapes)/sizeof(Shape);
+    assert(n == SHAPE_TYPE_COUNT);
+    for (int i=0; i < n; i++) {
+        for (int j=0; j < n; j++) {
+            Manifold c = shape_collide(shapes[i], shapes[j]);
+            Manifold mirror = shape_collide(shapes[j], shapes[i]);
+            assert(c.count == mirror.count);
+            // Same shape on the same spot has no one way out
+            if (i != j) assert(vec2_equal(c.normal, vec2_mult(mirror.normal, -1)));
+        }
+    }
+
+    test_passed();
+}
+
+void test_sat()
+{
+    test_start("sat");
+
+    Vec2 pentagon[] = {{0, -2}, {2, -0.5}, {1.2, 2}, {-1.2, 2}, {-2, -0.5}};
+    Shape poly5 = polyv(pentagon, 5);
+    Shape square = quad(0, 0, 2, 0, 2, 2, 0, 2);
+
+    typedef struct {
+        Shape s1;
+        Shape s2;
+        bool hit;
+        Vec2 dir;
+        double depth;
+    } test;
+
+    test tests[] =  {
+        {.s1=triangle(0, 0, 4, 0, 0, 4), .s2=triangle(1, 1, 5, 1, 1, 5), .hit=true, .dir=vec2(-M_SQRT1_2, -M_SQRT1_2), .depth=M_SQRT2},
+        {.s1=triangle(0, 0, 4, 0, 0, 4), .s2=triangle(3, 3, 7, 3, 3, 7), .hit=false},
+        {.s1=square, .s2=rect(1.5, 0.5, 2, 1), .hit=true, .dir=vec2(-1.0, 0.0), .depth=0.5},
+        {.s1=rect(1.5, 0.5, 2, 1), .s2=square, .hit=true, .dir=vec2(1.0, 0.0), .depth=0.5},
+        {.s1=circle(3, 1, 1.5), .s2=square, .hit=true, .dir=vec2(1.0, 0.0), .depth=0.5},
+        {.s1=circle(3.5, 3.5, 1.5), .s2=square, .hit=false},
+        {.s1=line(0, 0, 4, 4), .s2=rect(3, 0, 2, 2), .hit=false},
+        {.s1=line(0, 0, 4, 4), .s2=rect(1, 0, 2, 2), .hit=true},
+        {.s1=line(0, 0, 1, 0), .s2=line(5, 0, 6, 0), .hit=false},
+        {.s1=line(0, 0, 1, 1), .s2=line(3, 3, 2, 2), .hit=false},
+        {.s1=line(0, 0, 2, 0), .s2=line(1, 0, 3, 0), .hit=true},
+        {.s1=point(1, 1), .s2=triangle(0, 0, 4, 0, 0, 4), .hit=true},
+        {.s1=point(3, 3), .s2=triangle(0, 0, 4, 0, 0, 4), .hit=false},
+        {.s1=poly5, .s2=circle(0, 3, 1.5), .hit=true, .dir=vec2(0.0, -1.0), .depth=0.5},
+        {.s1=poly5, .s2=circle(0, 4, 1.5), .hit=false},
+        {.s1=poly5, .s2=rect(1, -1, 2, 1), .hit=true},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        Manifold c = shape_collide(t.s1, t.s2);
+        assert((c.count > 0) == t.hit);
+        if (t.hit && t.depth > 0) {
+            assert(vec2_equalp(c.normal, t.dir, 4));
+            assert(equalp(c.depth, t.depth, 4));
+        }
+    }
+
+    // Cached axis gives the same answers along a path
+    Shape tri = triangle(0, 0, 4, 0, 0, 4);
+    SatCache cache = {0};
+    int quick = 0;
+    for (int step=0; step <= 100; step++) {
+        Vec2 at = vec2(10 - step * 0.1, 8 - step * 0.07);
+        Shape moving = shape_offset(at, square);
+        bool was_valid = cache.valid;
+        Manifold cached = shape_collide_cached(moving, tri, &cache);
+        Manifold full = shape_collide(moving, tri);
+        assert(cached.count == full.count);
+        if (cached.count > 0) {
+            assert(vec2_equal(cached.normal, full.normal));
+            assert(!cache.valid);
+        } else {
+            assert(cache.valid);
+        }
+        if (was_valid && cached.count == 0) quick++;
+    }
+    assert(quick > 0);
+
+    test_passed();
+}
+
+void test_gjk()
+{
+    test_start("gjk");
+
+    Vec2 pentagon[] = {{0, -2}, {2, -0.5}, {1.2, 2}, {-1.2, 2}, {-2, -0.5}};
+    Shape poly5 = polyv(pentagon, 5);
+    Shape square = quad(0, 0, 2, 0, 2, 2, 0, 2);
+
+    typedef struct {
+        Shape s1;
+        Shape s2;
+        bool hit;
+        double distance;
+    } test;
+
+    test tests[] =  {
+        {.s1=triangle(0, 0, 4, 0, 0, 4), .s2=triangle(1, 1, 5, 1, 1, 5), .hit=true},
+        {.s1=triangle(0, 0, 4, 0, 0, 4), .s2=triangle(3, 3, 7, 3, 3, 7), .hit=false, .distance=M_SQRT2},
+        {.s1=square, .s2=rect(1.5, 0.5, 2, 1), .hit=true},
+        {.s1=circle(3, 1, 1.5), .s2=square, .hit=true},
+        {.s1=circle(5, 1, 1.5), .s2=square, .hit=false, .distance=1.5},
+        {.s1=circle(0, 0, 1), .s2=circle(5, 0, 2), .hit=false, .distance=2},
+        {.s1=circle(0, 0, 2), .s2=circle(3, 0, 2), .hit=true},
+        {.s1=line(0, 0, 4, 4), .s2=rect(3, 0, 2, 2), .hit=false, .distance=M_SQRT1_2},
+        {.s1=line(0, 0, 4, 4), .s2=rect(1, 0, 2, 2), .hit=true},
+        {.s1=point(3, 3), .s2=triangle(0, 0, 4, 0, 0, 4), .hit=false, .distance=M_SQRT2},
+        {.s1=point(2, 5), .s2=line(0, 0, 4, 0), .hit=false, .distance=5},
+        {.s1=poly5, .s2=circle(0, 3, 1.5), .hit=true},
+        {.s1=poly5, .s2=circle(0, 4, 1.5), .hit=false, .distance=0.5},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        GjkResult result = gjk(&t.s1, &t.s2, NULL);
+        assert(result.hit == t.hit);
+        assert(equalp(result.distance, t.distance, 4));
+
+        if (t.hit) {
+            // EPA agrees with SAT
+            Manifold c = shape_collide(t.s1, t.s2);
+            assert(c.count > 0);
+            assert(vec2_equalp(result.dir, c.normal, 3));
+            assert(equalp(result.depth, c.depth, 3));
+        } else {
+            // Closest points are on the shapes, distance apart
+            assert(equalp(vec2_mag(vec2_sub(result.point1, result.point2)), t.distance, 4));
+            assert(equalp(shape_distance(t.s1, t.s2, NULL, NULL), t.distance, 4));
+        }
+    }
+
+    Vec2 p1, p2;
+    shape_distance(circle(0, 0, 1), circle(5, 0, 2), &p1, &p2);
+    assert(vec2_equalp(p1, vec2(1.0, 0.0), 4));
+    assert(vec2_equalp(p2, vec2(3.0, 0.0), 4));
+
+    // Warm start, the same answers in fewer iterations
+    Shape tri = triangle(0, 0, 4, 0, 0, 4);
+    GjkCache cache = {0};
+    int cold = 0, warm = 0;
+    for (int step=0; step <= 100; step++) {
+        Shape moving = shape_offset(vec2(10 - step * 0.1, 8 - step * 0.07), poly5);
+        GjkResult a = gjk(&moving, &tri, NULL);
+        GjkResult b = gjk(&moving, &tri, &cache);
+        assert(a.hit == b.hit);
+        assert(equalp(a.distance, b.distance, 4));
+        if (a.hit) assert(equalp(a.depth, b.depth, 3));
+        cold += a.iterations;
+        warm += b.iterations;
+    }
+    assert(warm < cold);
+
+    test_passed();
+}
+
+
+// Finds p in the contact points of m, returns its index or -1
+static int manifold_find(Manifold m, Vec2 p)
+{
+    for (int i=0; i < m.count; i++) {
+        if (vec2_equalp(m.points[i], p, 4)) return i;
+    }
+    return -1;
+}
+
+void test_manifold()
+{
+    test_start("manifold");
+
+    // Small enough to collect thousands a frame
+    assert(sizeof(Manifold) <= 8 * sizeof(p2_real) + 8);
+
+    typedef struct {
+        Shape s1;
+        Shape s2;
+        int count;
+        Vec2 normal;
+        double depth;
+        Vec2 points[2];
+    } test;
+
+    Shape square = quad(0, 0, 2, 0, 2, 2, 0, 2);
+
+    test tests[] =  {
+        {.s1=rect(0, 0, 4, 2), .s2=rect(1, 1.5, 2, 2), .count=2, .normal=vec2(0.0, -1.0), .depth=0.5,
+            .points={vec2(1.0, 1.75), vec2(3.0, 1.75)}},
+        // Rotated box resting on a corner
+        {.s1=quad(1, 1.5, 2, 2.5, 1, 3.5, 0, 2.5), .s2=square, .count=1, .normal=vec2(0.0, 1.0), .depth=0.5,
+            .points={vec2(1.0, 1.75)}},
+        // Wide box on a narrow one, the contacts are the narrow one's width
+        {.s1=square, .s2=rect(-1, 1.8, 4, 1), .count=2, .normal=vec2(0.0, -1.0), .depth=0.2,
+            .points={vec2(0.0, 1.9), vec2(2.0, 1.9)}},
+        {.s1=circle(0, 0, 2), .s2=circle(3, 0, 2), .count=1, .normal=vec2(-1.0, 0.0), .depth=1,
+            .points={vec2(1.5, 0.0)}},
+        {.s1=circle(1, 3, 1.5), .s2=square, .count=1, .normal=vec2(0.0, 1.0), .depth=0.5,
+            .points={vec2(1.0, 1.75)}},
+        {.s1=square, .s2=circle(1, 3, 1.5), .count=1, .normal=vec2(0.0, -1.0), .depth=0.5,
+            .points={vec2(1.0, 1.75)}},
+        {.s1=line(-1, 1.5, 3, 1.5), .s2=square, .count=2, .normal=vec2(0.0, 1.0), .depth=0.5,
+            .points={vec2(0.0, 1.75), vec2(2.0, 1.75)}},
+        {.s1=point(1, 1.5), .s2=square, .count=1, .normal=vec2(0.0, 1.0), .depth=0.5,
+            .points={vec2(1.0, 1.75)}},
+        {.s1=square, .s2=rect(3, 0, 1, 1), .count=0},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        Manifold m = shape_collide(t.s1, t.s2);
+        assert(m.count == t.count);
+        if (t.count == 0) continue;
+        assert(vec2_equalp(m.normal, t.normal, 4));
+        assert(equalp(m.depth, t.depth, 4));
+        for (int j=0; j < t.count; j++) {
+            assert(manifold_find(m, t.points[j]) >= 0);
+        }
+
+        // Swapping the shapes flips the normal, the points stay
+        Manifold swapped = shape_collide(t.s2, t.s1);
+        assert(swapped.count == m.count);
+        assert(vec2_equalp(swapped.normal, vec2_mult(m.normal, -1), 4));
+        for (int j=0; j < m.count; j++) {
+            int k = manifold_find(swapped, m.points[j]);
+            assert(k >= 0);
+            assert(swapped.ids[k] == CONTACT_ID(m.ids[j] & 0xff, m.ids[j] >> 8));
+        }
+    }
+
+    // Circles on the same center still get a direction
+    Manifold same = shape_collide(circle(1, 1, 2), circle(1, 1, 1));
+    assert(same.count == 1);
+    assert(vec2_equal(same.normal, vec2(1.0, 0.0)));
+    assert(equalp(same.depth, 3, 4));
+
+    // Ids name the same features while a box slides on another
+    Manifold first = shape_collide(rect(0, 0, 4, 2), rect(1, 1.5, 2, 2));
+    assert(first.count == 2);
+    assert(first.ids[0] != first.ids[1]);
+    for (int step=1; step < 10; step++) {
+        Manifold m = shape_collide(rect(0, 0, 4, 2), rect(1 + step * 0.1, 1.5, 2, 2));
+        assert(m.count == 2);
+        for (int j=0; j<2; j++) {
+            int k = manifold_find(first, vec2_sub(m.points[j], vec2(step * 0.1, 0)));
+            assert(k >= 0);
+            assert(m.ids[j] == first.ids[k]);
+        }
+    }
+
+    test_passed();
+}
+
+void test_contact_cache()
+{
+    test_start("contact_cache");
+
+    ContactCache cache = contact_cache_new();
+    BodyPool pool = body_pool_new();
+    BodyHandle floor = body_pool_create(&pool, vec2zero, 0);
+    BodyHandle box = body_pool_create(&pool, vec2(1, 1.5), 1);
+    BodyHandle ball = body_pool_create(&pool, vec2(0, 5), 1);
+    ContactKey box_key = contact_key(box, 0, floor, 0);
+    ContactKey ball_key = contact_key(ball, 0, floor, 0);
+
+    contact_cache_begin(&cache);
+    CachedContact *c = contact_cache_update(&cache, box_key, shape_collide(rect(1, 1.5, 2, 2), rect(0, 0, 4, 2)));
+    assert(c != NULL && c->manifold.count == 2);
+    assert(c->normal_impulse[0] == 0 && c->normal_impulse[1] == 0);
+    // As a solver would
+    c->normal_impulse[0] = 1;
+    c->normal_impulse[1] = 2;
+    c->tangent_impulse[1] = 3;
+    assert(contact_cache_update(&cache, ball_key, shape_collide(circle(0, 5, 1), rect(0, 0, 4, 2))) == NULL);
+    assert(contact_cache_end(&cache) == 0);
+    assert(contact_cache_count(&cache) == 1);
+
+    // Slid a bit, the points are matched by feature and keep their impulses
+    contact_cache_begin(&cache);
+    CachedContact old = *c;
+    // Same points in the other order
+    Manifold m = shape_collide(rect(1.2, 1.5, 2, 2), rect(0, 0, 4, 2));
+    Vec2 point = m.points[0];
+    uint16_t id = m.ids[0];
+    m.points[0] = m.points[1];
+    m.ids[0] = m.ids[1];
+    m.points[1] = point;
+    m.ids[1] = id;
+    c = contact_cache_update(&cache, box_key, m);
+    assert(c->manifold.count == 2);
+    for (int i=0; i<2; i++) {
+        int j = c->manifold.ids[i] == old.manifold.ids[0] ? 0 : 1;
+        assert(c->manifold.ids[i] == old.manifold.ids[j]);
+        assert(c->normal_impulse[i] == old.normal_impulse[j]);
+        assert(c->tangent_impulse[i] == old.tangent_impulse[j]);
+    }
+    assert(contact_cache_get(&cache, box_key) == c);
+    assert(contact_cache_end(&cache) == 0);
+
+    // Tipped over on a corner, a new feature starts from zero
+    contact_cache_begin(&cache);
+    c = contact_cache_update(&cache, box_key, shape_collide(quad(1, 3.5, 0, 2.5, 1, 1.5, 2, 2.5), rect(0, 0, 4, 2)));
+    assert(c->manifold.count == 1);
+    assert(c->normal_impulse[0] == 0);
+    // The ball lands
+    c = contact_cache_update(&cache, ball_key, shape_collide(circle(1, 2.5, 1), rect(0, 0, 4, 2)));
+    assert(c != NULL && c->manifold.count == 1);
+    assert(contact_cache_end(&cache) == 0);
+    assert(contact_cache_count(&cache) == 2);
+
+    // Pairs not updated in a frame are dropped, a miss drops at once
+    contact_cache_begin(&cache);
+    contact_cache_update(&cache, box_key, manifold_miss);
+    assert(contact_cache_get(&cache, box_key) == NULL);
+    assert(contact_cache_count(&cache) == 1);
+    assert(contact_cache_end(&cache) == 1);
+    assert(contact_cache_get(&cache, ball_key) == NULL);
+    assert(contact_cache_count(&cache) == 0);
+
+    body_pool_free(&pool);
+    contact_cache_free(&cache);
+
+    test_passed();
+}
+
+void test_circle_collide_n()
+{
+    test_start("circle_collide_n");
+
+    // Not a multiple of any register width, and more than one mask word
+    enum { N = 203 };
+    p2_real x1[N], y1[N], r1[N], x2[N], y2[N], r2[N];
+    p2_real nx[N], ny[N], depth[N];
+    uint64_t mask[(N + 63) / 64];
+
+    Rng rng = rng_new(16, 0);
+    for (int i=0; i < N; i++) {
+        x1[i] = rng_range(&rng, -5, 5);
+        y1[i] = rng_range(&rng, -5, 5);
+        x2[i] = rng_range(&rng, -5, 5);
+        y2[i] = rng_range(&rng, -5, 5);
+        r1[i] = rng_range(&rng, 0.5, 3);
+        r2[i] = rng_range(&rng, 0.5, 3);
+    }
+    // Same center, and just touching
+    x2[7] = x1[7];
+    y2[7] = y1[7];
+    x1[64] = 0; y1[64] = 0; r1[64] = 1;
+    x2[64] = 3; y2[64] = 0; r2[64] = 2;
+
+    CirclePairs pairs = {x1, y1, r1, x2, y2, r2, N};
+    CircleHits hits = {mask, nx, ny, depth};
+
+    SimdLevel levels[] = {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NEON};
+    SimdLevel best = simd_level();
+
+    for (int l=0; l < sizeof(levels)/sizeof(SimdLevel); l++) {
+        if (simd_set_level(levels[l]) != levels[l]) continue;
+
+        // Stale bits are cleared
+        memset(mask, 0xff, sizeof(mask));
+        int count = circle_collide_n(&pairs, &hits);
+
+        int want = 0;
+        for (int i=0; i < N; i++) {
+            Manifold m = shape_collide(circle(x1[i], y1[i], r1[i]), circle(x2[i], y2[i], r2[i]));
+            assert(circle_hits_test(&hits, i) == (m.count > 0));
+            if (m.count == 0) continue;
+            want++;
+            assert(vec2_equalp(vec2(nx[i], ny[i]), m.normal, 4));
+            assert(equalp(depth[i], m.depth, 4));
+        }
+        assert(count == want);
+        assert(circle_hits_test(&hits, 7) && nx[7] == 1 && ny[7] == 0);
+        assert(circle_hits_test(&hits, 64) && depth[64] == 0);
+        // No bits past n
+        assert(mask[N / 64] >> (N % 64) == 0);
+    }
+
+    simd_set_level(best);
+    test_passed();
+}
+
+void test_collider_collide()
+{
+    test_start("collider_collide");
+
+    // A chain of circles against a box with two wheels
+    Collider chain = {0};
+    for (int i=0; i<5; i++) collider_add_shape(chain, circle(i * 2, 0, 1));
+    Collider cart = {0};
+    collider_add_shape(cart, rect(0, 0, 6, 2));
+    collider_add_shape(cart, circle(1, 3, 1));
+    collider_add_shape(cart, circle(5, 3, 1));
+    collider_add_shape(cart, triangle(2, -2, 4, -2, 3, 0));
+
+    typedef struct {
+        Vec2 pos1;
+        Vec2 pos2;
+        int count;
+    } test;
+
+    test tests[] =  {
+        // Two circles on the corners of the triangle
+        {.pos1=vec2(0.0, -1.5), .pos2=vec2(0.0, 0.0), .count=2},
+        // Four on the wheels
+        {.pos1=vec2(0.0, 4.5), .pos2=vec2(0.0, 0.0), .count=4},
+        {.pos1=vec2(0.0, 20.0), .pos2=vec2(0.0, 0.0), .count=0},
+        // Through the box, touching both wheels and the triangle
+        {.pos1=vec2(9.0, 11.0), .pos2=vec2(10.0, 10.0), .count=8},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        ColliderContact contacts[32];
+        int count = collider_collide(t.pos1, &chain, t.pos2, &cart, contacts, 32);
+        assert(count == t.count);
+
+        // Same as testing every pair
+        int k = 0;
+        for (int a=0; a < collider_count(&chain); a++) {
+            for (int b=0; b < collider_count(&cart); b++) {
+                Manifold m = shape_collide(shape_offset(t.pos1, chain.shapes[a]), shape_offset(t.pos2, cart.shapes[b]));
+                if (m.count == 0) continue;
+                assert(contacts[k].shape1 == a && contacts[k].shape2 == b);
+                assert(contacts[k].manifold.count == m.count);
+                assert(vec2_equal(contacts[k].manifold.normal, m.normal));
+                k++;
+            }
+        }
+        assert(k == count);
+
+        // A short buffer keeps the first ones
+        if (count > 1) {
+            ColliderContact first[1];
+            assert(collider_collide(t.pos1, &chain, t.pos2, &cart, first, 1) == 1);
+            assert(first[0].shape1 == contacts[0].shape1 && first[0].shape2 == contacts[0].shape2);
+            Manifold m = collider_detect_collisions(t.pos1, &chain, t.pos2, &cart);
+            assert(vec2_equal(m.normal, contacts[0].manifold.normal));
+        }
+    }
+
+    // More shapes than fit on the stack
+    Collider big = {0};
+    for (int i=0; i<100; i++) collider_add_shape(big, circle(i, 0, 0.75));
+    ColliderContact contacts[512];
+    assert(collider_collide(vec2zero, &big, vec2(0, 1), &big, contacts, 512) == 100 + 2 * 99);
+
+    collider_free(chain);
+    collider_free(cart);
+    collider_free(big);
+
+    test_passed();
+}
+
+void test_collider_bounds()
+{
+    test_start("collider_bounds");
+
+    typedef struct {
+        Shape shape;
+        AABB box;
+        Circle circle;
+    } test;
+
+    test tests[] =  {
+        {.shape=circle(1, 2, 3), .box={{-2, -1}, {4, 5}}, .circle={{1, 2}, 3}},
+        {.shape=rect(0, 0, 4, 2), .box={{0, 0}, {4, 2}}, .circle={{2, 1}, 2.2360679}},
+        {.shape=line(-1, 1, 3, -2), .box={{-1, -2}, {3, 1}}, .circle={{1, -0.5}, 2.5}},
+        {.shape=triangle(0, 0, 2, 0, 0, 2), .box={{0, 0}, {2, 2}}, .circle={{1, 1}, 1.4142136}},
+        {.shape=point(5, 6), .box={{5, 6}, {5, 6}}, .circle={{5, 6}, 0}},
+    };
+
+    Collider c = {0};
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        collider_add_shape(c, t.shape);
+        assert(vec2_equalp(c.bounds[i].min, t.box.min, 4));
+        assert(vec2_equalp(c.bounds[i].max, t.box.max, 4));
+        assert(vec2_equalp(c.circles[i].center, t.circle.center, 4));
+        assert(equalp(c.circles[i].radius, t.circle.radius, 4));
+    }
+
+    // All of them together
+    assert(collider_count(&c) == 5);
+    assert(vec2_equal(c.bound.min, vec2(-2, -2)));
+    assert(vec2_equal(c.bound.max, vec2(5, 6)));
+    for (int i=0; i < collider_count(&c); i++) {
+        Circle s = c.circles[i];
+        assert(vec2_mag(vec2_sub(s.center, c.circle.center)) + s.radius <= c.circle.radius + 1e-4);
+    }
+
+    // Placed by the body position
+    AABB box = collider_aabb(&c, vec2(10, 20));
+    assert(vec2_equal(box.min, vec2(8, 18)));
+    assert(vec2_equal(box.max, vec2(15, 26)));
+    Circle circle = collider_bounding_circle(&c, vec2(10, 20));
+    assert(vec2_equal(circle.center, vec2_add(c.circle.center, vec2(10, 20))));
+
+    collider_free(c);
+    assert(collider_count(&c) == 0);
+
+    test_passed();
+}
+
+void test_poly()
+{
+    test_start("poly");
+
+    typedef struct {
+        Shape shape;
+        Vec2 first;
+        Vec2 centroid;
+        p2_real area;
+    } test;
+
+    Vec2 hexagon[] = {{2, 0}, {1, 1.7320508}, {-1, 1.7320508}, {-2, 0}, {-1, -1.7320508}, {1, -1.7320508}};
+    test tests[] =  {
+        // Both windings get outward normals
+        {.shape=poly(4, vec2(0, 0), vec2(2, 0), vec2(2, 2), vec2(0, 2)), .first={0, 0}, .centroid={1, 1}, .area=4},
+        {.shape=poly(4, vec2(0, 0), vec2(0, 2), vec2(2, 2), vec2(2, 0)), .first={0, 0}, .centroid={1, 1}, .area=4},
+        {.shape=poly(3, vec2(0, 0), vec2(3, 0), vec2(0, 3)), .first={0, 0}, .centroid={1, 1}, .area=4.5},
+        {.shape=polyv(hexagon, 6), .first={2, 0}, .centroid={0, 0}, .area=10.392305},
+        {.shape=poly(2, vec2(0, 0), vec2(4, 2)), .first={0, 0}, .centroid={2, 1}, .area=0},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        Poly p = t.shape.poly;
+        assert(p.ext == NULL);
+        assert(vec2_equal(p.v[0], t.first));
+        assert(vec2_equalp(p.centroid, t.centroid, 4));
+        assert(equalp(shape_area(t.shape), t.area, 4));
+        for (int j=0; j < p.n; j++) {
+            assert(equalp(vec2_mag(p.normals[j]), 1, 4));
+            if (p.n > 2) assert(vec2_dot(p.normals[j], vec2_sub(p.v[j], p.centroid)) > 0);
+        }
+
+        // Moving a copy leaves the first alone
+        Shape moved = shape_offset(vec2(10, -5), t.shape);
+        assert(vec2_equal(t.shape.poly.v[0], t.first));
+        assert(vec2_equal(moved.poly.v[0], vec2_add(t.first, vec2(10, -5))));
+        assert(vec2_equalp(moved.poly.centroid, vec2_add(t.centroid, vec2(10, -5)), 4));
+    }
+
+    // Past POLY_INLINE_VERTS polyv and poly assert, or give an empty poly
+    // without asserts. poly_in_arena keeps every vertex.
+    PolyArena many_arena = {0};
+    Vec2 many[10];
+    for (int i=0; i<10; i++) many[i] = vec2(cos(i * 2 * M_PI / 10), sin(i * 2 * M_PI / 10));
+    Shape kept = poly_in_arena(&many_arena, many, 10);
+    assert(kept.poly.n == 10);
+    assert(kept.poly.ext != NULL && vec2_equal(kept.poly.ext[9], many[9]));
+#ifdef NDEBUG
+    // assert is off too, check by hand
+    bool empty = polyv(many, 10).poly.n == 0
+        && poly(10, many[0], many[1], many[2], many[3], many[4],
+                many[5], many[6], many[7], many[8], many[9]).poly.n == 0
+        && shape_collide(polyv(many, 10), circle(0, 0, 5)).count == 0;
+    if (!empty) abort();
+#endif
+    poly_arena_free(&many_arena);
+
+    // Big polys live in the arena and move by offset
+    PolyArena arena = {0};
+    Vec2 round[24], round_moved[24];
+    for (int i=0; i<24; i++) {
+        p2_real a = i * 2 * M_PI / 24;
+        round[i] = vec2(2 * cos(a), 2 * sin(a));
+        round_moved[i] = vec2_add(round[i], vec2(3, 1));
+    }
+    Shape big = poly_in_arena(&arena, round, 24);
+    Shape big_moved = poly_in_arena(&arena, round_moved, 24);
+    assert(big.poly.ext != NULL && big.poly.n == 24);
+    assert(vec2_equalp(big.poly.centroid, vec2zero, 4));
+    assert(poly_in_arena(&arena, hexagon, 6).poly.ext == NULL);
+
+    Shape offset = shape_offset(vec2(3, 1), big);
+    assert(offset.poly.ext == big.poly.ext);
+    assert(vec2_equalp(offset.poly.centroid, vec2(3, 1), 4));
+
+    Shape others[] = {circle(5, 1.7, 1), rect(4, 0, 2, 2), poly(3, vec2(3, 3.5), vec2(4, 4), vec2(2, 4)), polyv(hexagon, 6)};
+    for (int i=0; i < sizeof(others)/sizeof(Shape); i++) {
+        Manifold a = shape_collide(offset, others[i]);
+        Manifold b = shape_collide(big_moved, others[i]);
+        assert(a.count == b.count);
+        assert(vec2_equalp(a.normal, b.normal, 4));
+        assert(equalp(a.depth, b.depth, 4));
+    }
+
+    // Enough polys to fill a few blocks
+    for (int i=0; i<500; i++) poly_in_arena(&arena, round, 24);
+    assert(arrlen(arena.blocks) > 1);
+    poly_arena_free(&arena);
+    assert(arena.blocks == NULL);
+
+    test_passed();
+}
+
+void test_grid()
+{
+    test_start("grid");
+
+    enum { N = 300 };
+    static AABB boxes[N];
+    static bool overlap[N][N];
+
+    Rng rng = rng_new(11, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, -50, 50), rng_range(&rng, -50, 50));
+        Vec2 size = vec2(rng_range(&rng, 0.5, 4), rng_range(&rng, 0.5, 4));
+        boxes[i] = (AABB){at, vec2_add(at, size)};
+    }
+    // Walls, a point and an empty box
+    boxes[0] = (AABB){{-60, -60}, {60, -45}};
+    boxes[1] = (AABB){{-60, -60}, {-45, 60}};
+    boxes[2] = (AABB){{3, 3}, {3, 3}};
+    boxes[3] = (AABB){{P2_REAL_MAX, P2_REAL_MAX}, {-P2_REAL_MAX, -P2_REAL_MAX}};
+
+    int expect = 0;
+    for (int i=0; i<N; i++) {
+        for (int j=i+1; j<N; j++) {
+            overlap[i][j] = i != 3 && j != 3 && aabb_overlap(boxes[i], boxes[j]);
+            expect += overlap[i][j];
+        }
+    }
+
+    typedef struct {
+        p2_real cell_size;
+    } test;
+
+    test tests[] =  {
+        {.cell_size=0},
+        {.cell_size=0.5},
+        {.cell_size=3},
+        {.cell_size=40},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        Grid grid = {.cell_size = t.cell_size};
+
+        // Twice, the second reuses the scratch
+        for (int round=0; round<2; round++) {
+            int count = grid_update(&grid, boxes, N);
+            assert(count == expect);
+            assert(arrlen(grid.pairs) == count);
+
+            static bool found[N][N];
+            memset(found, 0, sizeof(found));
+            for (int k=0; k<count; k++) {
+                BodyPair p = grid.pairs[k];
+                assert(p.a < p.b);
+                assert(overlap[p.a][p.b]);
+                assert(!found[p.a][p.b]);
+                found[p.a][p.b] = true;
+            }
+        }
+        if (t.cell_size > 0) assert(grid.cell == t.cell_size);
+        else assert(grid.cell > 0.5 && grid.cell < 4);
+        grid_free(&grid);
+    }
+
+    // Nothing to do
+    Grid grid = {0};
+    assert(grid_update(&grid, boxes, 0) == 0);
+    assert(grid_update(&grid, boxes + 3, 1) == 0);
+    grid_free(&grid);
+
+    // Boxes past the clamped cells on both sides count as big
+    AABB huge[] = {{{-1e12, -1e12}, {1e12, 1e12}}, {{0, 0}, {1, 1}}};
+    grid = (Grid){.cell_size = 1};
+    assert(grid_update(&grid, huge, 2) == 1);
+    assert(arrlen(grid.big) == 1);
+    grid_free(&grid);
+
+    test_passed();
+}
+
+// Checks pairs are unique, with a < b, hold every overlapping pair of
+// boxes and only pairs of overlapping fat boxes.
+static void check_tree_pairs(const AABBTree *tree, const AABB *boxes, int n)
+{
+    static bool found[300][300];
+    memset(found, 0, sizeof(found));
+    for (int k=0; k < arrlen(tree->pairs); k++) {
+        BodyPair p = tree->pairs[k];
+        assert(p.a < p.b && p.b < n);
+        assert(!found[p.a][p.b]);
+        found[p.a][p.b] = true;
+        assert(aabb_overlap(tree->nodes[tree->leaves[p.a]].box, tree->nodes[tree->leaves[p.b]].box));
+    }
+    for (int i=0; i<n; i++) {
+        for (int j=i+1; j<n; j++) {
+            if (aabb_overlap(boxes[i], boxes[j])) assert(found[i][j]);
+        }
+    }
+}
+
+void test_aabb_tree()
+{
+    test_start("aabb_tree");
+
+    enum { N = 300 };
+    static AABB boxes[N];
+
+    // Sizes from 0.1 to 30, where no cell size fits
+    Rng rng = rng_new(13, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, -100, 100), rng_range(&rng, -100, 100));
+        p2_real size = i % 10 == 0 ? rng_range(&rng, 5, 30) : rng_range(&rng, 0.1, 2);
+        boxes[i] = (AABB){at, vec2_add(at, vec2(size, size * rng_range(&rng, 0.5, 2)))};
+    }
+
+    AABBTree tree = {0};
+    aabb_tree_update(&tree, boxes, N);
+    check_tree_pairs(&tree, boxes, N);
+    int first = arrlen(tree.pairs);
+
+    // Small moves stay inside the fat boxes and change nothing
+    for (int i=0; i<N; i++) {
+        p2_real d = (boxes[i].max.x - boxes[i].min.x) * 0.05;
+        boxes[i] = aabb_offset(boxes[i], vec2(d, -d));
+        assert(!aabb_tree_move(&tree, i, boxes[i]));
+    }
+    assert(aabb_tree_update_pairs(&tree) == first);
+    check_tree_pairs(&tree, boxes, N);
+
+    // Big moves
+    for (int step=0; step<5; step++) {
+        for (int i=0; i<N; i += 3) {
+            boxes[i] = aabb_offset(boxes[i], vec2(rng_range(&rng, -5, 5), rng_range(&rng, -5, 5)));
+        }
+        aabb_tree_update(&tree, boxes, N);
+        check_tree_pairs(&tree, boxes, N);
+    }
+
+    // Fewer items, and an empty box
+    AABB empty = boxes[7];
+    boxes[7] = (AABB){{P2_REAL_MAX, P2_REAL_MAX}, {-P2_REAL_MAX, -P2_REAL_MAX}};
+    aabb_tree_update(&tree, boxes, N - 50);
+    assert(tree.leaves[7] == AABB_TREE_NULL);
+    for (int k=0; k < arrlen(tree.pairs); k++) {
+        assert(tree.pairs[k].a != 7 && tree.pairs[k].b != 7);
+    }
+    boxes[7] = empty;
+    aabb_tree_update(&tree, boxes, N);
+    check_tree_pairs(&tree, boxes, N);
+
+    // Queries find every item that is in the way
+    static int items[N];
+    typedef struct {
+        AABB box;
+        Vec2 point;
+        Vec2 from, to;
+    } test;
+
+    test tests[] =  {
+        {.box={{-10, -10}, {10, 10}}, .point={0, 0}, .from={-100, -100}, .to={100, 100}},
+        {.box={{50, -80}, {51, 80}}, .point={50, 50}, .from={-120, 3}, .to={120, 3}},
+        {.box={{-200, -200}, {200, 200}}, .point={-99, 99}, .from={5, -150}, .to={5, 150}},
+        {.box={{500, 500}, {501, 501}}, .point={500, 500}, .from={500, 0}, .to={600, 0}},
+    };
+
+    for (int i=0; i < sizeof(tests)/sizeof(test); i++) {
+        test t = tests[i];
+        AABB point = {t.point, t.point};
+        Vec2 d = vec2_sub(t.to, t.from);
+
+        static bool hit[3][N];
+        memset(hit, 0, sizeof(hit));
+        int n = aabb_tree_query(&tree, t.box, items, N);
+        for (int k=0; k<n; k++) hit[0][items[k]] = true;
+        n = aabb_tree_query_point(&tree, t.point, items, N);
+        for (int k=0; k<n; k++) hit[1][items[k]] = true;
+        n = aabb_tree_raycast(&tree, t.from, t.to, items, N);
+        for (int k=0; k<n; k++) hit[2][items[k]] = true;
+
+        for (int j=0; j<N; j++) {
+            if (aabb_overlap(boxes[j], t.box)) assert(hit[0][j]);
+            if (aabb_overlap(boxes[j], point)) assert(hit[1][j]);
+
+            // Sample the segment
+            for (int k=0; k<=400; k++) {
+                Vec2 p = vec2_add(t.from, vec2_mult(d, k / 400.0));
+                if (aabb_overlap(boxes[j], (AABB){p, p})) assert(hit[2][j]);
+            }
+        }
+    }
+    assert(aabb_tree_query(&tree, (AABB){{-200, -200}, {200, 200}}, items, 10) == 10);
+
+    // Stays balanced when items come in order
+    AABBTree line = {0};
+    for (int i=0; i<1000; i++) {
+        aabb_tree_insert(&line, i, (AABB){{i, 0}, {i + 1, 1}});
+    }
+    assert(aabb_tree_height(&line) <= 20);
+    for (int i=0; i<1000; i += 2) aabb_tree_remove(&line, i);
+    assert(aabb_tree_height(&line) <= 20);
+    assert(aabb_tree_update_pairs(&line) == 0);
+    aabb_tree_free(&line);
+
+    // Through the broadphase
+    Broadphase bp = {.type = BROADPHASE_TREE};
+    int count;
+    int pairs = broadphase_update(&bp, boxes, N);
+    assert(broadphase_pairs(&bp, &count) == bp.tree.pairs);
+    assert(count == pairs);
+    check_tree_pairs(&bp.tree, boxes, N);
+    broadphase_free(&bp);
+
+    aabb_tree_free(&tree);
+
+    test_passed();
+}
+
+void test_sweep_prune()
+{
+    test_start("sweep_prune");
+
+    enum { N = 200 };
+    static AABB boxes[N];
+    static bool before[N][N], now[N][N], seen[N][N];
+
+    // Spread along x, a few long ones, one empty
+    Rng rng = rng_new(16, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, 0, 400), rng_range(&rng, 0, 20));
+        p2_real w = i % 25 == 0 ? 40 : rng_range(&rng, 0.5, 4);
+        boxes[i] = (AABB){at, vec2_add(at, vec2(w, rng_range(&rng, 0.5, 4)))};
+    }
+    boxes[5] = (AABB){{10, 10}, {10, 10}};
+
+    typedef struct {
+        // Boxes to use, and how far they move before
+        int n;
+        p2_real move;
+        int axis;
+    } test;
+
+    test tests[] =  {
+        {.n=N, .move=0},
+        {.n=N, .move=0.5},
+        {.n=N, .move=0.5},
+        {.n=N, .move=20},
+        {.n=N, .move=0},
+        {.n=N - 30, .move=1},
+        {.n=N - 30, .move=1},
+        {.n=N, .move=3},
+    };
+
+    for (int axis=0; axis<2; axis++) {
+        SweepPrune sap = {.axis = axis};
+        memset(before, 0, sizeof(before));
+        for (int t_i=0; t_i < sizeof(tests)/sizeof(test); t_i++) {
+            test t = tests[t_i];
+            for (int i=0; i<N; i++) {
+                boxes[i] = aabb_offset(boxes[i], vec2(rng_range(&rng, -t.move, t.move), rng_range(&rng, -t.move, t.move) / 4));
+            }
+            // Empty for a step
+            AABB keep = boxes[9];
+            if (t_i == 2) boxes[9] = (AABB){{1, 1}, {0, 0}};
+
+            int count = sweep_prune_update(&sap, boxes, t.n);
+
+            memset(now, 0, sizeof(now));
+            int expect = 0;
+            for (int i=0; i<t.n; i++) {
+                for (int j=i+1; j<t.n; j++) {
+                    now[i][j] = aabb_overlap(boxes[i], boxes[j]);
+                    expect += now[i][j];
+                }
+            }
+            assert(count == expect);
+
+            memset(seen, 0, sizeof(seen));
+            for (int k=0; k<count; k++) {
+                BodyPair p = sap.pairs[k];
+                assert(p.a < p.b && now[p.a][p.b] && !seen[p.a][p.b]);
+                seen[p.a][p.b] = true;
+            }
+
+            // The deltas turn the last pairs into these
+            for (int k=0; k < arrlen(sap.added); k++) {
+                BodyPair p = sap.added[k];
+                assert(!before[p.a][p.b] && now[p.a][p.b]);
+                before[p.a][p.b] = true;
+            }
+            for (int k=0; k < arrlen(sap.removed); k++) {
+                BodyPair p = sap.removed[k];
+                assert(before[p.a][p.b] && !now[p.a][p.b]);
+                before[p.a][p.b] = false;
+            }
+            assert(memcmp(before, now, sizeof(now)) == 0);
+
+            boxes[9] = keep;
+        }
+        sweep_prune_free(&sap);
+    }
+
+    test_passed();
+}
+
+void test_lbvh()
+{
+    test_start("lbvh");
+
+    enum { N = 400 };
+    static AABB boxes[N];
+    static bool found[N][N];
 
+    Rng rng = rng_new(19, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, -80, 80), rng_range(&rng, -80, 80));
+        p2_real size = i % 40 == 0 ? rng_range(&rng, 10, 50) : rng_range(&rng, 0.2, 4);
+        boxes[i] = (AABB){at, vec2_add(at, vec2(size, size))};
+    }
+    // Same centers, so same codes, and empty ones
+    for (int i=100; i<120; i++) boxes[i] = (AABB){{5, 5}, {6 + i % 3, 6}};
+    boxes[3] = boxes[200] = (AABB){{1, 1}, {0, 0}};
+
+    typedef struct {
+        int n;
+        // All boxes on one line, the codes only differ in x
+        bool line;
+    } test;
+
+    test tests[] =  {
+        {.n=N},
+        {.n=N, .line=true},
+        {.n=120},
+        {.n=2},
+        {.n=1},
+        {.n=0},
+    };
+
+    LBVH bvh = {0};
+    for (int t_i=0; t_i < sizeof(tests)/sizeof(test); t_i++) {
+        test t = tests[t_i];
+        static AABB use[N];
+        for (int i=0; i < t.n; i++) {
+            use[i] = boxes[i];
+            if (t.line && !aabb_empty(use[i])) {
+                use[i].max.y -= use[i].min.y;
+                use[i].min.y = 0;
+            }
+        }
+
+        int count = lbvh_update(&bvh, use, t.n);
+        assert(count == arrlen(bvh.pairs));
+
+        memset(found, 0, sizeof(found));
+        for (int k=0; k<count; k++) {
+            BodyPair p = bvh.pairs[k];
+            assert(p.a < p.b && p.b < t.n);
+            assert(!found[p.a][p.b]);
+            assert(aabb_overlap(use[p.a], use[p.b]));
+            found[p.a][p.b] = true;
+        }
+        int expect = 0;
+        for (int i=0; i < t.n; i++) {
+            for (int j=i+1; j < t.n; j++) {
+                if (aabb_empty(use[i]) || aabb_empty(use[j])) continue;
+                expect += aabb_overlap(use[i], use[j]);
+            }
+        }
+        assert(count == expect);
+    }
+    lbvh_free(&bvh);
+
+    test_passed();
+}
+
+void test_static_tree()
+{
+    test_start("static tree");
+
+    enum { N = 400 };
+    static AABB boxes[N];
+    static bool found[N];
+
+    Rng rng = rng_new(23, 0);
+    for (int i=0; i<N; i++) {
+        Vec2 at = vec2(rng_range(&rng, -80, 80), rng_range(&rng, -80, 80));
+        Vec2 size = vec2(rng_range(&rng, 0.5, 8), rng_range(&rng, 0.5, 8));
+        // Long walls and floors
+        if (i % 50 == 0) size = i % 100 == 0 ? vec2(120, 2) : vec2(2, 120);
+        boxes[i] = (AABB){at, vec2_add(at, size)};
+    }
+    // Same boxes, which can't be split, and empty ones
+    for (int i=100; i<140; i++) boxes[i] = (AABB){{5, 5}, {7, 7}};
+    boxes[3] = boxes[200] = (AABB){{1, 1}, {0, 0}};
+
+    typedef struct {
+        int n;
+        // Same centers, only the sizes differ
+        bool same;
+    } test;
+
+    test tests[] =  {
+        {.n=N},
+        {.n=N, .same=true},
+        {.n=5},
+        {.n=1},
+        {.n=0},
+    };
+
+    AABB queries[] = {
+        {{-200, -200}, {200, 200}},
+        {{0, 0}, {10, 10}},
+        {{5, 5}, {5, 5}},
+        {{-30, 40}, {-20, 42}},
+        {{300, 300}, {310, 310}},
+    };
+
+    StaticTree tree = {0};
+    for (int t_i=0; t_i < sizeof(tests)/sizeof(test); t_i++) {
+        test t = tests[t_i];
+        static AABB use[N];
+        for (int i=0; i < t.n; i++) {
+            use[i] = boxes[i];
+            if (t.same) use[i] = (AABB){vec2(-i * 0.01, -i * 0.01), vec2(i * 0.01, i * 0.01)};
+        }
+        static_tree_build(&tree, use, t.n);
+
+        // Every item in exactly one leaf
+        memset(found, 0, sizeof(found));
+        int leaves = 0;
+        for (int k=0; k < arrlen(tree.nodes); k++) {
+            StaticTreeNode node = tree.nodes[k];
+            if (node.child1 != AABB_TREE_NULL) continue;
+            leaves += node.count;
+            for (int i=node.first; i < node.first + node.count; i++) {
+                assert(!found[tree.items[i]]);
+                found[tree.items[i]] = true;
+                assert(aabb_contains(node.box, use[tree.items[i]]));
+            }
+        }
+        int expect = 0;
+        for (int i=0; i < t.n; i++) expect += !aabb_empty(use[i]);
+        assert(leaves == expect);
+
+        for (int q=0; q < sizeof(queries)/sizeof(AABB); q++) {
+            static int items[N];
+            int count = static_tree_query(&tree, queries[q], items, N);
+            memset(found, 0, sizeof(found));
+            for (int k=0; k<count; k++) {
+                assert(!found[items[k]]);
+                found[items[k]] = true;
+            }
+            expect = 0;
+            for (int i=0; i < t.n; i++) {
+                bool hit = !aabb_empty(use[i]) && aabb_overlap(use[i], queries[q]);
+                assert(hit == found[i]);
+                expect += hit;
+            }
+            assert(count == expect);
+
+            // Stops at max_items
+            if (count > 2) assert(static_tree_query(&tree, queries[q], items, 2) == 2);
+        }
+    }
+    static_tree_free(&tree);
+
+    test_passed();
+}
+
+void test_shape_cache()
+{
+    test_start("shape_cache");
+
+    enum { N = 3 };
+    Collider colliders[N] = {0};
+    for (int i=0; i<N; i++) {
+        collider_add_shape(colliders[i], circle(0, 0, 1));
+        collider_add_shape(colliders[i], rect(-2, 1, 4, 1));
+    }
+    collider_add_shape(colliders[1], triangle(0, 0, 1, 0, 0, 1));
+    const Collider *ptrs[N] = {&colliders[0], &colliders[1], &colliders[2]};
+    Vec2 pos[N] = {{0, 0}, {1.5, 0}, {10, 10}};
+
+    ShapeCache cache = {0};
+    assert(shape_cache_update(&cache, ptrs, pos, N) == N);
+    assert(shape_cache_count(&cache) == N);
+    for (int i=0; i<N; i++) {
+        int n;
+        const Shape *shapes = shape_cache_shapes(&cache, i, &n);
+        assert(n == collider_count(&colliders[i]));
+        for (int j=0; j<n; j++) {
+            Shape want = shape_offset(pos[i], colliders[i].shapes[j]);
+            assert(memcmp(&shapes[j], &want, sizeof(Shape)) == 0);
+        }
+    }
+
+    // Nothing moved, nothing placed
+    assert(shape_cache_update(&cache, ptrs, pos, N) == 0);
+    pos[2] = vec2(1, 1);
+    assert(shape_cache_update(&cache, ptrs, pos, N) == 1);
+
+    // Same contacts as collider_collide
+    for (int a=0; a<N; a++) {
+        for (int b=0; b<N; b++) {
+            if (a == b) continue;
+            ColliderContact want[16], got[16];
+            int n = collider_collide(pos[a], &colliders[a], pos[b], &colliders[b], want, 16);
+            assert(shape_cache_collide(&cache, a, b, got, 16) == n);
+            for (int k=0; k<n; k++) {
+                assert(got[k].shape1 == want[k].shape1 && got[k].shape2 == want[k].shape2);
+                assert(vec2_equal(got[k].manifold.normal, want[k].manifold.normal));
+            }
+        }
+    }
+
+    // A new shape places everything again
+    collider_add_shape(colliders[0], point(0, 0));
+    assert(shape_cache_update(&cache, ptrs, pos, N) == N);
+    int n;
+    shape_cache_shapes(&cache, 0, &n);
+    assert(n == 3);
+
+    for (int i=0; i<N; i++) collider_free(colliders[i]);
+    shape_cache_free(&cache);
+
+    test_passed();
+}
 
 int main()
 {
@@ -222,6 +2047,30 @@ int main()
     test_map();
     test_vec2_add();
     test_vec2_sub();
+    test_vec2_lerp();
+    test_vec2_array();
+    test_body_store();
+    test_integrators();
+    test_sleep();
+    test_body_pool();
+    test_forces();
+    test_rng();
+    test_fixed();
+    test_shape_collide();
+    test_sat();
+    test_gjk();
+    test_manifold();
+    test_contact_cache();
+    test_circle_collide_n();
+    test_collider_collide();
+    test_collider_bounds();
+    test_poly();
+    test_shape_cache();
+    test_grid();
+    test_aabb_tree();
+    test_sweep_prune();
+    test_lbvh();
+    test_static_tree();
     /* test_rect_to_quad(); */
 
     all_test_passed();
@@ -17,7 +17,7 @@ void Update(float dt)
 {
 }
 
-void Draw(void)
+void Draw(float alpha)
 {
     ClearBackground(RAYWHITE);
 }
@@ -16,7 +16,7 @@ void Update(float dt)
 {
 }
 
-void Draw(void)
+void Draw(float alpha)
 {
     ClearBackground(RAYWHITE);
 }
@@ -16,6 +16,7 @@ Ball player = {
     .radius = 50,
     .body = {
         .pos = {100, 100},
+        .prev_pos = {100, 100},
         .mass = 50,
     }
 };
@@ -25,6 +26,7 @@ Ball player1 = {
     .radius = 100,
     .body = {
         .pos = {400, 100},
+        .prev_pos = {400, 100},
         .mass = 100,
     }
 };
@@ -46,8 +48,8 @@ void ProcessEvents()
     int key = GetKeyPressed();
     if (key == 'S') {
         if (start) {
-            player.body.pos = vec2(100, 100);
-            player1.body.pos = vec2(400, 100);
+            body_set_pos(&player.body, vec2(100, 100));
+            body_set_pos(&player1.body, vec2(400, 100));
         }
         start = !start;
     }
@@ -104,16 +106,17 @@ void Update(float dt)
     }
 }
 
-void draw_ball(Ball ball)
+void draw_ball(Ball ball, float alpha)
 {
-    DrawCircle(ball.body.pos.x, ball.body.pos.y, ball.radius, ball.color);
+    Vec2 pos = body_lerp_pos(&ball.body, alpha);
+    DrawCircle(pos.x, pos.y, ball.radius, ball.color);
 }
 
-void Draw()
+void Draw(float alpha)
 {
     ClearBackground(RAYWHITE);
-    draw_ball(player);
-    draw_ball(player1);
+    draw_ball(player, alpha);
+    draw_ball(player1, alpha);
 
     DrawText("Inside draw.c", 190, 200, 20, LIGHTGRAY);
 }
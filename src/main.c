@@ -1,23 +1,69 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <raylib.h>
 #include <time.h>
+#include <math.h>
 
 #if defined(PLATFORM_WEB)
 #include <emscripten/emscripten.h>
 #endif
 
+// Physics updates run at a fixed rate, independent of the frame rate.
+#define PHYSICS_HZ 60
+// Most physics updates to run in one frame. After a long frame the time
+// left over is dropped instead of trying to catch up (spiral of death).
+#define PHYSICS_MAX_STEPS 5
+
 void Init(int width, int height);
 void ProcessEvents(void);
-void Update(float);     // Update and Draw one frame
-void Draw(void);
+void Update(float);     // Update one fixed physics step
+void Draw(float);       // Draw one frame, alpha of the way to the next physics step
+void rng_seed_default(uint64_t seed);
+
+// FixedStep turns variable frame times into a whole number of fixed steps.
+typedef struct FixedStep {
+    float dt;
+    int max_steps;
+    // Time not yet simulated
+    float accumulator;
+} FixedStep;
+
+FixedStep fixed_step_new(float hz, int max_steps)
+{
+    return (FixedStep){
+        .dt = 1.0f / hz,
+        .max_steps = max_steps,
+        .accumulator = 0,
+    };
+}
+
+// Adds the frame time and returns how many fixed steps to run this frame.
+int fixed_step_advance(FixedStep *fs, float frame_time)
+{
+    fs->accumulator += frame_time;
+
+    int steps = (int)(fs->accumulator / fs->dt);
+    if (steps > fs->max_steps) {
+        steps = fs->max_steps;
+        fs->accumulator = steps * fs->dt + fmodf(fs->accumulator, fs->dt);
+    }
+    fs->accumulator -= steps * fs->dt;
+    return steps;
+}
+
+// How far between the last step and the next one the frame is, from 0 to 1.
+float fixed_step_alpha(const FixedStep *fs)
+{
+    return fs->accumulator / fs->dt;
+}
 
 int main(void)
 {
     const int screenWidth = 800;
     const int screenHeight = 450;
 
-    srand(time(NULL));
+    rng_seed_default(time(NULL));
 
     InitWindow(screenWidth, screenHeight, "Physics 2D Simulation");
     SetWindowPosition(100, 100);
@@ -30,16 +76,20 @@ int main(void)
 
     Init(screenWidth, screenHeight);
 
+    FixedStep physics = fixed_step_new(PHYSICS_HZ, PHYSICS_MAX_STEPS);
+
     while (!WindowShouldClose())    // Detect window close button or ESC key
     {
         ProcessEvents();
 
-        float dt = GetFrameTime();
-        Update(dt);
+        int steps = fixed_step_advance(&physics, GetFrameTime());
+        for (int i=0; i<steps; i++) {
+            Update(physics.dt);
+        }
 
         BeginDrawing();
             DrawFPS(10, 10);
-            Draw();
+            Draw(fixed_step_alpha(&physics));
         EndDrawing();
 
     }
@@ -4,7 +4,8 @@
 
 #include "../lib/nature2d.h"
 
-Object boundary;
+// Holds the walls around the screen as statics
+World world;
 
 Object ball = {0};
 Object ball2 = {0};
@@ -13,8 +14,19 @@ Vec2 controller_direction;
 
 void Init(int width, int height)
 {
-    body_init(&boundary.body,  vec2zero, 0);
-    collider_add_shape(boundary.collier, rect(10, 10, width-20, height-20));
+    world = world_new(width, height);
+    Shape walls[] = {
+        rect(0, 0, width, 10),
+        rect(0, height-10, width, 10),
+        rect(0, 10, 10, height-20),
+        rect(width-10, 10, 10, height-20),
+    };
+    for (int i=0; i<4; i++) {
+        Object wall = basic_object;
+        body_init(&wall.body, vec2zero, 0);
+        collider_add_shape(wall.collier, walls[i]);
+        world_add_static(&world, wall);
+    }
 
     body_init(&ball.body,  vec2(100, 100), 50);
     /* ball.body.max_speed = 150; */
@@ -58,8 +70,8 @@ void ProcessEvents(void)
 
 void Update(float dt)
 {
-    Collision collision = object_detect_collision(&ball, &ball2);
-    if (collision.hit) {
+    Manifold collision = object_detect_collision(&ball, &ball2);
+    if (collision.count > 0) {
         /* Vec2 dir = vec2_add(collision[0], ball.body.pos); */
         /* dir = vec2_normalize(dir); */
         /* double speed = vec2_mag(ball.body.vel); */
@@ -67,7 +79,7 @@ void Update(float dt)
         ball.body.vel = vec2_mult(ball.body.vel, -1);
 
         printf("collision detection\n");
-        debug_vec2("colllision.dir", collision.dir);
+        debug_vec2("colllision.normal", collision.normal);
         /* Vec2 move = vec2_set_mag(collision.dir, 30); */
         /* ball.body.pos = vec2_add(ball.body.pos, move); */
 
@@ -77,6 +89,20 @@ void Update(float dt)
     /* Vec2 wind = vec2(0, 500); */
     /* body_apply_force(&ball.body, wind); */
 
+    // Push the ball out of the walls, and bounce only if it is moving in,
+    // so it can't flip back and forth while still inside. In a corner it
+    // touches two walls at once.
+    ColliderContact contacts[4];
+    int num_contacts = world_collide_statics(&world, &ball, contacts, 4);
+    for (int i=0; i<num_contacts; i++) {
+        Vec2 normal = contacts[i].manifold.normal;
+        ball.body.pos = vec2_add(ball.body.pos, vec2_mult(normal, contacts[i].manifold.depth));
+        double into = vec2_dot(ball.body.vel, normal);
+        if (into < 0) {
+            ball.body.vel = vec2_sub(ball.body.vel, vec2_mult(normal, 2 * into));
+        }
+    }
+
     Vec2 force = vec2_set_mag(controller_direction, 10000);
     body_apply_force(&ball.body, force);
 
@@ -86,12 +112,12 @@ void Update(float dt)
     object_update(&ball2, dt);
 }
 
-void Draw(void)
+void Draw(float alpha)
 {
     ClearBackground(LIGHTGRAY);
 
-    object_draw(&ball);
-    object_draw(&ball2);
-    /* object_draw(&boundary); */
+    object_draw(&ball, alpha);
+    object_draw(&ball2, alpha);
+    world_draw(&world, alpha);
 }
 